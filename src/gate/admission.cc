@@ -0,0 +1,133 @@
+//
+// kumofs
+//
+// Copyright (C) 2009 FURUHASHI Sadayuki
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+//
+#include "gate/admission.h"
+#include "gate/interface.h"
+#include "log/mlogger.h"
+#include "log/logpacker.h"
+
+namespace kumo {
+namespace gate {
+
+
+static unsigned int s_request_limit = 0;
+static size_t s_byte_limit = 0;
+
+// totals of all client connections
+static volatile unsigned int s_requests = 0;
+static volatile size_t s_bytes = 0;
+static volatile unsigned int s_suspended = 0;
+static volatile unsigned long s_suspend_count = 0;
+
+
+admission::admission(mp::wavy::core* reactor, int fd) :
+	m_reactor(reactor), m_fd(fd),
+	m_requests(0), m_bytes(0), m_suspended(0) { }
+
+admission::~admission() { }
+
+
+admission::ticket::ticket(const shared_admission& adm, size_t bytes) :
+	m_adm(adm), m_bytes(bytes)
+{
+	__sync_add_and_fetch(&m_adm->m_requests, 1);
+	__sync_add_and_fetch(&m_adm->m_bytes, bytes);
+	__sync_add_and_fetch(&s_requests, 1);
+	__sync_add_and_fetch(&s_bytes, bytes);
+}
+
+admission::ticket::~ticket()
+{
+	m_adm->release(m_bytes);
+}
+
+
+void admission::set_limits(unsigned int requests, size_t bytes)
+{
+	s_request_limit = requests;
+	s_byte_limit = bytes;
+}
+
+bool admission::exceeded() const
+{
+	return (s_request_limit && m_requests >= s_request_limit) ||
+		(s_byte_limit && m_bytes >= s_byte_limit);
+}
+
+void admission::check_limits()
+{
+	if(!exceeded()) { return; }
+
+	if(!__sync_bool_compare_and_swap(&m_suspended, 0, 1)) { return; }
+	LOG_TRACE("suspend reading fd=",m_fd," requests=",m_requests," bytes=",m_bytes);
+
+	if(m_reactor) {
+		m_reactor->suspend_read(m_fd);
+	} else {
+		wavy::suspend_read(m_fd);
+	}
+	__sync_add_and_fetch(&s_suspended, 1);
+	__sync_add_and_fetch(&s_suspend_count, 1);
+
+	// the tickets may be released before m_suspended is set
+	if(!exceeded()) {
+		resume();
+	}
+}
+
+void admission::release(size_t bytes)
+{
+	__sync_sub_and_fetch(&m_requests, 1);
+	__sync_sub_and_fetch(&m_bytes, bytes);
+	__sync_sub_and_fetch(&s_requests, 1);
+	__sync_sub_and_fetch(&s_bytes, bytes);
+
+	if(m_suspended && !exceeded()) {
+		resume();
+	}
+}
+
+void admission::resume()
+{
+	if(!__sync_bool_compare_and_swap(&m_suspended, 1, 0)) { return; }
+	LOG_TRACE("resume reading fd=",m_fd);
+
+	__sync_sub_and_fetch(&s_suspended, 1);
+
+	// Note: the fd may be closed already.
+	//       the wavy core ignores it in that case.
+	if(m_reactor) {
+		m_reactor->resume_read(m_fd);
+	} else {
+		wavy::resume_read(m_fd);
+	}
+}
+
+
+void admission::log_stats()
+{
+	TLOGPACK("ad",3,
+			"requests", (uint64_t)s_requests,
+			"bytes", (uint64_t)s_bytes,
+			"suspended", (uint64_t)s_suspended,
+			"suspend_count", (uint64_t)s_suspend_count);
+}
+
+
+}  // namespace gate
+}  // namespace kumo
+
@@ -0,0 +1,92 @@
+//
+// kumofs
+//
+// Copyright (C) 2009 FURUHASHI Sadayuki
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+//
+#ifndef KUMO_GATE_ADMISSION_H__
+#define KUMO_GATE_ADMISSION_H__
+
+#include <mp/wavy.h>
+#include <mp/memory.h>
+#include <stddef.h>
+
+namespace kumo {
+namespace gate {
+
+
+class admission;
+typedef mp::shared_ptr<admission> shared_admission;
+
+
+// Admission control of the requests from a client connection.
+// Each request holds a ticket in its life zone until its response is
+// written. The connection stops reading its socket while the tickets
+// exceed the limits, and restarts when enough of them are released.
+class admission {
+public:
+	// reactor is NULL if the connection is served by the shared wavy core
+	admission(mp::wavy::core* reactor, int fd);
+	~admission();
+
+	class ticket {
+	public:
+		ticket(const shared_admission& adm, size_t bytes);
+		~ticket();
+
+	private:
+		shared_admission m_adm;
+		size_t m_bytes;
+
+	private:
+		ticket();
+		ticket(const ticket&);
+	};
+
+	// called at the end of read_event().
+	// suspends reading the socket if the connection exceeds the limits.
+	void check_limits();
+
+	// true if the connection exceeds the limits.
+	// read_event stops reading the socket while it is true.
+	bool exceeded() const;
+
+	// limits of each connection. 0: unlimited
+	static void set_limits(unsigned int requests, size_t bytes);
+
+	// writes the depths of all client connections to the binary log
+	static void log_stats();
+
+private:
+	void release(size_t bytes);
+	void resume();
+
+	mp::wavy::core* m_reactor;
+	int m_fd;
+
+	volatile unsigned int m_requests;
+	volatile size_t m_bytes;
+	volatile int m_suspended;
+
+private:
+	admission();
+	admission(const admission&);
+};
+
+
+}  // namespace gate
+}  // namespace kumo
+
+#endif /* gate/admission.h */
+
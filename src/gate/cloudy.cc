@@ -17,8 +17,11 @@
 //
 #include "gate/cloudy.h"
 #include "gate/memproto/memproto.h"
+#include "gate/admission.h"
 #include "log/mlogger.h"
 #include "rpc/exception.h"
+#include "rpc/pool.h"
+#include "rpc/read_sizer.h"
 #include <mp/object_callback.h>
 #include <mp/stream_buffer.h>
 #include <stdexcept>
@@ -43,12 +46,15 @@ using gate::wavy;
 using gate::shared_zone;
 using gate::auto_zone;
 
+static unsigned int g_budget_msec = 0;
+
 static const size_t CLOUDY_INITIAL_ALLOCATION_SIZE = 32*1024;
 static const size_t CLOUDY_RESERVE_SIZE = 4*1024;
+static const size_t CLOUDY_RESERVE_MAX = 1024*1024;
 
 class handler : public wavy::handler {
 public:
-	handler(int fd);
+	handler(int fd, mp::wavy::core* reactor);
 	~handler();
 
 public:
@@ -59,7 +65,8 @@ public:
 
 	class context {
 	public:
-		context(int fd, mp::stream_buffer* buf, const shared_valid& valid);
+		context(int fd, mp::stream_buffer* buf, const shared_valid& valid,
+				const gate::shared_admission& adm);
 		~context();
 
 	public:
@@ -67,10 +74,15 @@ public:
 		msgpack::zone* release_reference();
 		const shared_valid& valid() { return m_valid; }
 
+		// size of the request being dispatched
+		void set_request_size(size_t size) { m_request_size = size; }
+
 	private:
 		int m_fd;
 		mp::stream_buffer* m_buffer;
 		shared_valid m_valid;
+		gate::shared_admission m_admission;
+		size_t m_request_size;
 
 	private:
 		context();
@@ -79,8 +91,10 @@ public:
 
 private:
 	mp::stream_buffer m_buffer;
+	rpc::read_sizer m_sizer;
 	memproto_parser m_memproto;
 	shared_valid m_valid;
+	gate::shared_admission m_admission;
 
 	context m_context;
 
@@ -187,7 +201,7 @@ void send_response(
 
 #define RELEASE_REFERENCE(user, fd, life) \
 	handler::context* ctx = static_cast<handler::context*>(user); \
-	shared_zone life(ctx->release_reference());
+	shared_zone life(ctx->release_reference(), &rpc::zone_pool::release);
 
 
 static const uint32_t ZERO_FLAG = 0;
@@ -274,6 +288,7 @@ void request_getx(void* user,
 	req.keylen   = keylen;
 	req.key      = key;
 	req.user     = static_cast<void*>(e);
+	req.budget_msec = g_budget_msec;
 	req.callback = &response_getx;
 	req.life     = life;
 
@@ -304,6 +319,7 @@ void request_set(void* user,
 	req.vallen   = vallen;
 	req.val      = val;
 	req.user     = static_cast<void*>(e);
+	req.budget_msec = g_budget_msec;
 	req.callback = &response_set;
 	req.life     = life;
 
@@ -331,6 +347,7 @@ void request_delete(void* user,
 	req.key      = key;
 	req.keylen   = keylen;
 	req.user     = static_cast<void*>(e);
+	req.budget_msec = g_budget_msec;
 	req.callback = &response_delete;
 	req.life     = life;
 
@@ -338,28 +355,34 @@ void request_delete(void* user,
 }
 
 
-handler::context::context(int fd, mp::stream_buffer* buf, const shared_valid& valid) :
-	m_fd(fd), m_buffer(buf), m_valid(valid) { }
+handler::context::context(int fd, mp::stream_buffer* buf, const shared_valid& valid,
+		const gate::shared_admission& adm) :
+	m_fd(fd), m_buffer(buf), m_valid(valid),
+	m_admission(adm), m_request_size(0) { }
 
 handler::context::~context() { }
 
 msgpack::zone* handler::context::release_reference()
 {
-	auto_zone z(new msgpack::zone());
+	auto_zone z(rpc::zone_pool::get());
 
 	mp::stream_buffer::reference* ref =
 		z->allocate<mp::stream_buffer::reference>();
 	m_buffer->release_to(ref);
 
+	z->allocate<gate::admission::ticket>(m_admission, m_request_size);
+
 	return z.release();
 }
 
 
-handler::handler(int fd) :
+handler::handler(int fd, mp::wavy::core* reactor) :
 	wavy::handler(fd),
 	m_buffer(CLOUDY_INITIAL_ALLOCATION_SIZE),
+	m_sizer(CLOUDY_RESERVE_SIZE, CLOUDY_RESERVE_MAX),
 	m_valid(new bool(true)),
-	m_context(fd, &m_buffer, m_valid)
+	m_admission(new gate::admission(reactor, fd)),
+	m_context(fd, &m_buffer, m_valid, m_admission)
 {
 	memproto_callback cb = {
 		request_getx,    // get
@@ -392,40 +415,57 @@ handler::~handler()
 
 void handler::read_event()
 try {
-	m_buffer.reserve_buffer(CLOUDY_RESERVE_SIZE);
+	// read till the socket is drained to save the round trips
+	// to the event loop, within the budget for fairness.
+	size_t total = 0;
+	while(true) {
+		m_buffer.reserve_buffer(m_sizer.size());
+		size_t capacity = m_buffer.buffer_capacity();
+
+		ssize_t rl = ::read(fd(), m_buffer.buffer(), capacity);
+		if(rl <= 0) {
+			if(rl == 0) { throw rpc::connection_closed_error(); }
+			if(errno == EAGAIN || errno == EINTR) { break; }
+			else { throw rpc::connection_broken_error(); }
+		}
 
-	size_t rl = ::read(fd(), m_buffer.buffer(), m_buffer.buffer_capacity());
-	if(rl <= 0) {
-		if(rl == 0) { throw rpc::connection_closed_error(); }
-		if(errno == EAGAIN || errno == EINTR) { return; }
-		else { throw rpc::connection_broken_error(); }
-	}
+		m_buffer.buffer_consumed(rl);
 
-	m_buffer.buffer_consumed(rl);
+		do {
+			size_t off = 0;
+			int ret = memproto_parser_execute(&m_memproto,
+					(char*)m_buffer.data(), m_buffer.data_size(), &off);
 
-	do {
-		size_t off = 0;
-		int ret = memproto_parser_execute(&m_memproto,
-				(char*)m_buffer.data(), m_buffer.data_size(), &off);
+			if(ret == 0) {
+				break;
+			}
 
-		if(ret == 0) {
-			break;
-		}
+			if(ret < 0) {
+				//std::cout << "parse error " << ret << std::endl;
+				throw std::runtime_error("parse error");
+			}
 
-		if(ret < 0) {
-			//std::cout << "parse error " << ret << std::endl;
-			throw std::runtime_error("parse error");
-		}
+			m_buffer.data_used(off);
+
+			m_context.set_request_size(off);
+			ret = memproto_dispatch(&m_memproto);
+			if(ret <= 0) {
+				LOG_DEBUG("unknown command ",(uint16_t)-ret);
+				throw std::runtime_error("unknown command");
+			}
 
-		m_buffer.data_used(off);
+		} while(m_buffer.data_size() > 0);
 
-		ret = memproto_dispatch(&m_memproto);
-		if(ret <= 0) {
-			LOG_DEBUG("unknown command ",(uint16_t)-ret);
-			throw std::runtime_error("unknown command");
+		m_sizer.update(rl, capacity, m_buffer.data_size());
+
+		total += rl;
+		if((size_t)rl < capacity || total >= READ_EVENT_BUDGET_SIZE ||
+				m_admission->exceeded()) {
+			break;
 		}
+	}
 
-	} while(m_buffer.data_size() > 0);
+	m_admission->check_limits();
 
 } catch(rpc::connection_error& e) {
 	LOG_DEBUG(e.what());
@@ -439,7 +479,8 @@ try {
 }
 
 
-void accepted(int fd, int err)
+// reactor is NULL if the connection is served by the shared wavy core
+void accepted(mp::wavy::core* reactor, int fd, int err)
 {
 	if(fd < 0) {
 		LOG_FATAL("accept failed: ",strerror(err));
@@ -455,23 +496,45 @@ void accepted(int fd, int err)
 	::setsockopt(fd, SOL_SOCKET, SO_LINGER, (void *)&opt, sizeof(opt));  // ignore error
 #endif
 	LOG_DEBUG("accept Cloudy gate fd=",fd);
-	wavy::add<handler>(fd);
+	if(reactor) {
+		reactor->add<handler>(fd, reactor);
+	} else {
+		wavy::add<handler>(fd, reactor);
+	}
 }
 
 
 }  // noname namespace
 
 
-Cloudy::Cloudy(int lsock) :
-	m_lsock(lsock) { }
+Cloudy::Cloudy(int lsock, unsigned int budget_msec) :
+	m_lsock(lsock), m_reactors(NULL)
+{
+	g_budget_msec = budget_msec;
+}
+
+Cloudy::Cloudy(gate::reactors* rs, const std::vector<int>& lsocks,
+		unsigned int budget_msec) :
+	m_lsock(-1), m_reactors(rs), m_lsocks(lsocks)
+{
+	g_budget_msec = budget_msec;
+}
 
 Cloudy::~Cloudy() {}
 
 void Cloudy::run()
 {
 	using namespace mp::placeholders;
-	wavy::listen(m_lsock,
-			mp::bind(&accepted, _1, _2));
+	if(m_reactors) {
+		for(unsigned int i=0; i < m_lsocks.size(); ++i) {
+			mp::wavy::core* reactor = m_reactors->get(i);
+			reactor->listen(m_lsocks[i],
+					mp::bind(&accepted, reactor, _1, _2));
+		}
+	} else {
+		wavy::listen(m_lsock,
+				mp::bind(&accepted, (mp::wavy::core*)NULL, _1, _2));
+	}
 }
 
 
@@ -19,13 +19,20 @@
 #define KUMO_GATE_CLOUDY_H__
 
 #include "gate/interface.h"
+#include "gate/reactors.h"
+#include <vector>
 
 namespace kumo {
 
 
 class Cloudy : public gate::gate {
 public:
-	Cloudy(int lsock);
+	Cloudy(int lsock, unsigned int budget_msec);
+
+	// lsocks[i] is accepted by rs->get(i)
+	Cloudy(gate::reactors* rs, const std::vector<int>& lsocks,
+			unsigned int budget_msec);
+
 	~Cloudy();
 
 	void run();
@@ -33,6 +40,9 @@ public:
 private:
 	int m_lsock;
 
+	gate::reactors* m_reactors;
+	std::vector<int> m_lsocks;
+
 private:
 	Cloudy();
 	Cloudy(const Cloudy&);
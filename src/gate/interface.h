@@ -60,7 +60,7 @@ struct res_get {
 typedef void (*callback_get)(void* user, res_get& res, auto_zone z);
 
 struct req_get {
-	req_get() : has_user_hash(false) { }
+	req_get() : has_user_hash(false), budget_msec(0) { }
 
 	const char* key;
 	uint32_t keylen;
@@ -68,6 +68,10 @@ struct req_get {
 	bool has_user_hash;
 	uint64_t user_hash;
 
+	// the request fails if it is not finished in this msec.
+	// servers drop it after that. 0: no deadline
+	unsigned int budget_msec;
+
 	shared_zone life;
 	callback_get callback;
 	void* user;
@@ -75,6 +79,22 @@ struct req_get {
 	void submit();
 };
 
+struct req_get_multi {
+	req_get_multi() : num(0), budget_msec(0) { }
+
+	unsigned int num;
+	const char** keys;
+	uint32_t* keylens;
+
+	unsigned int budget_msec;
+
+	shared_zone life;
+	callback_get callback;
+	void** users;  // callback is called with users[i] for keys[i]
+
+	void submit();
+};
+
 
 enum set_op_t {
 	OP_SET       = 0,
@@ -82,6 +102,8 @@ enum set_op_t {
 	OP_CAS       = 2,
 	OP_APPEND    = 3,
 	OP_PREPEND   = 4,
+	OP_ADD       = 5,
+	OP_REPLACE   = 6,
 };
 
 
@@ -97,13 +119,13 @@ struct res_set {
 	uint32_t vallen;
 	uint64_t clocktime;
 
-	bool cas_success;
+	bool cas_success;  // false if cas, add or replace failed
 };
 
 typedef void (*callback_set)(void* user, res_set& res, auto_zone z);
 
 struct req_set {
-	req_set() : has_user_hash(false), operation(OP_SET) { }
+	req_set() : has_user_hash(false), operation(OP_SET), budget_msec(0) { }
 
 	const char* key;
 	uint32_t keylen;
@@ -117,6 +139,8 @@ struct req_set {
 	set_op_t operation;
 	uint64_t clocktime;
 
+	unsigned int budget_msec;
+
 	shared_zone life;
 	callback_set callback;
 	void* user;
@@ -139,7 +163,7 @@ struct res_delete {
 typedef void (*callback_delete)(void* user, res_delete& res, auto_zone z);
 
 struct req_delete {
-	req_delete() : has_user_hash(false), async(false) { }
+	req_delete() : has_user_hash(false), async(false), budget_msec(0) { }
 
 	const char* key;
 	uint32_t keylen;
@@ -149,6 +173,8 @@ struct req_delete {
 
 	bool async;
 
+	unsigned int budget_msec;
+
 	shared_zone life;
 	callback_delete callback;
 	void* user;
@@ -157,6 +183,70 @@ struct req_delete {
 };
 
 
+struct res_incr {
+	int error;
+
+	const char* key;
+	uint32_t keylen;
+
+	uint64_t hash;
+
+	bool found;  // false if the key is not found
+	bool non_numeric;  // true if the value is not a number
+	uint64_t value;
+	uint64_t clocktime;
+};
+
+typedef void (*callback_incr)(void* user, res_incr& res, auto_zone z);
+
+struct req_incr {
+	req_incr() : has_user_hash(false), decrement(false),
+		offset(0), initial(NULL), initiallen(0), budget_msec(0) { }
+
+	const char* key;
+	uint32_t keylen;
+
+	bool has_user_hash;
+	uint64_t user_hash;
+
+	uint64_t delta;
+	bool decrement;
+
+	// the counter is decimal digits after offset bytes of the value
+	uint16_t offset;
+
+	// stored if the key is not found and it is not NULL
+	const char* initial;
+	uint32_t initiallen;
+
+	unsigned int budget_msec;
+
+	shared_zone life;
+	callback_incr callback;
+	void* user;
+
+	void submit();
+};
+
+
+struct res_flush {
+	int error;
+
+	uint64_t clocktime;  // values stored before it are flushed
+};
+
+typedef void (*callback_flush)(void* user, res_flush& res, auto_zone z);
+
+// invalidates all values stored in the cluster
+struct req_flush {
+	shared_zone life;
+	callback_flush callback;
+	void* user;
+
+	void submit();
+};
+
+
 }  // namespace gate
 }  // namespace kumo
 
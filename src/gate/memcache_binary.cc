@@ -17,12 +17,16 @@
 //
 #include "gate/memcache_binary.h"
 #include "gate/memproto/memproto.h"
+#include "gate/admission.h"
 #include "log/mlogger.h"
 #include "rpc/exception.h"
+#include "rpc/pool.h"
+#include "rpc/read_sizer.h"
 #include <mp/object_callback.h>
 #include <mp/stream_buffer.h>
 #include <stdexcept>
 #include <string.h>
+#include <stdio.h>
 #include <errno.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -31,15 +35,15 @@
 #include <sys/uio.h>
 #include <sys/time.h>
 #include <unistd.h>
-#include <algorithm>
 #include <memory>
-#include <deque>
+#include <vector>
 
 namespace kumo {
 namespace {
 
 static bool g_save_flag = false;
 static bool g_save_exptime = false;
+static unsigned int g_budget_msec = 0;
 static uint32_t g_system_time;
 
 #define RELATIVE_MAX (60*60*24*30)
@@ -68,10 +72,11 @@ using gate::auto_zone;
 
 static const size_t MEMPROTO_INITIAL_ALLOCATION_SIZE = 32*1024;
 static const size_t MEMPROTO_RESERVE_SIZE = 4*1024;
+static const size_t MEMPROTO_RESERVE_MAX = 1024*1024;
 
 class handler : public wavy::handler {
 public:
-	handler(int fd);
+	handler(int fd, mp::wavy::core* reactor);
 	~handler();
 
 public:
@@ -93,6 +98,11 @@ private:
 			const char* key, uint16_t keylen,
 			uint32_t expiration);
 
+	// increment, decrement
+	void request_incr(memproto_header* h,
+			const char* key, uint16_t keylen,
+			uint64_t amount, uint64_t initial, uint32_t expiration);
+
 	// noop
 	void request_noop(memproto_header* h);
 
@@ -102,6 +112,7 @@ private:
 private:
 	memproto_parser m_memproto;
 	mp::stream_buffer m_buffer;
+	rpc::read_sizer m_sizer;
 
 	struct entry;
 
@@ -118,27 +129,26 @@ private:
 		void invalidate();
 
 	private:
-		bool m_valid;
-		int m_fd;
+		void flush();
+		void send_ready();
+		bool is_head_ready();
+		void grow();
+		static bool consume(entry* e, shared_zone* result);
 
-		struct element_t {
-			element_t(entry* a) : e(a), vec(NULL), veclen(0) { }
-
-			void filled() { e = NULL; }
-			bool is_filled() const { return e == NULL; }
-
-			entry* e;
-			shared_zone life;
-			struct iovec* vec;
-			size_t veclen;
-		};
-
-		mp::pthread_mutex m_queue_mutex;
+		volatile bool m_valid;
+		int m_fd;
 
-		typedef std::deque<element_t> queue_t;
-		queue_t m_queue;
+		// entries indexed by the sequence number of the request.
+		// the size is power of 2.
+		mp::pthread_mutex m_ring_mutex;
+		std::vector<entry*> m_ring;
+		volatile uint64_t m_head;  // the oldest unsent entry
+		uint64_t m_tail;
 
-		struct find_entry_compare;
+		// held by the thread sending the ready responses
+		mp::pthread_mutex m_flush_mutex;
+		std::vector<struct iovec> m_flush_vec;
+		std::vector<wavy::request> m_flush_req;
 
 	private:
 		response_queue();
@@ -148,10 +158,28 @@ private:
 	typedef mp::shared_ptr<response_queue> shared_entry_queue;
 	shared_entry_queue m_queue;
 
+	gate::shared_admission m_admission;
+	size_t m_request_size;  // size of the request being dispatched
+
+
+	enum entry_state {
+		ENTRY_PENDING  = 0,
+		ENTRY_READY    = 1,
+		ENTRY_CONSUMED = 2,
+	};
 
 	struct entry {
+		entry() : state(ENTRY_PENDING), vec(NULL), veclen(0) { }
+
 		shared_entry_queue queue;
 		memproto_header header;
+
+		// set by the response_queue
+		uint64_t seq;
+		volatile int state;
+		shared_zone life;
+		struct iovec* vec;
+		size_t veclen;
 	};
 
 
@@ -171,6 +199,8 @@ private:
 			gate::res_set& res, auto_zone z);
 	static void response_cas(void* user,
 			gate::res_set& res, auto_zone z);
+	static void response_add(void* user,
+			gate::res_set& res, auto_zone z);
 
 
 	// delete
@@ -180,6 +210,20 @@ private:
 			gate::res_delete& res, auto_zone z);
 
 
+	// increment, decrement
+	struct incr_entry : entry {
+	};
+	static void response_incr(void* user,
+			gate::res_incr& res, auto_zone z);
+
+
+	// flush
+	struct flush_entry : entry {
+	};
+	static void response_flush(void* user,
+			gate::res_flush& res, auto_zone z);
+
+
 	static void send_response_nosend(entry* e, auto_zone z);
 
 	static void send_response_nodata(entry* e, auto_zone z,
@@ -203,8 +247,12 @@ private:
 };
 
 
+static const size_t RESPONSE_RING_INITIAL_SIZE = 64;
+
 handler::response_queue::response_queue(int fd) :
-	m_valid(true), m_fd(fd) { }
+	m_valid(true), m_fd(fd),
+	m_ring(RESPONSE_RING_INITIAL_SIZE, NULL),
+	m_head(0), m_tail(0) { }
 
 handler::response_queue::~response_queue() { }
 
@@ -214,122 +262,146 @@ inline int handler::response_queue::is_valid() const
 	return m_valid;
 }
 
-inline void handler::response_queue::invalidate()
+void handler::response_queue::invalidate()
 {
 	m_valid = false;
+	__sync_synchronize();
 
 	// untie circular reference.
-	// m_queue -> element_t -> shared_zone -> {get,set,delete}_entry
-	// -> m_queue.
-	mp::pthread_scoped_lock mqlk(m_queue_mutex);
-	m_queue.clear();
+	// entry -> shared_zone -> {get,set,delete}_entry -> m_queue.
+	// responses reached after this are released by reached_try_send.
+	mp::pthread_scoped_lock fllk(m_flush_mutex);
+	mp::pthread_scoped_lock rlk(m_ring_mutex);
+	const uint64_t mask = m_ring.size() - 1;
+	for(; m_head != m_tail; ++m_head) {
+		shared_zone life;
+		consume(m_ring[m_head & mask], &life);
+		m_ring[m_head & mask] = NULL;
+	}
 }
 
 
 void handler::response_queue::push_entry(entry* e)
 {
-	element_t m(e);
-
-	mp::pthread_scoped_lock mqlk(m_queue_mutex);
-	m_queue.push_back(m);
+	mp::pthread_scoped_lock rlk(m_ring_mutex);
+	if(m_tail - m_head == m_ring.size()) {
+		grow();
+	}
+	e->seq = m_tail;
+	m_ring[m_tail & (m_ring.size() - 1)] = e;
+	++m_tail;
 }
 
+void handler::response_queue::grow()
+{
+	std::vector<entry*> ring(m_ring.size() * 2, NULL);
+	const uint64_t mask = m_ring.size() - 1;
+	const uint64_t nmask = ring.size() - 1;
+	for(uint64_t seq = m_head; seq != m_tail; ++seq) {
+		ring[seq & nmask] = m_ring[seq & mask];
+	}
+	m_ring.swap(ring);
+}
 
-struct handler::response_queue::find_entry_compare {
-	find_entry_compare(entry* key) : m_key(key) { }
 
-	bool operator() (const element_t& elem)
-	{
-		return elem.e == m_key;
+inline bool handler::response_queue::consume(entry* e, shared_zone* result)
+{
+	if(!__sync_bool_compare_and_swap(&e->state, ENTRY_READY, ENTRY_CONSUMED)) {
+		return false;
 	}
-
-	entry* m_key;
-};
+	result->swap(e->life);
+	return true;
+}
 
 void handler::response_queue::reached_try_send(
 		entry* e, auto_zone z,
 		struct iovec* vec, size_t veclen)
 {
-	mp::pthread_scoped_lock mqlk(m_queue_mutex);
-
-	queue_t::iterator found = std::find_if(m_queue.begin(), m_queue.end(),
-			find_entry_compare(e));
-
-	if(found == m_queue.end()) {
-		// invalidated
+	// the last reference may be released with the response
+	shared_entry_queue self(e->queue);
+
+	e->life.reset(z.release());
+	e->vec = vec;
+	e->veclen = veclen;
+	__sync_synchronize();
+	e->state = ENTRY_READY;
+	__sync_synchronize();
+
+	if(!m_valid) {
+		shared_zone life;
+		consume(e, &life);
 		return;
 	}
 
-	shared_zone life(z.release());
-
-	found->life = life;
-	found->vec = vec;
-	found->veclen = veclen;
-	found->filled();
+	if(e->seq != m_head) {
+		// sent by the thread that completes the preceding responses
+		return;
+	}
 
-	do {
-		element_t& elem(m_queue.front());
+	flush();
+}
 
-		if(!elem.is_filled()) {
-			break;
+void handler::response_queue::flush()
+{
+	while(m_flush_mutex.trylock()) {
+		try {
+			send_ready();
+		} catch (...) {
+			m_flush_mutex.unlock();
+			throw;
 		}
+		m_flush_mutex.unlock();
 
-		if(elem.veclen > 0) {
-			std::auto_ptr<shared_zone> sz(new shared_zone(elem.life));
-			wavy::request req(&mp::object_delete<shared_zone>, sz.get());
-			wavy::writev(m_fd, elem.vec, elem.veclen, req);
-			sz.release();
+		// responses reached while sending are not sent by their threads
+		__sync_synchronize();
+		if(!is_head_ready()) {
+			break;
 		}
-
-		m_queue.pop_front();
-	} while(!m_queue.empty());
-
-#if 0
-	size_t reqlen = 0;
-
-	queue_t::iterator qlast = m_queue.begin();
-	for(queue_t::const_iterator qend = m_queue.end(); qlast != qend; ++qlast) {
-		if(qlast->e) { break; }
-		reqlen += qlast->veclen;
 	}
+}
 
-	if(reqlen == 0) { return; }
-
-	// optimize
-	//if(m_queue.begin() + 1 == qlast) {
-	//}
-
-	typedef mp::wavy::output::request wavy_request;
-
-	struct iovec* const vb = (struct iovec*)found->life->malloc(
-			sizeof(struct iovec) * reqlen);
-
-	wavy_request* const vr = (wavy_request*)found->life->malloc(
-			sizeof(wavy_request) * reqlen);
-
-	memset(vr, 0, sizeof(wavy_request) * reqlen);
-
+bool handler::response_queue::is_head_ready()
+{
+	mp::pthread_scoped_lock rlk(m_ring_mutex);
+	if(!m_valid || m_head == m_tail) {
+		return false;
+	}
+	return m_ring[m_head & (m_ring.size() - 1)]->state == ENTRY_READY;
+}
 
-	struct iovec* vbp = vb;
-	wavy_request* vrp = vr;
+void handler::response_queue::send_ready()
+{
+	// sends the contiguous ready responses with one writev
+	m_flush_vec.clear();
+	m_flush_req.clear();
 
-	for(queue_t::const_iterator q(m_queue.begin()); q != qlast; ++q) {
-		memcpy(vbp, q->vec, sizeof(struct iovec) * q->veclen);
+	{
+		mp::pthread_scoped_lock rlk(m_ring_mutex);
+		if(!m_valid) { return; }
 
-		vrp[q->veclen-1] = wavy_request(
-				&mp::object_delete<shared_zone>,
-				new shared_zone(q->life));
+		const uint64_t mask = m_ring.size() - 1;
+		for(; m_head != m_tail; ++m_head) {
+			entry* e = m_ring[m_head & mask];
 
-		vbp += q->veclen;
-		vrp += q->veclen;
+			shared_zone life;
+			if(!consume(e, &life)) {
+				break;
+			}
+			m_ring[m_head & mask] = NULL;
+
+			if(e->veclen > 0) {
+				m_flush_vec.insert(m_flush_vec.end(), e->vec, e->vec + e->veclen);
+				m_flush_req.resize(m_flush_vec.size());
+				m_flush_req.back() = wavy::request(
+						&mp::object_delete<shared_zone>,
+						new shared_zone(life));
+			}
+		}
 	}
 
-	m_queue.erase(m_queue.begin(), qlast);
-
-	mqlk.unlock();
-
-	wavy::writev(m_fd, vb, vr, reqlen);
-#endif
+	if(!m_flush_vec.empty()) {
+		wavy::writev(m_fd, &m_flush_vec[0], &m_flush_req[0], m_flush_vec.size());
+	}
 }
 
 
@@ -415,10 +487,13 @@ void handler::send_response(
 }
 
 
-handler::handler(int fd) :
+handler::handler(int fd, mp::wavy::core* reactor) :
 	wavy::handler(fd),
 	m_buffer(MEMPROTO_INITIAL_ALLOCATION_SIZE),
-	m_queue(new response_queue(fd))
+	m_sizer(MEMPROTO_RESERVE_SIZE, MEMPROTO_RESERVE_MAX),
+	m_queue(new response_queue(fd)),
+	m_admission(new gate::admission(reactor, fd)),
+	m_request_size(0)
 {
 	void (*cmd_getx)(void*, memproto_header*,
 			const char*, uint16_t) = &mp::object_callback<void (memproto_header*,
@@ -441,6 +516,13 @@ handler::handler(int fd) :
 				uint32_t)>
 				::mem_fun<handler, &handler::request_delete>;
 
+	void (*cmd_incr)(void*, memproto_header*,
+			const char*, uint16_t,
+			uint64_t, uint64_t, uint32_t) = &mp::object_callback<void (memproto_header*,
+				const char*, uint16_t,
+				uint64_t, uint64_t, uint32_t)>
+				::mem_fun<handler, &handler::request_incr>;
+
 	void (*cmd_noop)(void*, memproto_header*) =
 			&mp::object_callback<void (memproto_header*)>
 				::mem_fun<handler, &handler::request_noop>;
@@ -453,11 +535,11 @@ handler::handler(int fd) :
 	memproto_callback cb = {
 		cmd_getx,    // get
 		cmd_set,     // set
-		NULL,        // add
+		cmd_set,     // add
 		cmd_set,     // replace
 		cmd_delete,  // delete
-		NULL,        // increment
-		NULL,        // decrement
+		cmd_incr,    // increment
+		cmd_incr,    // decrement
 		NULL,        // quit
 		cmd_flush,   // flush
 		cmd_getx,    // getq
@@ -480,40 +562,57 @@ handler::~handler()
 
 void handler::read_event()
 try {
-	m_buffer.reserve_buffer(MEMPROTO_RESERVE_SIZE);
+	// read till the socket is drained to save the round trips
+	// to the event loop, within the budget for fairness.
+	size_t total = 0;
+	while(true) {
+		m_buffer.reserve_buffer(m_sizer.size());
+		size_t capacity = m_buffer.buffer_capacity();
+
+		ssize_t rl = ::read(fd(), m_buffer.buffer(), capacity);
+		if(rl <= 0) {
+			if(rl == 0) { throw rpc::connection_closed_error(); }
+			if(errno == EAGAIN || errno == EINTR) { break; }
+			else { throw rpc::connection_broken_error(); }
+		}
 
-	size_t rl = ::read(fd(), m_buffer.buffer(), m_buffer.buffer_capacity());
-	if(rl <= 0) {
-		if(rl == 0) { throw rpc::connection_closed_error(); }
-		if(errno == EAGAIN || errno == EINTR) { return; }
-		else { throw rpc::connection_broken_error(); }
-	}
+		m_buffer.buffer_consumed(rl);
 
-	m_buffer.buffer_consumed(rl);
+		do {
+			size_t off = 0;
+			int ret = memproto_parser_execute(&m_memproto,
+					(char*)m_buffer.data(), m_buffer.data_size(), &off);
 
-	do {
-		size_t off = 0;
-		int ret = memproto_parser_execute(&m_memproto,
-				(char*)m_buffer.data(), m_buffer.data_size(), &off);
+			if(ret == 0) {
+				break;
+			}
 
-		if(ret == 0) {
-			break;
-		}
+			if(ret < 0) {
+				//std::cout << "parse error " << ret << std::endl;
+				throw std::runtime_error("parse error");
+			}
 
-		if(ret < 0) {
-			//std::cout << "parse error " << ret << std::endl;
-			throw std::runtime_error("parse error");
-		}
+			m_buffer.data_used(off);
+
+			m_request_size = off;
+			ret = memproto_dispatch(&m_memproto);
+			if(ret <= 0) {
+				LOG_DEBUG("unknown command ",(uint16_t)-ret);
+				throw std::runtime_error("unknown command");
+			}
+
+		} while(m_buffer.data_size() > 0);
 
-		m_buffer.data_used(off);
+		m_sizer.update(rl, capacity, m_buffer.data_size());
 
-		ret = memproto_dispatch(&m_memproto);
-		if(ret <= 0) {
-			LOG_DEBUG("unknown command ",(uint16_t)-ret);
-			throw std::runtime_error("unknown command");
+		total += rl;
+		if((size_t)rl < capacity || total >= READ_EVENT_BUDGET_SIZE ||
+				m_admission->exceeded()) {
+			break;
 		}
+	}
 
-	} while(m_buffer.data_size() > 0);
+	m_admission->check_limits();
 
 } catch(rpc::connection_error& e) {
 	LOG_DEBUG(e.what());
@@ -528,11 +627,12 @@ try {
 
 
 #define RELEASE_REFERENCE(life) \
-	shared_zone life(new msgpack::zone()); \
+	shared_zone life(rpc::new_shared_zone()); \
 	{ \
 		mp::stream_buffer::reference* ref = \
 			life->allocate<mp::stream_buffer::reference>(); \
 		m_buffer.release_to(ref); \
+		life->allocate<gate::admission::ticket>(m_admission, m_request_size); \
 	}
 
 #define RELEASE_REFERENCE_AUTO(z) \
@@ -541,6 +641,7 @@ try {
 		mp::stream_buffer::reference* ref = \
 			z->allocate<mp::stream_buffer::reference>(); \
 		m_buffer.release_to(ref); \
+		z->allocate<gate::admission::ticket>(m_admission, m_request_size); \
 	}
 
 
@@ -560,6 +661,7 @@ void handler::request_getx(memproto_header* h,
 	req.keylen   = keylen;
 	req.key      = key;
 	req.user     = reinterpret_cast<void*>(e);
+	req.budget_msec = g_budget_msec;
 	req.callback = &handler::response_getx;
 	req.life     = life;
 
@@ -575,9 +677,8 @@ void handler::request_set(memproto_header* h,
 	LOG_TRACE("set");
 	RELEASE_REFERENCE(life);
 
-	if(h->opcode == MEMPROTO_CMD_REPLACE && !h->cas) {
-		// replace without cas value is not supported
-		throw std::runtime_error("memcached binary protocol: unsupported requrest");
+	if(h->opcode == MEMPROTO_CMD_ADD && h->cas) {
+		throw std::runtime_error("memcached binary protocol: invalid argument");
 	}
 
 	if((!g_save_flag && flags) || (!g_save_exptime && expiration)) {
@@ -625,12 +726,20 @@ void handler::request_set(memproto_header* h,
 	req.vallen   = vallen;
 	req.val      = val;
 	req.user     = reinterpret_cast<void*>(e);
+	req.budget_msec = g_budget_msec;
 	req.callback = &handler::response_set;
 	req.life     = life;
 	if(h->cas) {
+		// replace with cas value is same as cas
 		req.operation = gate::OP_CAS;
 		req.clocktime = h->cas;
 		req.callback = &handler::response_cas;
+	} else if(h->opcode == MEMPROTO_CMD_ADD) {
+		req.operation = gate::OP_ADD;
+		req.callback = &handler::response_add;
+	} else if(h->opcode == MEMPROTO_CMD_REPLACE) {
+		req.operation = gate::OP_REPLACE;
+		req.callback = &handler::response_add;
 	}
 
 	m_queue->push_entry(e);
@@ -657,6 +766,7 @@ void handler::request_delete(memproto_header* h,
 	req.key      = key;
 	req.keylen   = keylen;
 	req.user     = reinterpret_cast<void*>(e);
+	req.budget_msec = g_budget_msec;
 	req.callback = &handler::response_delete;
 	req.life     = life;
 
@@ -664,6 +774,56 @@ void handler::request_delete(memproto_header* h,
 	req.submit();
 }
 
+void handler::request_incr(memproto_header* h,
+		const char* key, uint16_t keylen,
+		uint64_t amount, uint64_t initial, uint32_t expiration)
+{
+	LOG_TRACE("incr");
+	RELEASE_REFERENCE(life);
+
+	if(!g_save_exptime && expiration != 0 && expiration != 0xffffffff) {
+		// FIXME error response
+		throw std::runtime_error("memcached binary protocol: invalid argument");
+	}
+
+	incr_entry* e = life->allocate<incr_entry>();
+	e->queue      = m_queue;
+	e->header     = *h;
+
+	gate::req_incr req;
+	req.key       = key;
+	req.keylen    = keylen;
+	req.delta     = amount;
+	req.decrement = (h->opcode == MEMPROTO_CMD_DECREMENT);
+	req.offset    = (g_save_exptime ? 4 : 0) + (g_save_flag ? 2 : 0);
+	req.user      = reinterpret_cast<void*>(e);
+	req.budget_msec = g_budget_msec;
+	req.callback  = &handler::response_incr;
+	req.life      = life;
+
+	if(expiration != 0xffffffff) {
+		// stored if the key is not found
+		// exptime(4) + flags(2) + uint64
+		char* buf = (char*)life->malloc(4+2+20+1);
+		char* p = buf;
+		if(g_save_exptime) {
+			uint32_t exptime = htonl( exptime_to_system(expiration) );
+			memcpy(p, &exptime, 4);
+			p += 4;
+		}
+		if(g_save_flag) {
+			memset(p, 0, 2);
+			p += 2;
+		}
+		p += sprintf(p, "%llu", (unsigned long long)initial);
+		req.initial    = buf;
+		req.initiallen = p - buf;
+	}
+
+	m_queue->push_entry(e);
+	req.submit();
+}
+
 void handler::request_noop(memproto_header* h)
 {
 	LOG_TRACE("noop");
@@ -682,20 +842,24 @@ void handler::request_flush(memproto_header* h,
 		uint32_t expiration)
 {
 	LOG_TRACE("flush");
-	RELEASE_REFERENCE_AUTO(z);
+	RELEASE_REFERENCE(life);
 
 	if(expiration) {
 		// FIXME error response
 		throw std::runtime_error("memcached binary protocol: invalid argument");
 	}
 
-	entry* e = z->allocate<entry>();
+	flush_entry* e = life->allocate<flush_entry>();
 	e->queue      = m_queue;
 	e->header     = *h;
 
-	m_queue->push_entry(e);
+	gate::req_flush req;
+	req.user     = reinterpret_cast<void*>(e);
+	req.callback = &handler::response_flush;
+	req.life     = life;
 
-	send_response_nodata(e, z, MEMPROTO_RES_NO_ERROR);
+	m_queue->push_entry(e);
+	req.submit();
 }
 
 
@@ -828,6 +992,33 @@ void handler::response_cas(void* user,
 	send_response_nodata(e, z, MEMPROTO_RES_NO_ERROR);
 }
 
+void handler::response_add(void* user,
+		gate::res_set& res, auto_zone z)
+{
+	set_entry* e = reinterpret_cast<set_entry*>(user);
+	if(!e->queue->is_valid()) { return; }
+
+	LOG_TRACE("add/replace response");
+
+	if(res.error) {
+		// error
+		send_response_nodata(e, z, MEMPROTO_RES_OUT_OF_MEMORY);
+		return;
+	}
+
+	if(!res.cas_success) {
+		if(e->header.opcode == MEMPROTO_CMD_ADD) {
+			send_response_nodata(e, z, MEMPROTO_RES_KEY_EXISTS);
+		} else {
+			send_response_nodata(e, z, MEMPROTO_RES_KEY_NOT_FOUND);
+		}
+		return;
+	}
+
+	// stored
+	send_response_nodata(e, z, MEMPROTO_RES_NO_ERROR);
+}
+
 void handler::response_delete(void* user,
 		gate::res_delete& res, auto_zone z)
 {
@@ -850,7 +1041,63 @@ void handler::response_delete(void* user,
 }
 
 
-void accepted(int fd, int err)
+void handler::response_incr(void* user,
+		gate::res_incr& res, auto_zone z)
+{
+	incr_entry* e = reinterpret_cast<incr_entry*>(user);
+	if(!e->queue->is_valid()) { return; }
+
+	LOG_TRACE("incr response");
+
+	if(res.error) {
+		// error
+		send_response_nodata(e, z, MEMPROTO_RES_OUT_OF_MEMORY);
+		return;
+	}
+
+	if(!res.found) {
+		// not found
+		send_response_nodata(e, z, MEMPROTO_RES_KEY_NOT_FOUND);
+		return;
+	}
+
+	if(res.non_numeric) {
+		send_response_nodata(e, z, MEMPROTO_RES_NON_NUMERIC_VALUE);
+		return;
+	}
+
+	char* val = (char*)z->malloc(8);
+	*(uint32_t*)&val[0] = htonl((uint32_t)(res.value>>32));
+	*(uint32_t*)&val[4] = htonl((uint32_t)(res.value&0xffffffffULL));
+
+	send_response(e, z, MEMPROTO_RES_NO_ERROR,
+			NULL, 0,
+			val, 8,
+			NULL, 0,
+			res.clocktime);
+}
+
+
+void handler::response_flush(void* user,
+		gate::res_flush& res, auto_zone z)
+{
+	flush_entry* e = reinterpret_cast<flush_entry*>(user);
+	if(!e->queue->is_valid()) { return; }
+
+	LOG_TRACE("flush response");
+
+	if(res.error) {
+		// error
+		send_response_nodata(e, z, MEMPROTO_RES_OUT_OF_MEMORY);
+		return;
+	}
+
+	send_response_nodata(e, z, MEMPROTO_RES_NO_ERROR);
+}
+
+
+// reactor is NULL if the connection is served by the shared wavy core
+void accepted(mp::wavy::core* reactor, int fd, int err)
 {
 	if(fd < 0) {
 		LOG_FATAL("accept failed: ",strerror(err));
@@ -866,18 +1113,33 @@ void accepted(int fd, int err)
 	::setsockopt(fd, SOL_SOCKET, SO_LINGER, (void *)&opt, sizeof(opt));  // ignore error
 #endif
 	LOG_DEBUG("accept MemcacheBinary gate fd=",fd);
-	wavy::add<handler>(fd);
+	if(reactor) {
+		reactor->add<handler>(fd, reactor);
+	} else {
+		wavy::add<handler>(fd, reactor);
+	}
 }
 
 
 }  // noname namespace
 
 
-MemcacheBinary::MemcacheBinary(int lsock, bool save_flag, bool save_exptime) :
-	m_lsock(lsock)
+MemcacheBinary::MemcacheBinary(int lsock, bool save_flag, bool save_exptime,
+		unsigned int budget_msec) :
+	m_lsock(lsock), m_reactors(NULL)
 {
 	g_save_flag = save_flag;
 	g_save_exptime = save_exptime;
+	g_budget_msec = budget_msec;
+}
+
+MemcacheBinary::MemcacheBinary(gate::reactors* rs, const std::vector<int>& lsocks,
+		bool save_flag, bool save_exptime, unsigned int budget_msec) :
+	m_lsock(-1), m_reactors(rs), m_lsocks(lsocks)
+{
+	g_save_flag = save_flag;
+	g_save_exptime = save_exptime;
+	g_budget_msec = budget_msec;
 }
 
 
@@ -886,8 +1148,16 @@ MemcacheBinary::~MemcacheBinary() {}
 void MemcacheBinary::run()
 {
 	using namespace mp::placeholders;
-	wavy::listen(m_lsock,
-			mp::bind(&accepted, _1, _2));
+	if(m_reactors) {
+		for(unsigned int i=0; i < m_lsocks.size(); ++i) {
+			mp::wavy::core* reactor = m_reactors->get(i);
+			reactor->listen(m_lsocks[i],
+					mp::bind(&accepted, reactor, _1, _2));
+		}
+	} else {
+		wavy::listen(m_lsock,
+				mp::bind(&accepted, (mp::wavy::core*)NULL, _1, _2));
+	}
 
 	if(g_save_exptime) {
 		update_system_time();
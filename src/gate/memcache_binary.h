@@ -19,13 +19,21 @@
 #define KUMO_GATE_MEMCACHE_BINARY_H__
 
 #include "gate/interface.h"
+#include "gate/reactors.h"
+#include <vector>
 
 namespace kumo {
 
 
 class MemcacheBinary : public gate::gate {
 public:
-	MemcacheBinary(int lsock, bool save_flag, bool save_exptime);
+	MemcacheBinary(int lsock, bool save_flag, bool save_exptime,
+			unsigned int budget_msec);
+
+	// lsocks[i] is accepted by rs->get(i)
+	MemcacheBinary(gate::reactors* rs, const std::vector<int>& lsocks,
+			bool save_flag, bool save_exptime, unsigned int budget_msec);
+
 	~MemcacheBinary();
 
 	void run();
@@ -33,6 +41,9 @@ public:
 private:
 	int m_lsock;
 
+	gate::reactors* m_reactors;
+	std::vector<int> m_lsocks;
+
 private:
 	MemcacheBinary();
 	MemcacheBinary(const MemcacheBinary&);
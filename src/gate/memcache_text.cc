@@ -19,8 +19,11 @@
 #define __STDC_FORMAT_MACROS
 #include "gate/memcache_text.h"
 #include "gate/memproto/memtext.h"
+#include "gate/admission.h"
 #include "log/mlogger.h"
 #include "rpc/exception.h"
+#include "rpc/pool.h"
+#include "rpc/read_sizer.h"
 #include <mp/pthread.h>
 #include <mp/stream_buffer.h>
 #include <mp/object_callback.h>
@@ -44,6 +47,7 @@ namespace {
 
 static bool g_save_flag = false;
 static bool g_save_exptime = false;
+static unsigned int g_budget_msec = 0;
 static uint32_t g_system_time;
 
 #define RELATIVE_MAX (60*60*24*30)
@@ -72,10 +76,11 @@ using gate::auto_zone;
 
 static const size_t MEMTEXT_INITIAL_ALLOCATION_SIZE = 32*1024;
 static const size_t MEMTEXT_RESERVE_SIZE = 4*1024;
+static const size_t MEMTEXT_RESERVE_MAX = 1024*1024;
 
 class handler : public wavy::handler {
 public:
-	handler(int fd);
+	handler(int fd, mp::wavy::core* reactor);
 	~handler();
 
 public:
@@ -86,18 +91,21 @@ public:
 
 	class context {
 	public:
-		context(int fd, mp::stream_buffer* buf, const shared_valid& valid);
+		context(int fd, mp::stream_buffer* buf, const shared_valid& valid,
+				const gate::shared_admission& adm);
 		~context();
 
 	public:
 		int fd() const { return m_fd; }
-		msgpack::zone* release_reference();
+		// bytes: size of keys and values of the request
+		msgpack::zone* release_reference(size_t bytes);
 		const shared_valid& valid() { return m_valid; }
 
 	private:
 		int m_fd;
 		mp::stream_buffer* m_buffer;
 		shared_valid m_valid;
+		gate::shared_admission m_admission;
 
 	private:
 		context();
@@ -106,9 +114,11 @@ public:
 
 private:
 	mp::stream_buffer m_buffer;
+	rpc::read_sizer m_sizer;
 	memtext_parser m_memproto;
 	size_t m_off;
 	shared_valid m_valid;
+	gate::shared_admission m_admission;
 
 	context m_context;
 
@@ -142,6 +152,12 @@ struct set_entry : entry {
 struct delete_entry : entry {
 };
 
+struct incr_entry : entry {
+};
+
+struct flush_entry : entry {
+};
+
 
 inline void send_data(entry* e,
 		const char* buf, size_t buflen)
@@ -170,9 +186,13 @@ static const char* const NOT_SUPPORTED_REPLY = "CLIENT_ERROR supported\r\n";
 static const char* const GET_FAILED_REPLY    = "SERVER_ERROR get failed\r\n";
 static const char* const STORE_FAILED_REPLY  = "SERVER_ERROR store failed\r\n";
 static const char* const DELETE_FAILED_REPLY = "SERVER_ERROR delete failed\r\n";
+static const char* const INCR_FAILED_REPLY   = "SERVER_ERROR incr failed\r\n";
+static const char* const FLUSH_FAILED_REPLY  = "SERVER_ERROR flush failed\r\n";
 static const char* const VERSION_REPLY       = "VERSION " PACKAGE "-" VERSION "\r\n";
 static const char* const EXISTS_REPLY        = "EXISTS\r\n";
 static const char* const NOT_FOUND_REPLY     = "NOT_FOUND\r\n";
+static const char* const NOT_STORED_REPLY    = "NOT_STORED\r\n";
+static const char* const NON_NUMERIC_REPLY   = "CLIENT_ERROR cannot increment or decrement non-numeric value\r\n";
 
 // "VALUE "+keylen+" "+uint16+" "+uint32+" "+uint64+"\r\n\0"
 #define HEADER_SIZE(keylen) \
@@ -374,6 +394,25 @@ void response_cas(void* user,
 	send_data(e, "STORED\r\n", 8);
 }
 
+void response_add(void* user,
+		gate::res_set& res, auto_zone z)
+{
+	set_entry* e = reinterpret_cast<set_entry*>(user);
+	LOG_TRACE("add/replace response");
+
+	if(res.error) {
+		send_data(e, STORE_FAILED_REPLY, strlen(STORE_FAILED_REPLY));
+		return;
+	}
+
+	if(!res.cas_success) {
+		send_data(e, NOT_STORED_REPLY, strlen(NOT_STORED_REPLY));
+		return;
+	}
+
+	send_data(e, "STORED\r\n", 8);
+}
+
 void response_delete(void* user,
 		gate::res_delete& res, auto_zone z)
 {
@@ -392,6 +431,51 @@ void response_delete(void* user,
 	}
 }
 
+void response_incr(void* user,
+		gate::res_incr& res, auto_zone z)
+{
+	incr_entry* e = reinterpret_cast<incr_entry*>(user);
+	LOG_TRACE("incr response");
+
+	if(res.error) {
+		send_data(e, INCR_FAILED_REPLY, strlen(INCR_FAILED_REPLY));
+		return;
+	}
+
+	if(!res.found) {
+		send_data(e, NOT_FOUND_REPLY, strlen(NOT_FOUND_REPLY));
+		return;
+	}
+
+	if(res.non_numeric) {
+		send_data(e, NON_NUMERIC_REPLY, strlen(NON_NUMERIC_REPLY));
+		return;
+	}
+
+	// uint64+"\r\n\0"
+	char* buf = (char*)z->malloc(20+3);
+	int len = sprintf(buf, "%"PRIu64"\r\n", res.value);
+
+	struct iovec* vb = (struct iovec*)z->malloc(sizeof(struct iovec));
+	vb->iov_base = buf;
+	vb->iov_len  = len;
+	send_datav(e, vb, 1, z);
+}
+
+void response_flush_all(void* user,
+		gate::res_flush& res, auto_zone z)
+{
+	flush_entry* e = reinterpret_cast<flush_entry*>(user);
+	LOG_TRACE("flush_all response");
+
+	if(res.error) {
+		send_data(e, FLUSH_FAILED_REPLY, strlen(FLUSH_FAILED_REPLY));
+		return;
+	}
+
+	send_data(e, "OK\r\n", 4);
+}
+
 void response_noreply_set(void* user,
 		gate::res_set& res, auto_zone z)
 { }
@@ -404,10 +488,18 @@ void response_noreply_delete(void* user,
 		gate::res_delete& res, auto_zone z)
 { }
 
+void response_noreply_incr(void* user,
+		gate::res_incr& res, auto_zone z)
+{ }
+
+void response_noreply_flush_all(void* user,
+		gate::res_flush& res, auto_zone z)
+{ }
 
-#define RELEASE_REFERENCE(user, ctx, life) \
+
+#define RELEASE_REFERENCE(user, ctx, life, bytes) \
 	handler::context* ctx = static_cast<handler::context*>(user); \
-	shared_zone life(ctx->release_reference());
+	shared_zone life(ctx->release_reference(bytes), &rpc::zone_pool::release);
 
 
 int request_get_single(void* user,
@@ -416,7 +508,7 @@ int request_get_single(void* user,
 		bool require_cas)
 {
 	LOG_TRACE("get");
-	RELEASE_REFERENCE(user, ctx, life);
+	RELEASE_REFERENCE(user, ctx, life, r->key_len[0]);
 
 	const char* const key = r->key[0];
 	size_t const key_len  = r->key_len[0];
@@ -430,6 +522,7 @@ int request_get_single(void* user,
 	req.keylen   = key_len;
 	req.key      = key;
 	req.user     = reinterpret_cast<void*>(e);
+	req.budget_msec = g_budget_msec;
 	req.callback = &response_get;
 	req.life     = life;
 
@@ -443,7 +536,11 @@ int request_get_multi(void* user,
 		bool require_cas)
 {
 	LOG_TRACE("get multi");
-	RELEASE_REFERENCE(user, ctx, life);
+	size_t bytes = 0;
+	for(unsigned i=0; i < r->key_num; ++i) {
+		bytes += r->key_len[i];
+	}
+	RELEASE_REFERENCE(user, ctx, life, bytes);
 
 	size_t const veclen = r->key_num * 2 + 1;  // +1: \r\nEND\r\n
 
@@ -477,17 +574,23 @@ int request_get_multi(void* user,
 		me[i]->veclen      = veclen;
 	}
 
-	for(unsigned i=0; i < r->key_num; ++i) {
-		gate::req_get req;
-		req.keylen   = r->key_len[i];
-		req.key      = r->key[i];
-		req.user     = reinterpret_cast<void*>(me[i]);
-		req.callback = &response_get_multi;
-		req.life     = life;
+	gate::req_get_multi req;
+	req.num      = r->key_num;
+	req.keys     = (const char**)life->malloc(sizeof(const char*)*r->key_num);
+	req.keylens  = (uint32_t*)life->malloc(sizeof(uint32_t)*r->key_num);
+	req.users    = (void**)life->malloc(sizeof(void*)*r->key_num);
+	req.callback = &response_get_multi;
+	req.budget_msec = g_budget_msec;
+	req.life     = life;
 
-		req.submit();
+	for(unsigned i=0; i < r->key_num; ++i) {
+		req.keys[i]    = r->key[i];
+		req.keylens[i] = r->key_len[i];
+		req.users[i]   = reinterpret_cast<void*>(me[i]);
 	}
 
+	req.submit();
+
 	return 0;
 }
 
@@ -519,14 +622,15 @@ int request_set_impl(void* user,
 		memtext_request_storage* r,
 		uint64_t cas_unique)
 {
-	RELEASE_REFERENCE(user, ctx, life);
+	RELEASE_REFERENCE(user, ctx, life, r->key_len + r->data_len);
 
 	if((!g_save_flag && r->flags) || (!g_save_exptime && r->exptime)) {
 		wavy::write(ctx->fd(), NOT_SUPPORTED_REPLY, strlen(NOT_SUPPORTED_REPLY));
 		return 0;
 	}
 
-	if(cmd == MEMTEXT_CMD_SET || cmd == MEMTEXT_CMD_CAS) {
+	if(cmd == MEMTEXT_CMD_SET || cmd == MEMTEXT_CMD_CAS ||
+			cmd == MEMTEXT_CMD_ADD || cmd == MEMTEXT_CMD_REPLACE) {
 		if(g_save_flag) {
 			union {
 				uint16_t num;
@@ -562,6 +666,7 @@ int request_set_impl(void* user,
 	req.vallen   = r->data_len;
 	req.val      = r->data;
 	req.user     = reinterpret_cast<void*>(e);
+	req.budget_msec = g_budget_msec;
 	req.life     = life;
 	if(r->noreply) {
 		req.callback = &response_noreply_set;
@@ -582,6 +687,14 @@ int request_set_impl(void* user,
 		req.operation = gate::OP_CAS;
 		req.clocktime = cas_unique;
 		break;
+	case MEMTEXT_CMD_ADD:
+		if(!r->noreply) { req.callback = &response_add; }
+		req.operation = gate::OP_ADD;
+		break;
+	case MEMTEXT_CMD_REPLACE:
+		if(!r->noreply) { req.callback = &response_add; }
+		req.operation = gate::OP_REPLACE;
+		break;
 	case MEMTEXT_CMD_APPEND:
 		req.operation = gate::OP_APPEND;
 		break;
@@ -600,7 +713,7 @@ int request_set(void* user,
 		memtext_command cmd,
 		memtext_request_storage* r)
 {
-	LOG_TRACE("set/append/prepend");
+	LOG_TRACE("set/add/replace/append/prepend");
 	return request_set_impl(user, cmd, r, 0);
 }
 
@@ -618,7 +731,7 @@ int request_delete(void* user,
 		memtext_request_delete* r)
 {
 	LOG_TRACE("delete");
-	RELEASE_REFERENCE(user, ctx, life);
+	RELEASE_REFERENCE(user, ctx, life, r->key_len);
 
 	if(r->exptime) {
 		wavy::write(ctx->fd(), NOT_SUPPORTED_REPLY, strlen(NOT_SUPPORTED_REPLY));
@@ -633,6 +746,7 @@ int request_delete(void* user,
 	req.key      = r->key;
 	req.keylen   = r->key_len;
 	req.user     = reinterpret_cast<void*>(e);
+	req.budget_msec = g_budget_msec;
 	if(r->noreply) {
 		req.async    = true;
 		req.callback = &response_noreply_delete;
@@ -645,55 +759,121 @@ int request_delete(void* user,
 	return 0;
 }
 
+int request_incr(void* user,
+		memtext_command cmd,
+		memtext_request_numeric* r)
+{
+	LOG_TRACE("incr/decr");
+	RELEASE_REFERENCE(user, ctx, life, r->key_len);
+
+	incr_entry* e = life->allocate<incr_entry>();
+	e->fd    = ctx->fd();
+	e->valid = ctx->valid();
+
+	gate::req_incr req;
+	req.key       = r->key;
+	req.keylen    = r->key_len;
+	req.delta     = r->value;
+	req.decrement = (cmd == MEMTEXT_CMD_DECR);
+	req.offset    = (g_save_exptime ? 4 : 0) + (g_save_flag ? 2 : 0);
+	req.user      = reinterpret_cast<void*>(e);
+	req.budget_msec = g_budget_msec;
+	if(r->noreply) {
+		req.callback = &response_noreply_incr;
+	} else {
+		req.callback = &response_incr;
+	}
+	req.life      = life;
+
+	req.submit();
+	return 0;
+}
+
 int request_version(void* user,
 		memtext_command cmd,
 		memtext_request_other* r)
 {
 	LOG_TRACE("version");
-	RELEASE_REFERENCE(user, ctx, life);
+	RELEASE_REFERENCE(user, ctx, life, 0);
 
 	wavy::write(ctx->fd(), VERSION_REPLY, strlen(VERSION_REPLY));
 
 	return 0;
 }
 
-handler::context::context(int fd, mp::stream_buffer* buf, const shared_valid& valid) :
-	m_fd(fd), m_buffer(buf), m_valid(valid) { }
+int request_flush_all(void* user,
+		memtext_command cmd,
+		memtext_request_flush_all* r)
+{
+	LOG_TRACE("flush_all");
+	RELEASE_REFERENCE(user, ctx, life, 0);
+
+	if(r->exptime) {
+		// delayed flush is not supported
+		wavy::write(ctx->fd(), NOT_SUPPORTED_REPLY, strlen(NOT_SUPPORTED_REPLY));
+		return 0;
+	}
+
+	flush_entry* e = life->allocate<flush_entry>();
+	e->fd    = ctx->fd();
+	e->valid = ctx->valid();
+
+	gate::req_flush req;
+	req.user     = reinterpret_cast<void*>(e);
+	if(r->noreply) {
+		req.callback = &response_noreply_flush_all;
+	} else {
+		req.callback = &response_flush_all;
+	}
+	req.life     = life;
+
+	req.submit();
+	return 0;
+}
+
+handler::context::context(int fd, mp::stream_buffer* buf, const shared_valid& valid,
+		const gate::shared_admission& adm) :
+	m_fd(fd), m_buffer(buf), m_valid(valid), m_admission(adm) { }
 
 handler::context::~context() { }
 
-msgpack::zone* handler::context::release_reference()
+msgpack::zone* handler::context::release_reference(size_t bytes)
 {
-	auto_zone z(new msgpack::zone());
+	auto_zone z(rpc::zone_pool::get());
 
 	mp::stream_buffer::reference* ref =
 		z->allocate<mp::stream_buffer::reference>();
 	m_buffer->release_to(ref);
 
+	z->allocate<gate::admission::ticket>(m_admission, bytes);
+
 	return z.release();
 }
 
 
-handler::handler(int fd) :
+handler::handler(int fd, mp::wavy::core* reactor) :
 	wavy::handler(fd),
 	m_buffer(MEMTEXT_INITIAL_ALLOCATION_SIZE),
+	m_sizer(MEMTEXT_RESERVE_SIZE, MEMTEXT_RESERVE_MAX),
 	m_off(0),
 	m_valid(new bool(true)),
-	m_context(fd, &m_buffer, m_valid)
+	m_admission(new gate::admission(reactor, fd)),
+	m_context(fd, &m_buffer, m_valid, m_admission)
 {
 	memtext_callback cb = {
 		request_get,    // get
 		request_gets,   // gets
 		request_set,    // set
-		NULL,           // add
-		NULL,           // replace
+		request_set,    // add
+		request_set,    // replace
 		NULL, //request_set,    // append
 		NULL, //request_set,    // prepend
 		request_cas,    // cas
 		request_delete, // delete
-		NULL,           // incr
-		NULL,           // decr
+		request_incr,   // incr
+		request_incr,   // decr
 		request_version,// version
+		request_flush_all,// flush_all
 	};
 
 	memtext_init(&m_memproto, &cb, &m_context);
@@ -707,28 +887,44 @@ handler::~handler()
 
 void handler::read_event()
 try {
-	m_buffer.reserve_buffer(MEMTEXT_RESERVE_SIZE);
+	// read till the socket is drained to save the round trips
+	// to the event loop, within the budget for fairness.
+	size_t total = 0;
+	while(true) {
+		m_buffer.reserve_buffer(m_sizer.size());
+		size_t capacity = m_buffer.buffer_capacity();
+
+		ssize_t rl = ::read(fd(), m_buffer.buffer(), capacity);
+		if(rl <= 0) {
+			if(rl == 0) { throw rpc::connection_closed_error(); }
+			if(errno == EAGAIN || errno == EINTR) { break; }
+			else { throw rpc::connection_broken_error(); }
+		}
 
-	ssize_t rl = ::read(fd(), m_buffer.buffer(), m_buffer.buffer_capacity());
-	if(rl <= 0) {
-		if(rl == 0) { throw rpc::connection_closed_error(); }
-		if(errno == EAGAIN || errno == EINTR) { return; }
-		else { throw rpc::connection_broken_error(); }
-	}
+		m_buffer.buffer_consumed(rl);
 
-	m_buffer.buffer_consumed(rl);
+		do {
+			int ret = memtext_execute(&m_memproto,
+					(char*)m_buffer.data(), m_buffer.data_size(), &m_off);
+			if(ret < 0) {
+				throw std::runtime_error("parse error");
+			} else if(ret == 0) {
+				break;
+			}
+			m_buffer.data_used(m_off);
+			m_off = 0;
+		} while(m_buffer.data_size() > 0);
 
-	do {
-		int ret = memtext_execute(&m_memproto,
-				(char*)m_buffer.data(), m_buffer.data_size(), &m_off);
-		if(ret < 0) {
-			throw std::runtime_error("parse error");
-		} else if(ret == 0) {
-			return;
+		m_sizer.update(rl, capacity, m_buffer.data_size());
+
+		total += rl;
+		if((size_t)rl < capacity || total >= READ_EVENT_BUDGET_SIZE ||
+				m_admission->exceeded()) {
+			break;
 		}
-		m_buffer.data_used(m_off);
-		m_off = 0;
-	} while(m_buffer.data_size() > 0);
+	}
+
+	m_admission->check_limits();
 
 } catch(rpc::connection_error& e) {
 	LOG_DEBUG(e.what());
@@ -742,7 +938,8 @@ try {
 }
 
 
-void accepted(int fd, int err)
+// reactor is NULL if the connection is served by the shared wavy core
+void accepted(mp::wavy::core* reactor, int fd, int err)
 {
 	if(fd < 0) {
 		LOG_FATAL("accept failed: ",strerror(err));
@@ -758,18 +955,33 @@ void accepted(int fd, int err)
 	::setsockopt(fd, SOL_SOCKET, SO_LINGER, (void *)&opt, sizeof(opt));  // ignore error
 #endif
 	LOG_DEBUG("accept MemcacheText gate fd=",fd);
-	wavy::add<handler>(fd);
+	if(reactor) {
+		reactor->add<handler>(fd, reactor);
+	} else {
+		wavy::add<handler>(fd, reactor);
+	}
 }
 
 
 }  // noname namespace
 
 
-MemcacheText::MemcacheText(int lsock, bool save_flag, bool save_exptime) :
-	m_lsock(lsock)
+MemcacheText::MemcacheText(int lsock, bool save_flag, bool save_exptime,
+		unsigned int budget_msec) :
+	m_lsock(lsock), m_reactors(NULL)
 {
 	g_save_flag = save_flag;
 	g_save_exptime = save_exptime;
+	g_budget_msec = budget_msec;
+}
+
+MemcacheText::MemcacheText(gate::reactors* rs, const std::vector<int>& lsocks,
+		bool save_flag, bool save_exptime, unsigned int budget_msec) :
+	m_lsock(-1), m_reactors(rs), m_lsocks(lsocks)
+{
+	g_save_flag = save_flag;
+	g_save_exptime = save_exptime;
+	g_budget_msec = budget_msec;
 }
 
 MemcacheText::~MemcacheText() {}
@@ -777,8 +989,16 @@ MemcacheText::~MemcacheText() {}
 void MemcacheText::run()
 {
 	using namespace mp::placeholders;
-	wavy::listen(m_lsock,
-			mp::bind(&accepted, _1, _2));
+	if(m_reactors) {
+		for(unsigned int i=0; i < m_lsocks.size(); ++i) {
+			mp::wavy::core* reactor = m_reactors->get(i);
+			reactor->listen(m_lsocks[i],
+					mp::bind(&accepted, reactor, _1, _2));
+		}
+	} else {
+		wavy::listen(m_lsock,
+				mp::bind(&accepted, (mp::wavy::core*)NULL, _1, _2));
+	}
 
 	if(g_save_exptime) {
 		update_system_time();
@@ -39,6 +39,7 @@ typedef enum {
 	MEMPROTO_RES_VALUE_TOO_BIG      = 0x0003,
 	MEMPROTO_RES_INVALID_ARGUMENTS  = 0x0004,
 	MEMPROTO_RES_ITEM_NOT_STORED    = 0x0005,
+	MEMPROTO_RES_NON_NUMERIC_VALUE  = 0x0006,
 	MEMPROTO_RES_UNKNOWN_COMMAND    = 0x0081,
 	MEMPROTO_RES_OUT_OF_MEMORY      = 0x0082,
 	MEMPROTO_RES_PAUSE              = 0xfe00,
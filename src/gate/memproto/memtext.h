@@ -53,6 +53,9 @@ typedef enum {
 
 	/* other */
 	MEMTEXT_CMD_VERSION,
+
+	/* flush_all */
+	MEMTEXT_CMD_FLUSH_ALL,
 } memtext_command;
 
 
@@ -100,6 +103,11 @@ typedef struct {
 typedef struct {
 } memtext_request_other;
 
+typedef struct {
+	uint32_t exptime;
+	bool noreply;
+} memtext_request_flush_all;
+
 typedef int (*memtext_callback_retrieval)(
 		void* user, memtext_command cmd,
 		memtext_request_retrieval* req);
@@ -124,6 +132,10 @@ typedef int (*memtext_callback_other)(
 		void* user, memtext_command cmd,
 		memtext_request_other* req);
 
+typedef int (*memtext_callback_flush_all)(
+		void* user, memtext_command cmd,
+		memtext_request_flush_all* req);
+
 typedef struct {
 	memtext_callback_retrieval cmd_get;
 	memtext_callback_retrieval cmd_gets;
@@ -137,6 +149,7 @@ typedef struct {
 	memtext_callback_numeric   cmd_incr;
 	memtext_callback_numeric   cmd_decr;
 	memtext_callback_other     cmd_version;
+	memtext_callback_flush_all cmd_flush_all;
 } memtext_callback;
 
 typedef struct {
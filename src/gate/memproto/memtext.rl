@@ -135,6 +135,7 @@
 	action cmd_incr    { ctx->command = MEMTEXT_CMD_INCR;    }
 	action cmd_decr    { ctx->command = MEMTEXT_CMD_DECR;    }
 	action cmd_version { ctx->command = MEMTEXT_CMD_VERSION; }
+	action cmd_flush_all { ctx->command = MEMTEXT_CMD_FLUSH_ALL; }
 
 
 	action do_retrieval {
@@ -225,6 +226,18 @@
 		} else { goto convert_error; }
 	}
 
+	action do_flush_all {
+		CALLBACK(cb, memtext_callback_flush_all);
+		if(cb) {
+			memtext_request_flush_all req = {
+				ctx->exptime, ctx->noreply
+			};
+			if((*cb)(ctx->user, ctx->command, &req) < 0) {
+				goto convert_error;
+			}
+		} else { goto convert_error; }
+	}
+
 	key        = ([^\r \0\n]+)       >mark_key        %key;
 	#key       = ([\!-\~]+)          >mark_key        %key;
 	flags      = ('0' | [1-9][0-9]*) >mark_flags      %flags;
@@ -255,6 +268,8 @@
 
 	other_command = ('version') @cmd_version;
 
+	flush_all_command = ('flush_all') @cmd_flush_all;
+
 	retrieval = retrieval_command ' ' key (' ' key >incr_key)*
 				' '*   # workaraound for libmemcached
 				'\r\n';
@@ -293,12 +308,18 @@
 			'\r\n'
 			;
 
+	flush_all = flush_all_command
+				(' ' exptime)? (' ' noreply)?
+				'\r\n'
+				;
+
 	command = retrieval @do_retrieval
 			| storage   @do_storage
 			| cas       @do_cas
 			| delete    @do_delete
 			| numeric   @do_numeric
 			| other     @do_other
+			| flush_all @do_flush_all
 			;
 
 main := (command >reset)+;
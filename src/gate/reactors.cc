@@ -0,0 +1,75 @@
+//
+// kumofs
+//
+// Copyright (C) 2009 FURUHASHI Sadayuki
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+//
+#include "gate/reactors.h"
+
+namespace kumo {
+namespace gate {
+
+
+reactors::reactors(unsigned int num)
+{
+	m_cores.reserve(num);
+	try {
+		for(unsigned int i=0; i < num; ++i) {
+			m_cores.push_back(new mp::wavy::core());
+		}
+	} catch (...) {
+		for(std::vector<mp::wavy::core*>::iterator it(m_cores.begin());
+				it != m_cores.end(); ++it) {
+			delete *it;
+		}
+		throw;
+	}
+}
+
+reactors::~reactors()
+{
+	for(std::vector<mp::wavy::core*>::iterator it(m_cores.begin());
+			it != m_cores.end(); ++it) {
+		delete *it;
+	}
+}
+
+void reactors::run()
+{
+	for(std::vector<mp::wavy::core*>::iterator it(m_cores.begin());
+			it != m_cores.end(); ++it) {
+		(*it)->add_thread(1);
+	}
+}
+
+void reactors::end()
+{
+	for(std::vector<mp::wavy::core*>::iterator it(m_cores.begin());
+			it != m_cores.end(); ++it) {
+		(*it)->end();
+	}
+}
+
+void reactors::join()
+{
+	for(std::vector<mp::wavy::core*>::iterator it(m_cores.begin());
+			it != m_cores.end(); ++it) {
+		(*it)->join();
+	}
+}
+
+
+}  // namespace gate
+}  // namespace kumo
+
@@ -0,0 +1,60 @@
+//
+// kumofs
+//
+// Copyright (C) 2009 FURUHASHI Sadayuki
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+//
+#ifndef KUMO_GATE_REACTORS_H__
+#define KUMO_GATE_REACTORS_H__
+
+#include <mp/wavy.h>
+#include <vector>
+
+namespace kumo {
+namespace gate {
+
+
+// Independent wavy cores for the gates.
+// Each reactor has its own epoll set, task queue and thread. It accepts
+// connections on its own SO_REUSEPORT listen socket and serves them
+// until they are closed, so that the reactors don't contend for the
+// lock of the shared wavy core.
+class reactors {
+public:
+	reactors(unsigned int num);
+	~reactors();
+
+	unsigned int size() const { return m_cores.size(); }
+	mp::wavy::core* get(unsigned int i) { return m_cores[i]; }
+
+	// starts one thread on each reactor
+	void run();
+
+	void end();
+	void join();
+
+private:
+	std::vector<mp::wavy::core*> m_cores;
+
+private:
+	reactors();
+	reactors(const reactors&);
+};
+
+
+}  // namespace gate
+}  // namespace kumo
+
+#endif /* gate/reactors.h */
+
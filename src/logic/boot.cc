@@ -35,7 +35,7 @@ scoped_listen_tcp::~scoped_listen_tcp()
 }
 
 
-int scoped_listen_tcp::listen(const rpc::address& addr)
+int scoped_listen_tcp::listen(const rpc::address& addr, bool reuseport)
 {
 	int lsock = socket(PF_INET, SOCK_STREAM, 0);
 	if(lsock < 0) {
@@ -48,6 +48,18 @@ int scoped_listen_tcp::listen(const rpc::address& addr)
 		throw std::runtime_error("setsockopt failed");
 	}
 
+	if(reuseport) {
+#ifdef SO_REUSEPORT
+		if( ::setsockopt(lsock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0 ) {
+			::close(lsock);
+			throw std::runtime_error("setsockopt SO_REUSEPORT failed");
+		}
+#else
+		::close(lsock);
+		throw std::runtime_error("SO_REUSEPORT is not supported");
+#endif
+	}
+
 	char addrbuf[addr.addrlen()];
 	addr.getaddr((sockaddr*)addrbuf);
 
@@ -34,7 +34,9 @@ public:
 	~scoped_listen_tcp();
 
 public:
-	static int listen(const rpc::address& addr);
+	// sockets listened with reuseport on the same address share
+	// incoming connections
+	static int listen(const rpc::address& addr, bool reuseport = false);
 
 public:
 	int sock() const
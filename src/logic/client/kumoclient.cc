@@ -0,0 +1,629 @@
+//
+// kumofs
+//
+// Copyright (C) 2009 FURUHASHI Sadayuki
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+//
+#include "client/kumoclient.h"
+#include "gateway/framework.h"
+#include "gateway/init.h"
+#include "gate/interface.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace kumo {
+namespace client {
+
+
+config::config() :
+	rthreads(4),
+	wthreads(2),
+	connect_timeout_sec(10.0),
+	connect_retry_limit(4),
+	server_connections(1),
+	server_queue_limit(8192),
+	budget_msec(0),
+	keepalive_interval(2.0),
+	clock_interval(2.0),
+	get_retry_num(5),
+	set_retry_num(20),
+	delete_retry_num(20),
+	renew_threshold(4),
+	async_replicate_set(false),
+	async_replicate_delete(false),
+	read_balance(false) { }
+
+
+// Config of gateway::init() and gateway::framework::run()
+struct client::context {
+	context(const config& cfg);
+
+	address manager1;
+	address manager2;
+
+	unsigned short rthreads;
+	unsigned short wthreads;
+
+	unsigned int connect_timeout_msec;
+	unsigned short connect_retry_limit;
+	unsigned short server_connections;
+	unsigned int server_queue_limit;
+
+	unsigned long keepalive_interval_usec;
+	unsigned long clock_interval_usec;
+
+	unsigned short get_retry_num;
+	unsigned short set_retry_num;
+	unsigned short delete_retry_num;
+
+	unsigned short renew_threshold;
+
+	bool async_replicate_set;
+	bool async_replicate_delete;
+
+	std::string key_prefix;
+
+	bool read_balance;
+	unsigned short hedge_percentile;
+
+	unsigned int batch_window_usec;
+	unsigned int batch_size;
+
+	// the local cache is not used because values may be
+	// modified by other clients without notification
+	std::string local_cache;
+	unsigned int cache_memory_mb;
+	unsigned int negative_ttl_msec;
+	unsigned int negative_limit;
+	bool lease;
+	bool no_coalesce;
+
+	bool started;
+};
+
+namespace {
+	volatile int s_instances = 0;
+	unsigned int s_budget_msec = 0;
+
+	address resolve_address(const std::string& str)
+	{
+		std::string host(str);
+		unsigned short port = MANAGER_DEFAULT_PORT;
+
+		std::string::size_type posc = str.rfind(':');
+		if(posc != std::string::npos) {
+			host = str.substr(0, posc);
+			port = atoi(str.c_str() + posc + 1);
+			if(port == 0) {
+				throw error("invalid port number: "+str);
+			}
+		}
+
+		addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+
+		addrinfo* res = NULL;
+		int err = getaddrinfo(host.c_str(), NULL, &hints, &res);
+		if(err != 0) {
+			throw error(std::string("can't resolve host name (") +
+					gai_strerror(err) + "): " + host);
+		}
+
+		sockaddr_in addr;
+		memcpy(&addr, res->ai_addr, sizeof(addr));
+		addr.sin_port = htons(port);
+		freeaddrinfo(res);
+
+		return address(addr);
+	}
+}  // noname namespace
+
+client::context::context(const config& cfg) :
+	rthreads(cfg.rthreads),
+	wthreads(cfg.wthreads),
+	connect_timeout_msec(cfg.connect_timeout_sec * 1000),
+	connect_retry_limit(cfg.connect_retry_limit),
+	server_connections(cfg.server_connections),
+	server_queue_limit(cfg.server_queue_limit),
+	keepalive_interval_usec(cfg.keepalive_interval * 1000 * 1000),
+	clock_interval_usec(cfg.clock_interval * 1000 * 1000),
+	get_retry_num(cfg.get_retry_num),
+	set_retry_num(cfg.set_retry_num),
+	delete_retry_num(cfg.delete_retry_num),
+	renew_threshold(cfg.renew_threshold),
+	async_replicate_set(cfg.async_replicate_set),
+	async_replicate_delete(cfg.async_replicate_delete),
+	key_prefix(cfg.key_prefix),
+	read_balance(cfg.read_balance),
+	hedge_percentile(0),
+	batch_window_usec(0),
+	batch_size(32),
+	cache_memory_mb(0),
+	negative_ttl_msec(0),
+	negative_limit(0),
+	lease(false),
+	no_coalesce(false),
+	started(false)
+{
+	if(cfg.manager1.empty()) {
+		throw error("manager1 is required");
+	}
+	if(server_connections < 1) {
+		throw error("server_connections must be 1 or more");
+	}
+	manager1 = resolve_address(cfg.manager1);
+	if(!cfg.manager2.empty()) {
+		manager2 = resolve_address(cfg.manager2);
+	}
+}
+
+
+client::client(const config& cfg) :
+	m_ctx(new context(cfg))
+{
+	if(__sync_fetch_and_add(&s_instances, 1) != 0) {
+		__sync_sub_and_fetch(&s_instances, 1);
+		throw error("only one client can run in a process");
+	}
+	s_budget_msec = cfg.budget_msec;
+	try {
+		gateway::init(*m_ctx);
+	} catch (...) {
+		__sync_sub_and_fetch(&s_instances, 1);
+		throw;
+	}
+}
+
+client::~client()
+{
+	try {
+		stop();
+	} catch (...) { }
+	__sync_sub_and_fetch(&s_instances, 1);
+}
+
+void client::start()
+{
+	if(m_ctx->started) { return; }
+	gateway::net->run(*m_ctx, false);
+	m_ctx->started = true;
+
+	// requests fail with "No server" until the hash space is received
+	static const unsigned int WAIT_STEP_MSEC = 10;
+	unsigned int timeout = m_ctx->connect_timeout_msec *
+		(m_ctx->connect_retry_limit + 1);
+	for(unsigned int waited = 0; ; waited += WAIT_STEP_MSEC) {
+		{
+			pthread_scoped_rdlock hslk(gateway::share->hs_rwlock());
+			if(!gateway::share->hash_space_empty(hslk)) {
+				return;
+			}
+		}
+		if(waited >= timeout) {
+			throw error("can't receive the hash space from the managers");
+		}
+		usleep(WAIT_STEP_MSEC * 1000);
+	}
+}
+
+void client::stop()
+{
+	if(!m_ctx->started) { return; }
+	m_ctx->started = false;
+	gateway::net->signal_end();
+	gateway::net->join();
+}
+
+
+namespace {
+	// callback of the asynchronous API
+	template <typename Callback>
+	struct async_entry {
+		Callback callback;
+		void* user;
+		const char* key;
+		size_t keylen;
+	};
+
+	template <typename Callback>
+	async_entry<Callback>* new_entry(shared_zone& life,
+			const char* key, size_t keylen,
+			Callback callback, void* user)
+	{
+		async_entry<Callback>* e = life->allocate< async_entry<Callback> >();
+		char* k = (char*)life->malloc(keylen);
+		memcpy(k, key, keylen);
+		e->callback = callback;
+		e->user     = user;
+		e->key      = k;
+		e->keylen   = keylen;
+		return e;
+	}
+
+	void async_get(void* user, gate::res_get& res, auto_zone z)
+	{
+		async_entry<get_callback>* e =
+			reinterpret_cast<async_entry<get_callback>*>(user);
+		get_result r;
+		r.error  = res.error;
+		r.key    = e->key;
+		r.keylen = e->keylen;
+		if(res.error) {
+			r.val    = NULL;
+			r.vallen = 0;
+			r.cas    = 0;
+		} else {
+			r.val    = res.val;
+			r.vallen = res.vallen;
+			r.cas    = res.clocktime;
+		}
+		(*e->callback)(e->user, r);
+	}
+
+	void async_set(void* user, gate::res_set& res, auto_zone z)
+	{
+		async_entry<set_callback>* e =
+			reinterpret_cast<async_entry<set_callback>*>(user);
+		set_result r;
+		r.error  = res.error;
+		r.key    = e->key;
+		r.keylen = e->keylen;
+		if(res.error) {
+			r.stored = false;
+			r.cas    = 0;
+		} else {
+			r.stored = res.cas_success;
+			r.cas    = res.clocktime;
+		}
+		(*e->callback)(e->user, r);
+	}
+
+	void async_remove(void* user, gate::res_delete& res, auto_zone z)
+	{
+		async_entry<remove_callback>* e =
+			reinterpret_cast<async_entry<remove_callback>*>(user);
+		remove_result r;
+		r.error   = res.error;
+		r.key     = e->key;
+		r.keylen  = e->keylen;
+		r.removed = res.error ? false : res.deleted;
+		(*e->callback)(e->user, r);
+	}
+
+	void submit_set(const char* key, size_t keylen,
+			const char* val, size_t vallen,
+			gate::set_op_t operation, uint64_t clocktime,
+			set_callback callback, void* user)
+	{
+		shared_zone life(rpc::new_shared_zone());
+		async_entry<set_callback>* e = new_entry(life, key, keylen, callback, user);
+		char* v = (char*)life->malloc(vallen);
+		memcpy(v, val, vallen);
+
+		gate::req_set req;
+		req.key       = e->key;
+		req.keylen    = e->keylen;
+		req.val       = v;
+		req.vallen    = vallen;
+		req.operation = operation;
+		req.clocktime = clocktime;
+		req.budget_msec = s_budget_msec;
+		req.life      = life;
+		req.callback  = &async_set;
+		req.user      = reinterpret_cast<void*>(e);
+		req.submit();
+	}
+}  // noname namespace
+
+
+void client::get_async(const char* key, size_t keylen,
+		get_callback callback, void* user)
+{
+	shared_zone life(rpc::new_shared_zone());
+	async_entry<get_callback>* e = new_entry(life, key, keylen, callback, user);
+
+	gate::req_get req;
+	req.key      = e->key;
+	req.keylen   = e->keylen;
+	req.budget_msec = s_budget_msec;
+	req.life     = life;
+	req.callback = &async_get;
+	req.user     = reinterpret_cast<void*>(e);
+	req.submit();
+}
+
+void client::get_multi_async(unsigned int num,
+		const char* const* keys, const size_t* keylens,
+		get_callback callback, void* const* users)
+{
+	if(num == 0) { return; }
+
+	shared_zone life(rpc::new_shared_zone());
+	const char** ks  = (const char**)life->malloc(sizeof(char*) * num);
+	uint32_t* kls    = (uint32_t*)life->malloc(sizeof(uint32_t) * num);
+	void** us        = (void**)life->malloc(sizeof(void*) * num);
+	for(unsigned int i=0; i < num; ++i) {
+		async_entry<get_callback>* e =
+			new_entry(life, keys[i], keylens[i], callback, users[i]);
+		ks[i]  = e->key;
+		kls[i] = e->keylen;
+		us[i]  = reinterpret_cast<void*>(e);
+	}
+
+	gate::req_get_multi req;
+	req.num      = num;
+	req.keys     = ks;
+	req.keylens  = kls;
+	req.budget_msec = s_budget_msec;
+	req.life     = life;
+	req.callback = &async_get;
+	req.users    = us;
+	req.submit();
+}
+
+void client::set_async(const char* key, size_t keylen,
+		const char* val, size_t vallen,
+		set_callback callback, void* user)
+{
+	submit_set(key, keylen, val, vallen, gate::OP_SET, 0, callback, user);
+}
+
+void client::cas_async(const char* key, size_t keylen,
+		const char* val, size_t vallen, uint64_t cas,
+		set_callback callback, void* user)
+{
+	submit_set(key, keylen, val, vallen, gate::OP_CAS, cas, callback, user);
+}
+
+void client::remove_async(const char* key, size_t keylen,
+		remove_callback callback, void* user)
+{
+	shared_zone life(rpc::new_shared_zone());
+	async_entry<remove_callback>* e = new_entry(life, key, keylen, callback, user);
+
+	gate::req_delete req;
+	req.key      = e->key;
+	req.keylen   = e->keylen;
+	req.budget_msec = s_budget_msec;
+	req.life     = life;
+	req.callback = &async_remove;
+	req.user     = reinterpret_cast<void*>(e);
+	req.submit();
+}
+
+
+namespace {
+	// waits the callbacks of the synchronous and batched API
+	class waiter {
+	public:
+		waiter(unsigned int num) : m_remain(num), m_failed(0) { }
+
+		void done(bool failed)
+		{
+			pthread_scoped_lock lk(m_mutex);
+			if(failed) { ++m_failed; }
+			if(--m_remain == 0) {
+				m_cond.signal();
+			}
+		}
+
+		// returns number of failed requests
+		unsigned int wait()
+		{
+			pthread_scoped_lock lk(m_mutex);
+			while(m_remain > 0) {
+				m_cond.wait(m_mutex);
+			}
+			return m_failed;
+		}
+
+	private:
+		mp::pthread_mutex m_mutex;
+		mp::pthread_cond m_cond;
+		unsigned int m_remain;
+		unsigned int m_failed;
+	};
+
+	struct sync_get {
+		waiter* w;
+		bool found;
+		std::string val;
+		uint64_t cas;
+	};
+
+	void sync_get_callback(void* user, const get_result& res)
+	{
+		sync_get* s = reinterpret_cast<sync_get*>(user);
+		if(!res.error && res.val) {
+			s->found = true;
+			s->val.assign(res.val, res.vallen);
+			s->cas = res.cas;
+		}
+		s->w->done(res.error);
+	}
+
+	struct sync_set {
+		waiter* w;
+		bool stored;
+		uint64_t cas;
+	};
+
+	void sync_set_callback(void* user, const set_result& res)
+	{
+		sync_set* s = reinterpret_cast<sync_set*>(user);
+		s->stored = res.stored;
+		s->cas = res.cas;
+		s->w->done(res.error);
+	}
+
+	struct sync_remove {
+		waiter* w;
+		bool removed;
+	};
+
+	void sync_remove_callback(void* user, const remove_result& res)
+	{
+		sync_remove* s = reinterpret_cast<sync_remove*>(user);
+		s->removed = res.removed;
+		s->w->done(res.error);
+	}
+}  // noname namespace
+
+
+bool client::get(const std::string& key, std::string* val, uint64_t* cas)
+{
+	waiter w(1);
+	sync_get s;
+	s.w = &w;
+	s.found = false;
+	s.cas = 0;
+
+	get_async(key.data(), key.size(), &sync_get_callback, &s);
+	if(w.wait()) {
+		throw error("get failed");
+	}
+
+	if(!s.found) { return false; }
+	val->swap(s.val);
+	if(cas) { *cas = s.cas; }
+	return true;
+}
+
+uint64_t client::set(const std::string& key, const std::string& val)
+{
+	waiter w(1);
+	sync_set s;
+	s.w = &w;
+
+	set_async(key.data(), key.size(), val.data(), val.size(),
+			&sync_set_callback, &s);
+	if(w.wait()) {
+		throw error("set failed");
+	}
+	return s.cas;
+}
+
+bool client::cas(const std::string& key, const std::string& val, uint64_t cas)
+{
+	waiter w(1);
+	sync_set s;
+	s.w = &w;
+
+	cas_async(key.data(), key.size(), val.data(), val.size(), cas,
+			&sync_set_callback, &s);
+	if(w.wait()) {
+		throw error("cas failed");
+	}
+	return s.stored;
+}
+
+bool client::remove(const std::string& key)
+{
+	waiter w(1);
+	sync_remove s;
+	s.w = &w;
+
+	remove_async(key.data(), key.size(), &sync_remove_callback, &s);
+	if(w.wait()) {
+		throw error("remove failed");
+	}
+	return s.removed;
+}
+
+
+void client::get_multi(const std::vector<std::string>& keys,
+		std::map<std::string, std::string>* vals)
+{
+	unsigned int num = keys.size();
+	if(num == 0) { return; }
+
+	waiter w(num);
+	std::vector<sync_get> s(num);
+	std::vector<const char*> ks(num);
+	std::vector<size_t> kls(num);
+	std::vector<void*> us(num);
+	for(unsigned int i=0; i < num; ++i) {
+		s[i].w = &w;
+		s[i].found = false;
+		ks[i]  = keys[i].data();
+		kls[i] = keys[i].size();
+		us[i]  = &s[i];
+	}
+
+	get_multi_async(num, &ks[0], &kls[0], &sync_get_callback, &us[0]);
+	if(w.wait()) {
+		throw error("get_multi failed");
+	}
+
+	for(unsigned int i=0; i < num; ++i) {
+		if(s[i].found) {
+			(*vals)[keys[i]].swap(s[i].val);
+		}
+	}
+}
+
+void client::set_multi(const std::map<std::string, std::string>& kvs)
+{
+	if(kvs.empty()) { return; }
+
+	waiter w(kvs.size());
+	std::vector<sync_set> s(kvs.size());
+	unsigned int i = 0;
+	for(std::map<std::string, std::string>::const_iterator it(kvs.begin());
+			it != kvs.end(); ++it, ++i) {
+		s[i].w = &w;
+		set_async(it->first.data(), it->first.size(),
+				it->second.data(), it->second.size(),
+				&sync_set_callback, &s[i]);
+	}
+
+	if(w.wait()) {
+		throw error("set_multi failed");
+	}
+}
+
+size_t client::remove_multi(const std::vector<std::string>& keys)
+{
+	if(keys.empty()) { return 0; }
+
+	waiter w(keys.size());
+	std::vector<sync_remove> s(keys.size());
+	for(unsigned int i=0; i < keys.size(); ++i) {
+		s[i].w = &w;
+		s[i].removed = false;
+		remove_async(keys[i].data(), keys[i].size(),
+				&sync_remove_callback, &s[i]);
+	}
+
+	if(w.wait()) {
+		throw error("remove_multi failed");
+	}
+
+	size_t removed = 0;
+	for(unsigned int i=0; i < keys.size(); ++i) {
+		if(s[i].removed) { ++removed; }
+	}
+	return removed;
+}
+
+
+}  // namespace client
+}  // namespace kumo
+
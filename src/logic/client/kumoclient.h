@@ -0,0 +1,199 @@
+//
+// kumofs
+//
+// Copyright (C) 2009 FURUHASHI Sadayuki
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+//
+#ifndef KUMOCLIENT_H__
+#define KUMOCLIENT_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace kumo {
+namespace client {
+
+
+// libkumoclient embeds the routing modules of kumo-gateway.
+// It subscribes the hash space to the managers and sends requests
+// to the servers directly without kumo-gateway.
+struct config {
+	config();
+
+	std::string manager1;  // host[:port]
+	std::string manager2;  // host[:port], optional
+
+	unsigned short rthreads;
+	unsigned short wthreads;
+
+	double connect_timeout_sec;
+	unsigned short connect_retry_limit;
+
+	unsigned short server_connections;  // connections to each server
+
+	// requests to a server fail while this number of requests
+	// are queued to it. 0: unlimited
+	unsigned int server_queue_limit;
+
+	// requests fail if they are not finished in this msec.
+	// servers drop them after that. 0: disabled
+	unsigned int budget_msec;
+
+	double keepalive_interval;  // sec
+	double clock_interval;  // sec
+
+	unsigned short get_retry_num;
+	unsigned short set_retry_num;
+	unsigned short delete_retry_num;
+
+	unsigned short renew_threshold;
+
+	bool async_replicate_set;
+	bool async_replicate_delete;
+
+	bool read_balance;
+
+	std::string key_prefix;
+};
+
+
+struct error : std::runtime_error {
+	error(const std::string& msg) :
+		std::runtime_error(msg) { }
+};
+
+
+// results of the asynchronous API.
+// key and val are available only while the callback is running.
+
+struct get_result {
+	int error;  // 0 if succeeded
+
+	const char* key;
+	size_t keylen;
+
+	const char* val;  // NULL if the key is not found
+	size_t vallen;
+	uint64_t cas;
+};
+
+typedef void (*get_callback)(void* user, const get_result& res);
+
+struct set_result {
+	int error;
+
+	const char* key;
+	size_t keylen;
+
+	bool stored;  // false if cas failed
+	uint64_t cas;
+};
+
+typedef void (*set_callback)(void* user, const set_result& res);
+
+struct remove_result {
+	int error;
+
+	const char* key;
+	size_t keylen;
+
+	bool removed;  // false if the key is not found
+};
+
+typedef void (*remove_callback)(void* user, const remove_result& res);
+
+
+// only one client can run in a process.
+// callbacks are called on the worker threads of the client;
+// don't call the synchronous API in them.
+class client {
+public:
+	client(const config& cfg);
+	~client();
+
+	// starts the worker threads and waits until the hash space
+	// is received from the managers.
+	void start();
+
+	// stops the worker threads. pending callbacks may not be called.
+	void stop();
+
+public:
+	// synchronous API. throws client::error if failed.
+
+	// returns false if the key is not found
+	bool get(const std::string& key, std::string* val, uint64_t* cas = NULL);
+
+	uint64_t set(const std::string& key, const std::string& val);
+
+	// returns false if the value is modified after the cas was got
+	bool cas(const std::string& key, const std::string& val, uint64_t cas);
+
+	// returns false if the key is not found
+	bool remove(const std::string& key);
+
+public:
+	// batched API. requests are sent to the servers at once.
+
+	// missing keys are not stored into vals
+	void get_multi(const std::vector<std::string>& keys,
+			std::map<std::string, std::string>* vals);
+
+	void set_multi(const std::map<std::string, std::string>& kvs);
+
+	// returns number of removed keys
+	size_t remove_multi(const std::vector<std::string>& keys);
+
+public:
+	// asynchronous API. key and val are copied before returning.
+
+	void get_async(const char* key, size_t keylen,
+			get_callback callback, void* user);
+
+	// callback is called with users[i] for keys[i]
+	void get_multi_async(unsigned int num,
+			const char* const* keys, const size_t* keylens,
+			get_callback callback, void* const* users);
+
+	void set_async(const char* key, size_t keylen,
+			const char* val, size_t vallen,
+			set_callback callback, void* user);
+
+	void cas_async(const char* key, size_t keylen,
+			const char* val, size_t vallen, uint64_t cas,
+			set_callback callback, void* user);
+
+	void remove_async(const char* key, size_t keylen,
+			remove_callback callback, void* user);
+
+private:
+	struct context;
+	std::auto_ptr<context> m_ctx;
+
+private:
+	client();
+	client(const client&);
+};
+
+
+}  // namespace client
+}  // namespace kumo
+
+#endif /* kumoclient.h */
+
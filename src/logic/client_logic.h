@@ -32,8 +32,10 @@ class client_logic : public rpc_server<Framework>, public rpc::client {
 public:
 	client_logic(
 			unsigned int connect_timeout_msec,
-			unsigned short connect_retry_limit) :
-		rpc::client(connect_timeout_msec, connect_retry_limit) { }
+			unsigned short connect_retry_limit,
+			unsigned short connections_per_peer = 1) :
+		rpc::client(connect_timeout_msec, connect_retry_limit,
+				connections_per_peer) { }
 };
 
 
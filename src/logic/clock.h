@@ -21,6 +21,7 @@
 #include <limits>
 #include <stdint.h>
 #include <time.h>
+#include <sys/time.h>
 #include <cstdlib>
 
 #include <msgpack.hpp>
@@ -155,6 +156,28 @@ private:
 };
 
 
+// deadlines of requests are wall clock time in msec.
+// the clocks of the nodes are expected to be synchronized by NTP
+// as well as the time part of ClockTime. 0 means no deadline.
+inline uint64_t deadline_now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+inline uint64_t deadline_after(unsigned int msec)
+{
+	if(msec == 0) { return 0; }
+	return deadline_now() + msec;
+}
+
+inline bool deadline_passed(uint64_t deadline)
+{
+	return deadline != 0 && deadline <= deadline_now();
+}
+
+
 #ifdef MSGPACK_OBJECT_HPP__
 inline Clock& operator>> (msgpack::object o, Clock& v)
 {
@@ -27,6 +27,8 @@ namespace gateway {
 
 
 @message mod_network_t::HashSpacePush       = 3
+@message mod_network_t::HashSpaceDeltaPush  = 4
+@message mod_network_t::LeaseInvalidate     = 5
 
 
 @rpc mod_network_t
@@ -36,12 +38,32 @@ namespace gateway {
 		// acknowledge: true
 	};
 
+	message HashSpaceDeltaPush {
+		msgtype::HSDelta wdelta;
+		msgtype::HSDelta rdelta;
+		uint64_t flush_clocktime = 0;
+		// acknowledge: true
+		// base of the delta is unknown: false
+	};
+
+	message LeaseInvalidate {
+		uint64_t hash;
+		// acknowledge: true
+	};
+
+public:
+	mod_network_t();
+	~mod_network_t();
+
 public:
 	void keep_alive();
 
 	void renew_hash_space();
 	void renew_hash_space_for(const address& addr);
-	RPC_REPLY_DECL(HashSpaceRequest, from, res, err, z);
+	RPC_REPLY_DECL(HashSpaceSubscribe, from, res, err, z);
+
+private:
+	volatile uint64_t m_last_renew_usec;
 @end
 
 
@@ -31,6 +31,8 @@ void framework::dispatch(
 try {
 	switch(method.get()) {
 	RPC_DISPATCH(mod_network, HashSpacePush);
+	RPC_DISPATCH(mod_network, HashSpaceDeltaPush);
+	RPC_DISPATCH(mod_network, LeaseInvalidate);
 	default:
 		throw unknown_method_error();
 	}
@@ -43,10 +45,47 @@ void framework::session_lost(const address& addr, shared_session& s)
 	LOG_WARN("lost session ",addr);
 	if(addr == share->manager1() || addr == share->manager2()) {
 		mod_network.renew_hash_space_for(addr);
+	} else {
+		// the server may have lost the leases
+		mod_cache.invalidate_all_leases();
 	}
 }
 
 
+unsigned short framework::connections_per_peer(const address& addr)
+{
+	if(addr == share->manager1() || addr == share->manager2()) {
+		return 1;
+	}
+	return rpc::client::connections_per_peer(addr);
+}
+
+
+namespace {
+	struct log_loads {
+		void operator() (const address& addr, shared_session s)
+		{
+			if(addr == share->manager1() || addr == share->manager2()) {
+				return;
+			}
+			s->connection_loads(&loads);
+			LOG_TRACE("connection loads of ",addr,": ",loads.size()," connections");
+			TLOGPACK("sq",3,
+					"addr", addr,
+					"depth", loads,
+					"queue", (uint64_t)s->queue_depth());
+		}
+		std::vector<unsigned int> loads;
+	};
+}  // noname namespace
+
+void framework::log_connection_stats()
+{
+	log_loads f;
+	for_each_peer_session(f);
+}
+
+
 }  // namespace gateway
 }  // namespace kumo
 
@@ -32,8 +32,10 @@ public:
 	template <typename Config>
 	framework(const Config& cfg);
 
+	// handle_signals is false when the framework is embedded in
+	// libkumoclient.
 	template <typename Config>
-	void run(const Config& cfg);
+	void run(const Config& cfg, bool handle_signals = true);
 
 	void dispatch(
 			shared_session from, weak_responder response,
@@ -41,12 +43,23 @@ public:
 
 	void session_lost(const address& addr, shared_session& s);
 
+	// rpc::client
+	// connections to the managers are not pooled
+	unsigned short connections_per_peer(const address& addr);
+
 	// rpc_server
 	void keep_alive()
 	{
 		mod_network.keep_alive();
+		mod_cache.expire_leases();
+		mod_cache.expire_negatives();
+		mod_cache.log_stats();
+		log_connection_stats();
 	}
 
+	// requests in flight on each connection to the servers
+	void log_connection_stats();
+
 public:
 	mod_network_t mod_network;
 	mod_cache_t   mod_cache;
@@ -84,15 +97,61 @@ private:
 
 	std::string m_cfg_key_prefix;
 
+	const bool m_cfg_read_balance;
+	const unsigned short m_cfg_hedge_percentile;
+
+	const unsigned int m_cfg_batch_window_usec;
+	const unsigned int m_cfg_batch_size;
+
+	const bool m_cfg_lease;
+
+	const bool m_cfg_no_coalesce;
+
+	const unsigned int m_cfg_server_queue_limit;
+
 public:
 	// mod_store.cc
 	void incr_error_renew_count();
 
+	// mod_store.cc
+	// choose a replica of rhs by latency if cfg_read_balance is set.
+	// Note: hslk is not required
+	shared_session read_server_for(uint64_t h, read_route* route);
+	shared_session read_hedge_server_for(uint64_t h, read_route* route);
+	uint64_t read_route_end(read_route* route,
+			const rpc::basic_session* from, bool success);
+	void read_route_cancel(read_route* route);
+
+	// mod_store.cc
+	// true if the server has too many requests in flight or queued
+	bool server_queue_full(const shared_session& s);
+
+private:
+	static bool update_hs(HashSpace& hs, const HashSpace::Delta& delta);
+
+	read_stat* read_stat_of(const address& addr);
+
+	mp::pthread_mutex m_read_stats_mutex;
+	typedef std::map<address, read_stat> read_stats_t;
+	read_stats_t m_read_stats;  // entries are never erased
+
+	volatile unsigned int m_read_rr;
+
 public:
 	RESOURCE_ACCESSOR(mp::pthread_rwlock, hs_rwlock);
 	bool update_rhs(const HashSpace::Seed& seed, REQUIRE_HSLK_WRLOCK);
 	bool update_whs(const HashSpace::Seed& seed, REQUIRE_HSLK_WRLOCK);
 
+	// returns false if the base of the delta is unknown
+	bool update_rhs(const HashSpace::Delta& delta, REQUIRE_HSLK_WRLOCK);
+	bool update_whs(const HashSpace::Delta& delta, REQUIRE_HSLK_WRLOCK);
+
+	void hash_space_clocktime(ClockTime* wtime, ClockTime* rtime, REQUIRE_HSLK_RDLOCK);
+	void hash_space_clocktime(ClockTime* wtime, ClockTime* rtime, REQUIRE_HSLK_WRLOCK);
+
+	// true until the hash spaces are received from the managers
+	bool hash_space_empty(REQUIRE_HSLK_RDLOCK);
+
 	enum hash_space_type {
 		HS_WRITE,
 		HS_READ,
@@ -103,6 +162,14 @@ public:
 	template <hash_space_type Hs>
 	shared_session server_for(uint64_t h, unsigned int offset = 0);
 
+	template <hash_space_type Hs>
+	address server_addr_for(uint64_t h, unsigned int offset = 0);
+
+	// mod_store.cc
+	// replication factor of rhs
+	// Note: hslk is not required
+	unsigned int read_replication_factor();
+
 public:
 	RESOURCE_CONST_ACCESSOR(address, manager1);
 	RESOURCE_CONST_ACCESSOR(address, manager2);
@@ -118,6 +185,17 @@ public:
 
 	RESOURCE_CONST_ACCESSOR(std::string, cfg_key_prefix);
 
+	RESOURCE_CONST_ACCESSOR(bool, cfg_read_balance);
+	RESOURCE_CONST_ACCESSOR(unsigned short, cfg_hedge_percentile);
+
+	RESOURCE_CONST_ACCESSOR(unsigned int, cfg_batch_window_usec);
+	RESOURCE_CONST_ACCESSOR(unsigned int, cfg_batch_size);
+
+	RESOURCE_CONST_ACCESSOR(bool, cfg_lease);
+	RESOURCE_CONST_ACCESSOR(bool, cfg_no_coalesce);
+
+	RESOURCE_CONST_ACCESSOR(unsigned int, cfg_server_queue_limit);
+
 private:
 	resource();
 	resource(const resource&);
@@ -150,6 +228,60 @@ inline bool resource::update_whs(const HashSpace::Seed& seed, REQUIRE_HSLK_WRLOC
 	}
 }
 
+inline bool resource::update_hs(HashSpace& hs, const HashSpace::Delta& delta)
+{
+	if(!hs.empty() && delta.clocktime() < hs.clocktime()) {
+		return true;  // obsolete
+	}
+	if(delta.full()) {
+		HashSpace tmp;
+		tmp.apply(delta);
+		if(hs.empty() || !tmp.empty()) {
+			hs = tmp;
+		}
+		return true;
+	}
+	if(delta.clocktime() == hs.clocktime()) {
+		return true;  // not modified
+	}
+	// apply into a copy not to install an empty ring
+	HashSpace tmp(hs);
+	if(!tmp.apply(delta)) {
+		return false;
+	}
+	if(!tmp.empty()) {
+		hs = tmp;
+	}
+	return true;
+}
+
+inline bool resource::update_rhs(const HashSpace::Delta& delta, REQUIRE_HSLK_WRLOCK)
+{
+	return update_hs(m_rhs, delta);
+}
+
+inline bool resource::update_whs(const HashSpace::Delta& delta, REQUIRE_HSLK_WRLOCK)
+{
+	return update_hs(m_whs, delta);
+}
+
+inline void resource::hash_space_clocktime(ClockTime* wtime, ClockTime* rtime, REQUIRE_HSLK_RDLOCK)
+{
+	*wtime = m_whs.clocktime();
+	*rtime = m_rhs.clocktime();
+}
+
+inline void resource::hash_space_clocktime(ClockTime* wtime, ClockTime* rtime, REQUIRE_HSLK_WRLOCK)
+{
+	*wtime = m_whs.clocktime();
+	*rtime = m_rhs.clocktime();
+}
+
+inline bool resource::hash_space_empty(REQUIRE_HSLK_RDLOCK)
+{
+	return m_whs.empty() || m_rhs.empty();
+}
+
 
 }  // namespace gateway
 }  // namespace kumo
@@ -37,6 +37,11 @@ void req_get::submit()
 	gateway::net->mod_store.Get(*this);
 }
 
+void req_get_multi::submit()
+{
+	gateway::net->mod_store.GetMulti(*this);
+}
+
 void req_set::submit()
 {
 	gateway::net->mod_store.Set(*this);
@@ -47,6 +52,16 @@ void req_delete::submit()
 	gateway::net->mod_store.Delete(*this);
 }
 
+void req_incr::submit()
+{
+	gateway::net->mod_store.Incr(*this);
+}
+
+void req_flush::submit()
+{
+	gateway::net->mod_store.FlushAll(*this);
+}
+
 
 }  // namespace gate
 }  // namespace kumo
@@ -28,19 +28,32 @@ template <typename Config>
 framework::framework(const Config& cfg) :
 	client_logic<framework>(
 			cfg.connect_timeout_msec,
-			cfg.connect_retry_limit)
+			cfg.connect_retry_limit,
+			cfg.server_connections)
 {
 	if(!cfg.local_cache.empty()) {
 		mod_cache.init(cfg.local_cache.c_str());
 	}
+	if(cfg.cache_memory_mb) {
+		mod_cache.init_memory((size_t)cfg.cache_memory_mb * 1024 * 1024);
+	}
+	if(cfg.negative_ttl_msec) {
+		mod_cache.init_negative(cfg.negative_ttl_msec, cfg.negative_limit);
+	}
 }
 
 template <typename Config>
-void framework::run(const Config& cfg)
+void framework::run(const Config& cfg, bool handle_signals)
 {
-	init_wavy(cfg.rthreads, cfg.wthreads);  // wavy_server
+	init_wavy(cfg.rthreads, cfg.wthreads, handle_signals);  // wavy_server
 	start_timeout_step(cfg.clock_interval_usec);  // rpc_server
 	start_keepalive(cfg.keepalive_interval_usec);  // rpc_server
+	if(share->cfg_hedge_percentile()) {
+		mod_store.start_hedge_timer();
+	}
+	if(share->cfg_batch_window_usec()) {
+		mod_store.start_batch_timer();
+	}
 	mod_network.renew_hash_space();
 	TLOGPACK("SW",2,
 			"mgr1", share->manager1(),
@@ -58,7 +71,15 @@ resource::resource(const Config& cfg) :
 	m_cfg_delete_retry_num(cfg.delete_retry_num),
 	m_cfg_renew_threshold(cfg.renew_threshold),
 	m_cfg_key_prefix(cfg.key_prefix),
-	m_error_count(0)
+	m_cfg_read_balance(cfg.read_balance),
+	m_cfg_hedge_percentile(cfg.hedge_percentile),
+	m_cfg_batch_window_usec(cfg.batch_window_usec),
+	m_cfg_batch_size(cfg.batch_size),
+	m_cfg_lease(cfg.lease),
+	m_cfg_no_coalesce(cfg.no_coalesce),
+	m_cfg_server_queue_limit(cfg.server_queue_limit),
+	m_error_count(0),
+	m_read_rr(0)
 { }
 
 template <typename Config>
@@ -0,0 +1,299 @@
+//
+// kumofs
+//
+// Copyright (C) 2009 FURUHASHI Sadayuki
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+//
+#include "gateway/local_cache.h"
+#include "storage/storage.h"
+#include <stdlib.h>
+#include <string.h>
+
+namespace kumo {
+namespace gateway {
+
+
+// key and raw value follow the header in the same block
+struct local_cache::entry {
+	volatile unsigned int ref;  // the table and the readers
+	bool referenced;            // CLOCK bit
+
+	uint64_t hash;
+	uint32_t keylen;
+	uint32_t raw_vallen;
+
+	entry* chain;  // next entry in the bucket
+	entry* prev;   // CLOCK ring
+	entry* next;
+
+	char* key()		{ return reinterpret_cast<char*>(this + 1); }
+	char* raw_val()	{ return key() + keylen; }
+	size_t bytes() const { return sizeof(entry) + keylen + raw_vallen; }
+};
+
+struct local_cache::shard {
+	shard() : hand(NULL), bytes(0), entries(0),
+		hits(0), misses(0), evictions(0) { }
+
+	mp::pthread_mutex mutex;
+	std::vector<entry*> buckets;
+	entry* hand;  // CLOCK hand
+
+	size_t bytes;
+	size_t entries;
+
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+};
+
+
+local_cache::local_cache(size_t budget_bytes) :
+	m_shards(new shard[SHARDS]),
+	m_shard_budget(budget_bytes / SHARDS)
+{
+	for(unsigned int i=0; i < SHARDS; ++i) {
+		m_shards[i].buckets.resize(1024, NULL);
+	}
+}
+
+local_cache::~local_cache()
+{
+	for(unsigned int i=0; i < SHARDS; ++i) {
+		shard* s = &m_shards[i];
+		for(std::vector<entry*>::iterator it(s->buckets.begin());
+				it != s->buckets.end(); ++it) {
+			for(entry* e = *it; e != NULL; ) {
+				entry* x = e;
+				e = e->chain;
+				release(x);
+			}
+		}
+	}
+	delete[] m_shards;
+}
+
+
+bool local_cache::get(const msgtype::DBKey& key, msgtype::DBValue* result_val,
+		msgpack::zone* z)
+{
+	shard* s = shard_of(key.hash());
+	entry* e;
+	{
+		mp::pthread_scoped_lock lk(s->mutex);
+		e = find(s, key, NULL);
+		if(!e) {
+			++s->misses;
+			return false;
+		}
+		e->referenced = true;
+		++s->hits;
+		__sync_add_and_fetch(&e->ref, 1);
+	}
+
+	z->push_finalizer(&local_cache::release, reinterpret_cast<void*>(e));
+	*result_val = msgtype::DBValue(e->raw_val(), e->raw_vallen);
+	return true;
+}
+
+void local_cache::update(const msgtype::DBKey& key, const msgtype::DBValue& val)
+{
+	size_t bytes = sizeof(entry) + key.size() + val.raw_size();
+	if(bytes > m_shard_budget) {
+		return;
+	}
+
+	entry* n = reinterpret_cast<entry*>(::malloc(bytes));
+	if(!n) {
+		return;
+	}
+	n->ref        = 1;
+	n->referenced = false;
+	n->hash       = key.hash();
+	n->keylen     = key.size();
+	n->raw_vallen = val.raw_size();
+	memcpy(n->key(), key.data(), key.size());
+	memcpy(n->raw_val(), val.raw_data(), val.raw_size());
+
+	shard* s = shard_of(key.hash());
+	mp::pthread_scoped_lock lk(s->mutex);
+
+	entry** slot;
+	entry* e = find(s, key, &slot);
+	if(e) {
+		if(!(Storage::clocktime_of(e->raw_val()) < val.clocktime())) {
+			lk.unlock();
+			::free(n);
+			return;  // cached one is newer
+		}
+		unlink(s, e, slot);
+	}
+
+	evict(s, m_shard_budget - bytes);
+
+	if(s->entries >= s->buckets.size()) {
+		grow(s);
+	}
+
+	slot = &s->buckets[n->hash & (s->buckets.size() - 1)];
+	n->chain = *slot;
+	*slot = n;
+
+	if(s->hand == NULL) {
+		n->prev = n;
+		n->next = n;
+		s->hand = n;
+	} else {
+		// insert behind the hand
+		n->next = s->hand;
+		n->prev = s->hand->prev;
+		s->hand->prev->next = n;
+		s->hand->prev = n;
+	}
+
+	s->bytes += bytes;
+	++s->entries;
+}
+
+void local_cache::remove(const msgtype::DBKey& key)
+{
+	shard* s = shard_of(key.hash());
+	mp::pthread_scoped_lock lk(s->mutex);
+
+	entry** slot;
+	entry* e = find(s, key, &slot);
+	if(e) {
+		unlink(s, e, slot);
+	}
+}
+
+void local_cache::clear()
+{
+	for(unsigned int i=0; i < SHARDS; ++i) {
+		shard* s = &m_shards[i];
+		mp::pthread_scoped_lock lk(s->mutex);
+		for(std::vector<entry*>::iterator it(s->buckets.begin());
+				it != s->buckets.end(); ++it) {
+			for(entry* e = *it; e != NULL; ) {
+				entry* x = e;
+				e = e->chain;
+				release(x);  // readers may still refer it
+			}
+			*it = NULL;
+		}
+		s->hand = NULL;
+		s->bytes = 0;
+		s->entries = 0;
+	}
+}
+
+void local_cache::stats(stats_t* result)
+{
+	*result = stats_t();
+	for(unsigned int i=0; i < SHARDS; ++i) {
+		shard* s = &m_shards[i];
+		mp::pthread_scoped_lock lk(s->mutex);
+		result->hits      += s->hits;
+		result->misses    += s->misses;
+		result->evictions += s->evictions;
+		result->bytes     += s->bytes;
+		result->entries   += s->entries;
+	}
+}
+
+
+local_cache::shard* local_cache::shard_of(uint64_t hash)
+{
+	// lower bits are used by the buckets
+	return &m_shards[(hash >> 48) % SHARDS];
+}
+
+local_cache::entry* local_cache::find(shard* s,
+		const msgtype::DBKey& key, entry*** pslot)
+{
+	entry** slot = &s->buckets[key.hash() & (s->buckets.size() - 1)];
+	for(; *slot != NULL; slot = &(*slot)->chain) {
+		entry* e = *slot;
+		if(e->hash == key.hash() && e->keylen == key.size() &&
+				memcmp(e->key(), key.data(), key.size()) == 0) {
+			break;
+		}
+	}
+	if(pslot) { *pslot = slot; }
+	return *slot;
+}
+
+void local_cache::unlink(shard* s, entry* e, entry** slot)
+{
+	*slot = e->chain;
+
+	if(e->next == e) {
+		s->hand = NULL;
+	} else {
+		e->prev->next = e->next;
+		e->next->prev = e->prev;
+		if(s->hand == e) { s->hand = e->next; }
+	}
+
+	s->bytes -= e->bytes();
+	--s->entries;
+	release(e);  // readers may still refer it
+}
+
+void local_cache::evict(shard* s, size_t limit)
+{
+	// CLOCK: skip the entries referenced after the hand passed
+	while(s->hand != NULL && s->bytes > limit) {
+		entry* e = s->hand;
+		if(e->referenced) {
+			e->referenced = false;
+			s->hand = e->next;
+			continue;
+		}
+
+		entry** slot = &s->buckets[e->hash & (s->buckets.size() - 1)];
+		while(*slot != e) { slot = &(*slot)->chain; }
+		unlink(s, e, slot);
+		++s->evictions;
+	}
+}
+
+void local_cache::grow(shard* s)
+{
+	std::vector<entry*> buckets(s->buckets.size() * 2, NULL);
+	size_t mask = buckets.size() - 1;
+	for(std::vector<entry*>::iterator it(s->buckets.begin());
+			it != s->buckets.end(); ++it) {
+		for(entry* e = *it; e != NULL; ) {
+			entry* x = e;
+			e = e->chain;
+			x->chain = buckets[x->hash & mask];
+			buckets[x->hash & mask] = x;
+		}
+	}
+	s->buckets.swap(buckets);
+}
+
+void local_cache::release(void* p)
+{
+	entry* e = reinterpret_cast<entry*>(p);
+	if(__sync_sub_and_fetch(&e->ref, 1) == 0) {
+		::free(e);
+	}
+}
+
+
+}  // namespace gateway
+}  // namespace kumo
+
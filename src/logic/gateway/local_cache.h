@@ -0,0 +1,87 @@
+//
+// kumofs
+//
+// Copyright (C) 2009 FURUHASHI Sadayuki
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+//
+#ifndef GATEWAY_LOCAL_CACHE_H__
+#define GATEWAY_LOCAL_CACHE_H__
+
+#include "logic/msgtype.h"
+#include <mp/pthread.h>
+#include <vector>
+
+namespace kumo {
+namespace gateway {
+
+
+// in-process cache of DBValues.
+// entries are partitioned into lock-striped shards and evicted by
+// CLOCK algorithm when the shard exceeds its byte budget.
+// hits refer the cached bytes with reference counting instead of copying.
+class local_cache {
+public:
+	local_cache(size_t budget_bytes);
+	~local_cache();
+
+public:
+	// the value is available till the zone is freed
+	bool get(const msgtype::DBKey& key, msgtype::DBValue* result_val,
+			msgpack::zone* z);
+
+	// stores the value if it is newer than the cached one
+	void update(const msgtype::DBKey& key, const msgtype::DBValue& val);
+
+	void remove(const msgtype::DBKey& key);
+
+	void clear();
+
+	struct stats_t {
+		stats_t() : hits(0), misses(0), evictions(0), bytes(0), entries(0) { }
+		uint64_t hits;
+		uint64_t misses;
+		uint64_t evictions;
+		uint64_t bytes;
+		uint64_t entries;
+	};
+
+	void stats(stats_t* result);
+
+private:
+	struct entry;
+	struct shard;
+
+	static const unsigned int SHARDS = 16;
+
+	shard* shard_of(uint64_t hash);
+	static entry* find(shard* s, const msgtype::DBKey& key, entry*** pslot);
+	static void unlink(shard* s, entry* e, entry** slot);
+	static void evict(shard* s, size_t limit);
+	static void grow(shard* s);
+	static void release(void* e);
+
+	shard* m_shards;
+	size_t m_shard_budget;
+
+private:
+	local_cache();
+	local_cache(const local_cache&);
+};
+
+
+}  // namespace gateway
+}  // namespace kumo
+
+#endif /* gateway/local_cache.h */
+
@@ -21,6 +21,8 @@
 #include "gate/memcache_text.h"
 #include "gate/memcache_binary.h"
 #include "gate/cloudy.h"
+#include "gate/reactors.h"
+#include "gate/admission.h"
 
 using namespace kumo;
 
@@ -46,6 +48,10 @@ struct arg_t : rpc_args {
 	bool async_replicate_delete;
 
 	std::string local_cache;
+	unsigned int cache_memory_mb;
+
+	unsigned int negative_ttl_msec;
+	unsigned int negative_limit;
 
 	bool mctext_set;
 	sockaddr_in mctext_addr_in;
@@ -59,21 +65,85 @@ struct arg_t : rpc_args {
 	sockaddr_in cloudy_addr_in;
 	int cloudy_lsock;  // convert
 
+	unsigned short gate_reactors;
+	std::vector<int> mctext_lsocks;  // convert
+	std::vector<int> mcbin_lsocks;  // convert
+	std::vector<int> cloudy_lsocks;  // convert
+
 	bool mc_save_flag;
 	bool mc_save_exptime;
 
 	std::string key_prefix;
 
+	bool read_balance;
+	unsigned short hedge_percentile;
+
+	unsigned int batch_window_usec;
+	unsigned int batch_size;
+
+	bool lease;
+
+	bool no_coalesce;
+
+	unsigned short server_connections;
+
+	unsigned int client_queue_limit;
+	unsigned int client_queue_kb;
+	unsigned int server_queue_limit;
+
+	unsigned int mctext_budget_msec;
+	unsigned int mcbin_budget_msec;
+	unsigned int cloudy_budget_msec;
+
 	virtual void convert()
 	{
 		rpc_args::convert();
 
+		if(hedge_percentile > 99) {
+			throw std::runtime_error("--hedge-percentile must be less than 100");
+		}
+		if(!local_cache.empty() && cache_memory_mb) {
+			throw std::runtime_error("--local-cache and --cache-memory are exclusive");
+		}
+		if(lease && local_cache.empty() && !cache_memory_mb) {
+			throw std::runtime_error("--lease requires --local-cache or --cache-memory");
+		}
+		if(batch_size < 2 || batch_size > 64) {
+			throw std::runtime_error("--batch-size must be between 2 and 64");
+		}
+		if(server_connections < 1 || server_connections > 64) {
+			throw std::runtime_error("--server-connections must be between 1 and 64");
+		}
+		if(batch_window_usec != 0 &&
+				(batch_window_usec < 10 || batch_window_usec > 1000)) {
+			throw std::runtime_error("--batch-window must be 0 or between 10 and 1000");
+		}
+
 		manager1 = rpc::address(manager1_in);
 		manager2 = rpc::address(manager2_in);
 
 		if(!mctext_set && !mcbin_set && !cloudy_set) {
 			throw std::runtime_error("-t, -b or -c is required");
 		}
+		if(gate_reactors) {
+			// one SO_REUSEPORT socket for each reactor
+			for(unsigned short i=0; i < gate_reactors; ++i) {
+				if(mctext_set) {
+					mctext_lsocks.push_back(
+							scoped_listen_tcp::listen(mctext_addr_in, true));
+				}
+				if(mcbin_set) {
+					mcbin_lsocks.push_back(
+							scoped_listen_tcp::listen(mcbin_addr_in, true));
+				}
+				if(cloudy_set) {
+					cloudy_lsocks.push_back(
+							scoped_listen_tcp::listen(cloudy_addr_in, true));
+				}
+			}
+			return;
+		}
+
 		if(mctext_set) {
 			mctext_lsock = scoped_listen_tcp::listen(mctext_addr_in);
 		}
@@ -89,7 +159,21 @@ struct arg_t : rpc_args {
 		get_retry_num(5),
 		set_retry_num(20),
 		delete_retry_num(20),
-		renew_threshold(4)
+		renew_threshold(4),
+		cache_memory_mb(0),
+		negative_ttl_msec(0),
+		negative_limit(65536),
+		hedge_percentile(0),
+		batch_window_usec(0),
+		batch_size(32),
+		gate_reactors(0),
+		server_connections(1),
+		client_queue_limit(1024),
+		client_queue_kb(16*1024),
+		server_queue_limit(8192),
+		mctext_budget_msec(0),
+		mcbin_budget_msec(0),
+		cloudy_budget_msec(0)
 	{
 		using namespace kazuhiki;
 		set_basic_args();
@@ -99,6 +183,12 @@ struct arg_t : rpc_args {
 				type::connectable(&manager2_in, MANAGER_DEFAULT_PORT));
 		on("-lc","--local-cache",
 				type::string(&local_cache, ""));
+		on("-cm","--cache-memory",
+				type::numeric(&cache_memory_mb, cache_memory_mb));
+		on("-nt","--negative-ttl",
+				type::numeric(&negative_ttl_msec, negative_ttl_msec));
+		on("-nn","--negative-limit",
+				type::numeric(&negative_limit, negative_limit));
 		on("-t", "--memproto-text", &mctext_set,
 				type::listenable(&mctext_addr_in, MEMTEXT_DEFAULT_PORT));
 		on("-b", "--memproto-binary", &mcbin_set,
@@ -123,6 +213,34 @@ struct arg_t : rpc_args {
 				type::boolean(&async_replicate_delete));
 		on("-k", "--key-prefix",
 				type::string(&key_prefix, ""));
+		on("-rb", "--read-balance",
+				type::boolean(&read_balance));
+		on("-hp", "--hedge-percentile",
+				type::numeric(&hedge_percentile, hedge_percentile));
+		on("-bw", "--batch-window",
+				type::numeric(&batch_window_usec, batch_window_usec));
+		on("-bn", "--batch-size",
+				type::numeric(&batch_size, batch_size));
+		on("-L", "--lease",
+				type::boolean(&lease));
+		on("-NC", "--no-coalesce",
+				type::boolean(&no_coalesce));
+		on("-TG", "--gate-reactors",
+				type::numeric(&gate_reactors, gate_reactors));
+		on("-sc", "--server-connections",
+				type::numeric(&server_connections, server_connections));
+		on("-Qc", "--client-queue",
+				type::numeric(&client_queue_limit, client_queue_limit));
+		on("-Qb", "--client-queue-kb",
+				type::numeric(&client_queue_kb, client_queue_kb));
+		on("-Qs", "--server-queue",
+				type::numeric(&server_queue_limit, server_queue_limit));
+		on("-Bt", "--memproto-text-budget",
+				type::numeric(&mctext_budget_msec, mctext_budget_msec));
+		on("-Bb", "--memproto-binary-budget",
+				type::numeric(&mcbin_budget_msec, mcbin_budget_msec));
+		on("-Bc", "--cloudy-budget",
+				type::numeric(&cloudy_budget_msec, cloudy_budget_msec));
 		parse(argc, argv);
 	}
 
@@ -140,6 +258,12 @@ struct arg_t : rpc_args {
 			"--manager2        address of manager 2\n"
 		"  -lc                       "
 			"--local-cache     local cache (Tokyo Cabinet abstract database)\n"
+		"  -cm <number="<<cache_memory_mb<<">            "
+			"--cache-memory    size of in-process cache in MB (0: disabled)\n"
+		"  -nt <number="<<negative_ttl_msec<<">            "
+			"--negative-ttl    cache missing keys for this msec (0: disabled)\n"
+		"  -nn <number="<<negative_limit<<">        "
+			"--negative-limit  maximum number of cached missing keys\n"
 		"  -t  <[addr:]port="<<MEMTEXT_DEFAULT_PORT<<">   "
 			"--memproto-text   memcached text protocol listen port\n"
 		"  -b  <[addr:]port="<<MEMPROTO_DEFAULT_PORT<<">   "
@@ -164,6 +288,34 @@ struct arg_t : rpc_args {
 			"--renew-threshold        hash space renew threshold\n"
 		"  -k <string>       "
 			"--key-prefix             add prefix to keys automatically\n"
+		"  -rb               "
+			"--read-balance           route reads to the least loaded replica\n"
+		"  -hp <number="<<hedge_percentile<<">    "
+			"--hedge-percentile       send hedged get after this percentile of latency (0: disabled)\n"
+		"  -bw <number="<<batch_window_usec<<">    "
+			"--batch-window           gather requests to a server up to this usec (0: disabled)\n"
+		"  -bn <number="<<batch_size<<">   "
+			"--batch-size             maximum number of requests sent at once\n"
+		"  -L                "
+			"--lease                  use cached values while the servers lease them\n"
+		"  -NC               "
+			"--no-coalesce            don't share a response among concurrent gets of a key\n"
+		"  -TG <number="<<gate_reactors<<">    "
+			"--gate-reactors          serve clients on independent reactors with SO_REUSEPORT (0: disabled)\n"
+		"  -sc <number="<<server_connections<<">    "
+			"--server-connections     number of connections to each server\n"
+		"  -Qc <number="<<client_queue_limit<<">    "
+			"--client-queue           stop reading a client while this number of its requests are in flight (0: unlimited)\n"
+		"  -Qb <number="<<client_queue_kb<<">   "
+			"--client-queue-kb        stop reading a client while this KB of its keys and values are in flight (0: unlimited)\n"
+		"  -Qs <number="<<server_queue_limit<<">    "
+			"--server-queue           fail requests to a server while this number of requests are queued to it (0: unlimited)\n"
+		"  -Bt <number="<<mctext_budget_msec<<">    "
+			"--memproto-text-budget   give up requests on memcached text protocol after this msec (0: disabled)\n"
+		"  -Bb <number="<<mcbin_budget_msec<<">    "
+			"--memproto-binary-budget give up requests on memcached binary protocol after this msec (0: disabled)\n"
+		"  -Bc <number="<<cloudy_budget_msec<<">    "
+			"--cloudy-budget          give up requests on cloudy protocol after this msec (0: disabled)\n"
 		;
 		rpc_args::show_usage();
 	}
@@ -184,9 +336,17 @@ int main(int argc, char* argv[])
 	std::auto_ptr<MemcacheText> mctext;
 	std::auto_ptr<MemcacheBinary> mcbin;
 	std::auto_ptr<Cloudy> cloudy;
-	if(arg.mctext_set) { mctext.reset(new MemcacheText(arg.mctext_lsock, arg.mc_save_flag, arg.mc_save_exptime)); }
-	if(arg.mcbin_set)  { mcbin.reset(new MemcacheBinary(arg.mcbin_lsock, arg.mc_save_flag, arg.mc_save_exptime)); }
-	if(arg.cloudy_set) { cloudy.reset(new Cloudy(arg.cloudy_lsock)); }
+	std::auto_ptr<gate::reactors> reactors;
+	if(arg.gate_reactors) {
+		reactors.reset(new gate::reactors(arg.gate_reactors));
+		if(arg.mctext_set) { mctext.reset(new MemcacheText(reactors.get(), arg.mctext_lsocks, arg.mc_save_flag, arg.mc_save_exptime, arg.mctext_budget_msec)); }
+		if(arg.mcbin_set)  { mcbin.reset(new MemcacheBinary(reactors.get(), arg.mcbin_lsocks, arg.mc_save_flag, arg.mc_save_exptime, arg.mcbin_budget_msec)); }
+		if(arg.cloudy_set) { cloudy.reset(new Cloudy(reactors.get(), arg.cloudy_lsocks, arg.cloudy_budget_msec)); }
+	} else {
+		if(arg.mctext_set) { mctext.reset(new MemcacheText(arg.mctext_lsock, arg.mc_save_flag, arg.mc_save_exptime, arg.mctext_budget_msec)); }
+		if(arg.mcbin_set)  { mcbin.reset(new MemcacheBinary(arg.mcbin_lsock, arg.mc_save_flag, arg.mc_save_exptime, arg.mcbin_budget_msec)); }
+		if(arg.cloudy_set) { cloudy.reset(new Cloudy(arg.cloudy_lsock, arg.cloudy_budget_msec)); }
+	}
 
 	// daemonize
 	if(!arg.pidfile.empty()) {
@@ -199,6 +359,8 @@ int main(int argc, char* argv[])
 	}
 
 	// run server
+	gate::admission::set_limits(arg.client_queue_limit,
+			(size_t)arg.client_queue_kb * 1024);
 	gateway::init(arg);
 
 	if(mctext.get()) { mctext->run(); }
@@ -206,6 +368,20 @@ int main(int argc, char* argv[])
 	if(cloudy.get()) { cloudy->run(); }
 
 	gateway::net->run(arg);
+	if(reactors.get()) { reactors->run(); }
+
+	{
+		struct timespec interval = {
+			arg.keepalive_interval_usec / 1000000,
+			arg.keepalive_interval_usec % 1000000 * 1000 };
+		wavy::timer(&interval, &gate::admission::log_stats);
+	}
+
 	gateway::net->join();
+
+	if(reactors.get()) {
+		reactors->end();
+		reactors->join();
+	}
 }
 
@@ -17,12 +17,20 @@
 //
 #include "gateway/framework.h"
 #include "storage/storage.h"
+#include <sys/time.h>
 
 namespace kumo {
 namespace gateway {
 
 
-mod_cache_t::mod_cache_t() : m_db(NULL) { }
+mod_cache_t::mod_cache_t() :
+	m_flush_clocktime(0),
+	m_negative_ttl_usec(0), m_negative_limit(0),
+	m_db(NULL), m_mem(NULL)
+{
+	for(unsigned int i=0; i < LEASE_SEQ_STRIPES; ++i) { m_lease_seq[i] = 0; }
+	for(unsigned int i=0; i < NEGATIVE_SEQ_STRIPES; ++i) { m_negative_seq[i] = 0; }
+}
 
 mod_cache_t::~mod_cache_t()
 {
@@ -30,6 +38,7 @@ mod_cache_t::~mod_cache_t()
 		tcadbclose(m_db);
 		tcadbdel(m_db);
 	}
+	delete m_mem;
 }
 
 void mod_cache_t::init(const char* name)
@@ -46,6 +55,44 @@ void mod_cache_t::init(const char* name)
 	}
 }
 
+void mod_cache_t::init_memory(size_t budget_bytes)
+{
+	m_mem = new local_cache(budget_bytes);
+}
+
+void mod_cache_t::log_stats()
+{
+	if(!m_mem) { return; }
+	local_cache::stats_t st;
+	m_mem->stats(&st);
+	TLOGPACK("cs",3,
+			"hit", st.hits,
+			"miss", st.misses,
+			"evict", st.evictions,
+			"mem", st.bytes,
+			"num", st.entries);
+}
+
+void mod_cache_t::flush(ClockTime flush_clocktime)
+{
+	while(true) {
+		uint64_t x = m_flush_clocktime;
+		if(!(ClockTime(x) < flush_clocktime)) {
+			return;
+		}
+		if(__sync_bool_compare_and_swap(&m_flush_clocktime,
+					x, flush_clocktime.get())) {
+			break;
+		}
+	}
+
+	LOG_INFO("flush local cache at ",flush_clocktime.get());
+	if(m_mem) { m_mem->clear(); }
+	if(m_db) { tcadbvanish(m_db); }
+	invalidate_all_leases();
+	invalidate_all_negatives();
+}
+
 bool mod_cache_t::get_real(const msgtype::DBKey& key, msgtype::DBValue* result_val,
 		msgpack::zone* z)
 {
@@ -99,6 +146,203 @@ void mod_cache_t::update_real(const msgtype::DBKey& key, const msgtype::DBValue&
 }
 
 
+namespace {
+static uint64_t now_usec()
+{
+	struct timeval v;
+	gettimeofday(&v, NULL);
+	return (uint64_t)v.tv_sec * 1000 * 1000 + v.tv_usec;
+}
+}  // noname namespace
+
+void mod_cache_t::issue_lease_ticket(uint64_t hash, lease_ticket* result)
+{
+	result->sent_usec = now_usec();
+	pthread_scoped_lock lslk(m_leases_mutex);
+	result->seq = m_lease_seq[hash % LEASE_SEQ_STRIPES];
+}
+
+bool mod_cache_t::set_lease(const msgtype::DBKey& key,
+		const lease_ticket& ticket, uint32_t lease_msec)
+{
+	if(!is_enabled()) { return false; }
+
+	// the lease starts before the request is sent at the latest
+	uint64_t expire = ticket.sent_usec + (uint64_t)lease_msec * 1000;
+
+	pthread_scoped_lock lslk(m_leases_mutex);
+	if(m_lease_seq[key.hash() % LEASE_SEQ_STRIPES] != ticket.seq) {
+		// invalidated while the request is in flight
+		return false;
+	}
+	m_leases[std::make_pair(key.hash(),
+			std::string(key.data(), key.size()))] = expire;
+	return true;
+}
+
+bool mod_cache_t::get_leased(const msgtype::DBKey& key, msgtype::DBValue* result_val,
+		msgpack::zone* z)
+{
+	if(!is_enabled()) { return false; }
+
+	{
+		pthread_scoped_lock lslk(m_leases_mutex);
+		leases_t::iterator it(m_leases.find(std::make_pair(key.hash(),
+						std::string(key.data(), key.size()))));
+		if(it == m_leases.end()) {
+			return false;
+		}
+		if(it->second <= now_usec()) {
+			m_leases.erase(it);
+			return false;
+		}
+	}
+
+	return get(key, result_val, z);
+}
+
+void mod_cache_t::invalidate_lease(uint64_t hash)
+{
+	pthread_scoped_lock lslk(m_leases_mutex);
+	++m_lease_seq[hash % LEASE_SEQ_STRIPES];
+	leases_t::iterator it(m_leases.lower_bound(
+				std::make_pair(hash, std::string())));
+	while(it != m_leases.end() && it->first.first == hash) {
+		m_leases.erase(it++);
+	}
+}
+
+void mod_cache_t::invalidate_all_leases()
+{
+	pthread_scoped_lock lslk(m_leases_mutex);
+	for(unsigned int i=0; i < LEASE_SEQ_STRIPES; ++i) { ++m_lease_seq[i]; }
+	m_leases.clear();
+}
+
+void mod_cache_t::expire_leases()
+{
+	uint64_t now = now_usec();
+	pthread_scoped_lock lslk(m_leases_mutex);
+	for(leases_t::iterator it(m_leases.begin()); it != m_leases.end(); ) {
+		if(it->second <= now) {
+			m_leases.erase(it++);
+		} else {
+			++it;
+		}
+	}
+}
+
+
+void mod_cache_t::init_negative(unsigned int ttl_msec, size_t limit)
+{
+	m_negative_ttl_usec = (uint64_t)ttl_msec * 1000;
+	m_negative_limit = limit;
+}
+
+uint32_t mod_cache_t::negative_ticket(uint64_t hash)
+{
+	if(!m_negative_ttl_usec) { return 0; }
+	negative_stripe& st(negative_stripe_of(hash));
+	pthread_scoped_lock nglk(st.mutex);
+	return m_negative_seq[hash % NEGATIVE_SEQ_STRIPES];
+}
+
+// drops the expired entries and the oldest ones till the size
+// of the queue is less than the limit
+void mod_cache_t::pop_negatives(negative_stripe& st, uint64_t now, size_t limit)
+{
+	while(!st.queue.empty() &&
+			(st.queue.front().first <= now || st.queue.size() >= limit)) {
+		negatives_t::iterator it(st.map.find(st.queue.front().second));
+		if(it != st.map.end() && it->second == st.queue.front().first) {
+			st.map.erase(it);
+		}
+		st.queue.pop_front();
+	}
+}
+
+void mod_cache_t::set_negative(const msgtype::DBKey& key, uint32_t ticket)
+{
+	if(!m_negative_ttl_usec) { return; }
+
+	uint64_t now = now_usec();
+	uint64_t expire = now + m_negative_ttl_usec;
+	size_t limit = (m_negative_limit + NEGATIVE_STRIPES - 1) / NEGATIVE_STRIPES;
+	negative_key nk(key.hash(), std::string(key.data(), key.size()));
+
+	negative_stripe& st(negative_stripe_of(key.hash()));
+	pthread_scoped_lock nglk(st.mutex);
+	if(m_negative_seq[key.hash() % NEGATIVE_SEQ_STRIPES] != ticket) {
+		// set while the request is in flight
+		return;
+	}
+
+	pop_negatives(st, now, limit);
+
+	st.map[nk] = expire;
+	st.queue.push_back(negative_queue_t::value_type(expire, nk));
+}
+
+bool mod_cache_t::get_negative(const msgtype::DBKey& key)
+{
+	if(!m_negative_ttl_usec) { return false; }
+
+	negative_stripe& st(negative_stripe_of(key.hash()));
+	pthread_scoped_lock nglk(st.mutex);
+	negatives_t::iterator it(st.map.find(negative_key(key.hash(),
+					std::string(key.data(), key.size()))));
+	if(it == st.map.end()) {
+		return false;
+	}
+	if(it->second <= now_usec()) {
+		st.map.erase(it);
+		return false;
+	}
+	return true;
+}
+
+void mod_cache_t::invalidate_negative(uint64_t hash)
+{
+	if(!m_negative_ttl_usec) { return; }
+
+	negative_stripe& st(negative_stripe_of(hash));
+	pthread_scoped_lock nglk(st.mutex);
+	++m_negative_seq[hash % NEGATIVE_SEQ_STRIPES];
+	negatives_t::iterator it(st.map.lower_bound(
+				negative_key(hash, std::string())));
+	while(it != st.map.end() && it->first.first == hash) {
+		st.map.erase(it++);
+	}
+}
+
+void mod_cache_t::invalidate_all_negatives()
+{
+	if(!m_negative_ttl_usec) { return; }
+
+	for(unsigned int s=0; s < NEGATIVE_STRIPES; ++s) {
+		negative_stripe& st(m_negative_stripes[s]);
+		pthread_scoped_lock nglk(st.mutex);
+		for(unsigned int i=s; i < NEGATIVE_SEQ_STRIPES; i += NEGATIVE_STRIPES) {
+			++m_negative_seq[i];
+		}
+		st.map.clear();
+		st.queue.clear();
+	}
+}
+
+void mod_cache_t::expire_negatives()
+{
+	if(!m_negative_ttl_usec) { return; }
+
+	uint64_t now = now_usec();
+	for(unsigned int s=0; s < NEGATIVE_STRIPES; ++s) {
+		negative_stripe& st(m_negative_stripes[s]);
+		pthread_scoped_lock nglk(st.mutex);
+		pop_negatives(st, now, (size_t)-1);
+	}
+}
+
+
 }  // namespace gateway
 }  // namespace kumo
 
@@ -21,6 +21,11 @@
 #include <tcutil.h>
 #include <tcadb.h>
 #include "logic/msgtype.h"
+#include "gateway/local_cache.h"
+#include <mp/pthread.h>
+#include <map>
+#include <deque>
+#include <string>
 
 namespace kumo {
 namespace gateway {
@@ -33,29 +38,142 @@ public:
 
 public:
 	void init(const char* name);
+	void init_memory(size_t budget_bytes);
+
+	bool is_enabled() const { return m_db || m_mem; }
 
 public:
 	bool get(const msgtype::DBKey& key, msgtype::DBValue* result_val,
 			msgpack::zone* z)
 	{
-		if(!m_db) { return false; }
-		return get_real(key, result_val, z);
+		if(m_mem) {
+			if(!m_mem->get(key, result_val, z)) { return false; }
+		} else {
+			if(!m_db || !get_real(key, result_val, z)) { return false; }
+		}
+		return !is_flushed(*result_val);
 	}
 
 	void update(const msgtype::DBKey& key, const msgtype::DBValue& val)
 	{
+		if(is_flushed(val)) { return; }
+		if(m_mem) { return m_mem->update(key, val); }
 		if(!m_db) { return; }
 		return update_real(key, val);
 	}
 
+	void remove(const msgtype::DBKey& key)
+	{
+		if(m_mem) { return m_mem->remove(key); }
+		if(!m_db) { return; }
+		tcadbout(m_db, key.data(), key.size());
+	}
+
+	// writes the statistics of the memory cache to the log
+	void log_stats();
+
+	// drops all cached values if the flush clocktime is newer than
+	// the current one. values stored before it are never cached again.
+	void flush(ClockTime flush_clocktime);
+
+public:
+	// leases granted by the servers.
+	// cached values are used without asking the servers while
+	// their leases are valid.
+	struct lease_ticket {
+		uint64_t sent_usec;
+		uint32_t seq;
+	};
+
+	// called before sending GetLease
+	void issue_lease_ticket(uint64_t hash, lease_ticket* result);
+
+	// returns false if the ticket is invalidated after it is issued
+	bool set_lease(const msgtype::DBKey& key,
+			const lease_ticket& ticket, uint32_t lease_msec);
+
+	bool get_leased(const msgtype::DBKey& key, msgtype::DBValue* result_val,
+			msgpack::zone* z);
+
+	void invalidate_lease(uint64_t hash);
+	void invalidate_all_leases();
+	void expire_leases();
+
+public:
+	// keys known to be missing.
+	// they are answered without asking the servers till the ttl expires.
+	void init_negative(unsigned int ttl_msec, size_t limit);
+
+	// called before sending Get
+	uint32_t negative_ticket(uint64_t hash);
+
+	// ignored if the ticket is invalidated after it is issued
+	void set_negative(const msgtype::DBKey& key, uint32_t ticket);
+
+	bool get_negative(const msgtype::DBKey& key);
+
+	void invalidate_negative(uint64_t hash);
+	void invalidate_all_negatives();
+	void expire_negatives();
+
 private:
 	bool get_real(const msgtype::DBKey& key, msgtype::DBValue* result_val,
 			msgpack::zone* z);
 
 	void update_real(const msgtype::DBKey& key, const msgtype::DBValue& val);
 
+	bool is_flushed(const msgtype::DBValue& val) const
+	{
+		return m_flush_clocktime != 0 &&
+			val.clocktime() < ClockTime(m_flush_clocktime);
+	}
+
+	volatile uint64_t m_flush_clocktime;
+
+private:
+	// incremented when the leases of the hash are invalidated
+	static const unsigned int LEASE_SEQ_STRIPES = 1024;
+	uint32_t m_lease_seq[LEASE_SEQ_STRIPES];
+
+	mp::pthread_mutex m_leases_mutex;
+	typedef std::map<std::pair<uint64_t, std::string>, uint64_t> leases_t;
+	leases_t m_leases;  // expire time in usec
+
+private:
+	// incremented when the negatives of the hash are invalidated.
+	// guarded by the mutex of the stripe of the hash.
+	static const unsigned int NEGATIVE_SEQ_STRIPES = 1024;
+	uint32_t m_negative_seq[NEGATIVE_SEQ_STRIPES];
+
+	uint64_t m_negative_ttl_usec;  // 0: disabled
+	size_t m_negative_limit;
+
+	typedef std::pair<uint64_t, std::string> negative_key;
+	typedef std::map<negative_key, uint64_t> negatives_t;  // expire time in usec
+	typedef std::deque<std::pair<uint64_t, negative_key> > negative_queue_t;
+
+	// the ttl is constant, so that the order of insertion is
+	// the order of expiration. the oldest ones are dropped from
+	// the front of the queue. entries of the queue whose expire
+	// time doesn't match the map are already erased or renewed.
+	struct negative_stripe {
+		mp::pthread_mutex mutex;
+		negatives_t map;
+		negative_queue_t queue;
+	};
+
+	// NEGATIVE_SEQ_STRIPES must be a multiple of it
+	static const unsigned int NEGATIVE_STRIPES = 16;
+	negative_stripe m_negative_stripes[NEGATIVE_STRIPES];
+
+	negative_stripe& negative_stripe_of(uint64_t hash)
+		{ return m_negative_stripes[hash % NEGATIVE_STRIPES]; }
+
+	void pop_negatives(negative_stripe& st, uint64_t now, size_t limit);
+
 public:
 	TCADB* m_db;
+	local_cache* m_mem;
 };
 
 
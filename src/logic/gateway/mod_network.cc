@@ -18,17 +18,50 @@
 #include "gateway/framework.h"
 #include "gateway/mod_network.h"
 #include "manager/mod_network.h"
+#include <sys/time.h>
 
 namespace kumo {
 namespace gateway {
 
 
+mod_network_t::mod_network_t() :
+	m_last_renew_usec(0) { }
+
+mod_network_t::~mod_network_t() { }
+
+
+namespace {
+	// servers of the leases may be changed with the hash space
+	struct scoped_lease_guard {
+		scoped_lease_guard(REQUIRE_HSLK_WRLOCK) : m_hslk(hslk)
+		{
+			share->hash_space_clocktime(&m_wtime, &m_rtime, m_hslk);
+		}
+
+		~scoped_lease_guard()
+		{
+			ClockTime wtime;
+			ClockTime rtime;
+			share->hash_space_clocktime(&wtime, &rtime, m_hslk);
+			if(wtime.get() != m_wtime.get() || rtime.get() != m_rtime.get()) {
+				net->mod_cache.invalidate_all_leases();
+			}
+		}
+
+	private:
+		const pthread_scoped_wrlock& m_hslk;
+		ClockTime m_wtime;
+		ClockTime m_rtime;
+	};
+}  // noname namespace
+
 RPC_IMPL(mod_network_t, HashSpacePush, req, z, response)
 {
 	LOG_DEBUG("HashSpacePush");
 
 	{
 		pthread_scoped_wrlock hslk(share->hs_rwlock());
+		scoped_lease_guard lsg(hslk);
 		share->update_whs(req.param().wseed, hslk);
 		share->update_rhs(req.param().rseed, hslk);
 	}
@@ -36,13 +69,70 @@ RPC_IMPL(mod_network_t, HashSpacePush, req, z, response)
 	response.result(true);
 }
 
+RPC_IMPL(mod_network_t, HashSpaceDeltaPush, req, z, response)
+{
+	LOG_DEBUG("HashSpaceDeltaPush");
+
+	bool known;
+	{
+		pthread_scoped_wrlock hslk(share->hs_rwlock());
+		scoped_lease_guard lsg(hslk);
+		known = share->update_whs(req.param().wdelta, hslk);
+		known = share->update_rhs(req.param().rdelta, hslk) && known;
+	}
+
+	net->mod_cache.flush(ClockTime(req.param().flush_clocktime));
+
+	// the manager sends whole hash space if the result is false
+	response.result(known);
+}
+
+RPC_IMPL(mod_network_t, LeaseInvalidate, req, z, response)
+{
+	LOG_TRACE("LeaseInvalidate ",req.param().hash);
+	net->mod_cache.invalidate_lease(req.param().hash);
+	net->mod_cache.invalidate_negative(req.param().hash);
+	response.result(true);
+}
+
+
+namespace {
+	// at most one renewal in this interval prevents request storms against
+	// the managers when many requests fail at once
+	static const uint64_t RENEW_INTERVAL_USEC = 500 * 1000;
+
+	uint64_t now_usec()
+	{
+		struct timeval v;
+		gettimeofday(&v, NULL);
+		return (uint64_t)v.tv_sec * 1000 * 1000 + v.tv_usec;
+	}
+
+	manager::mod_network_t::HashSpaceSubscribe subscribe_param()
+	{
+		ClockTime wtime;
+		ClockTime rtime;
+		{
+			pthread_scoped_rdlock hslk(share->hs_rwlock());
+			share->hash_space_clocktime(&wtime, &rtime, hslk);
+		}
+		return manager::mod_network_t::HashSpaceSubscribe(wtime, rtime);
+	}
+}  // noname namespace
 
 void mod_network_t::renew_hash_space()
 {
+	uint64_t now = now_usec();
+	uint64_t last = m_last_renew_usec;
+	if(now < last + RENEW_INTERVAL_USEC ||
+			!__sync_bool_compare_and_swap(&m_last_renew_usec, last, now)) {
+		return;
+	}
+
 	shared_zone nullz;
-	manager::mod_network_t::HashSpaceRequest param;
+	manager::mod_network_t::HashSpaceSubscribe param(subscribe_param());
 
-	rpc::callback_t callback( BIND_RESPONSE(mod_network_t, HashSpaceRequest) );
+	rpc::callback_t callback( BIND_RESPONSE(mod_network_t, HashSpaceSubscribe) );
 
 	net->get_session(share->manager1())->call(
 			param, nullz, callback, 10);
@@ -57,21 +147,21 @@ void mod_network_t::renew_hash_space_for(const address& addr)
 {
 	shared_session ns(net->get_session(addr));
 	shared_zone nullz;
-	manager::mod_network_t::HashSpaceRequest param;
+	manager::mod_network_t::HashSpaceSubscribe param(subscribe_param());
 	ns->call(param, nullz,
-			BIND_RESPONSE(mod_network_t, HashSpaceRequest), 10);
+			BIND_RESPONSE(mod_network_t, HashSpaceSubscribe), 10);
 }
 
 void mod_network_t::keep_alive()
 {
 	shared_zone nullz;
-	manager::mod_network_t::HashSpaceRequest param;
+	manager::mod_network_t::HashSpaceSubscribe param(subscribe_param());
 	shared_session ns;
 
 	ns = net->get_session(share->manager1());
 	if(!ns->is_bound()) {  // FIXME
 		ns->call(param, nullz,
-				BIND_RESPONSE(mod_network_t, HashSpaceRequest), 10);
+				BIND_RESPONSE(mod_network_t, HashSpaceSubscribe), 10);
 	}
 
 	if(!share->manager2().connectable()) { return; }
@@ -79,29 +169,33 @@ void mod_network_t::keep_alive()
 	ns = net->get_session(share->manager2());
 	if(!ns->is_bound()) {  // FIXME
 		ns->call(param, nullz,
-				BIND_RESPONSE(mod_network_t, HashSpaceRequest), 10);
+				BIND_RESPONSE(mod_network_t, HashSpaceSubscribe), 10);
 	}
 }
 
 
-RPC_REPLY_IMPL(mod_network_t, HashSpaceRequest, from, res, err, z)
+RPC_REPLY_IMPL(mod_network_t, HashSpaceSubscribe, from, res, err, z)
 {
 	if(!err.is_nil()) {
-		LOG_ERROR("HashSpaceRequest failed ",err);
+		LOG_ERROR("HashSpaceSubscribe failed ",err);
 		if(SESSION_IS_ACTIVE(from)) {
 			shared_zone nullz;
-			manager::mod_network_t::HashSpaceRequest param;
+			manager::mod_network_t::HashSpaceSubscribe param(subscribe_param());
 
 			from->call(param, nullz,
-					BIND_RESPONSE(mod_network_t, HashSpaceRequest), 10);
+					BIND_RESPONSE(mod_network_t, HashSpaceSubscribe), 10);
 		}  // retry on Gateway::session_lost() if the node is lost
 	} else {
-		gateway::mod_network_t::HashSpacePush st(res.convert());
+		gateway::mod_network_t::HashSpaceDeltaPush st(res.convert());
 		{
 			pthread_scoped_wrlock hslk(share->hs_rwlock());
-			share->update_whs(st.wseed, hslk);
-			share->update_rhs(st.rseed, hslk);
+			scoped_lease_guard lsg(hslk);
+			// base may be changed by HashSpaceDeltaPush received meanwhile;
+			// it is up to date in that case.
+			share->update_whs(st.wdelta, hslk);
+			share->update_rhs(st.rdelta, hslk);
 		}
+		net->mod_cache.flush(ClockTime(st.flush_clocktime));
 	}
 }
 
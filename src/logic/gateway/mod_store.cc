@@ -16,13 +16,20 @@
 //    limitations under the License.
 //
 #include "gateway/framework.h"
+#include "manager/mod_network.h"
 #include <assert.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <map>
 
 namespace kumo {
 namespace gateway {
 
 
-mod_store_t::mod_store_t() { }
+mod_store_t::mod_store_t() :
+	m_hedge_delay_usec(0),
+	m_batch_last_usec(0),
+	m_batch_gap_usec(0) { }
 
 mod_store_t::~mod_store_t() { }
 
@@ -30,54 +37,479 @@ mod_store_t::~mod_store_t() { }
 template <resource::hash_space_type Hs>
 framework::shared_session resource::server_for(uint64_t h, unsigned int offset)
 {
-#if NUM_REPLICATION != 2
-#error fix following code
-#endif
-	assert(offset == 0 || offset == 1 || offset == 2);
+	return net->get_session(server_addr_for<Hs>(h, offset));
+}
 
+template <resource::hash_space_type Hs>
+address resource::server_addr_for(uint64_t h, unsigned int offset)
+{
 	pthread_scoped_rdlock hslk(m_hs_rwlock);
 
-	if((Hs == HS_WRITE ? m_whs : m_rhs).empty()) {
+	HashSpace& hs(Hs == HS_WRITE ? m_whs : m_rhs);
+	if(hs.empty()) {
 		share->incr_error_renew_count();
 		throw std::runtime_error("No server");
 	}
-	HashSpace::iterator it = (Hs == HS_WRITE ? m_whs : m_rhs).find(h);
 
+	HashSpace::node assigned[MAX_REPLICATION_FACTOR];
+	unsigned int num = hs.assigned_nodes(h, assigned);
+
+	// offset-th node or the first active node following it
+	unsigned int x = offset % num;
+	for(unsigned int i=0; i < num; ++i) {
+		if(assigned[(offset + i) % num].is_active()) {
+			x = (offset + i) % num;
+			break;
+		}
+	}
+
+	return assigned[x].addr();
+}
+
+bool resource::server_queue_full(const shared_session& s)
+{
+	return m_cfg_server_queue_limit &&
+		s->queue_depth() >= m_cfg_server_queue_limit;
+}
+
+unsigned int resource::read_replication_factor()
+{
+	pthread_scoped_rdlock hslk(m_hs_rwlock);
+	return m_rhs.replication_factor();
+}
+
+namespace {
+static uint64_t now_usec()
+{
+	struct timeval v;
+	gettimeofday(&v, NULL);
+	return (uint64_t)v.tv_sec * 1000 * 1000 + v.tv_usec;
+}
+
+// latency sample charged to a server that returned an error
+static const uint64_t READ_ERROR_PENALTY_USEC = 1000 * 1000;
+
+static unsigned int active_replicas_of(const HashSpace& hs, uint64_t h,
+		address* result, unsigned int* offsets)
+{
+	HashSpace::node assigned[MAX_REPLICATION_FACTOR];
+	unsigned int nassigned = hs.assigned_nodes(h, assigned);
+	unsigned int nactive = 0;
+
+	for(unsigned int i=0; i < nassigned; ++i) {
+		if(assigned[i].is_active()) {
+			result[nactive] = assigned[i].addr();
+			offsets[nactive] = i;
+			++nactive;
+		}
+	}
+
+	return nactive;
+}
+}  // noname namespace
+
+read_stat* resource::read_stat_of(const address& addr)
+{
+	pthread_scoped_lock stlk(m_read_stats_mutex);
+	return &m_read_stats[addr];
+}
+
+framework::shared_session resource::read_server_for(uint64_t h, read_route* route)
+{
+	read_leg& leg(route->primary);
+	leg.start_usec = now_usec();
+
+	if(!m_cfg_read_balance) {
+		route->offset = 0;
+		shared_session s(server_for<HS_READ>(h));
+		leg.session = s.get();
+		return s;
+	}
+
+	address replicas[MAX_REPLICATION_FACTOR];
+	unsigned int offsets[MAX_REPLICATION_FACTOR];
+	unsigned int num;
 	{
-		if(offset == 0) {
-			if(it->is_active()) { goto node_found; }
-		} else { --offset; }
-	
-		HashSpace::iterator origin(it);
-		++it;
-		for(; it != origin; ++it) {
-			if(*it == *origin) { continue; }
-	
-			if(offset == 0) {
-				if(it->is_active()) { goto node_found; }
-			} else { --offset; }
-	
-			HashSpace::node rep1 = *it;
+		pthread_scoped_rdlock hslk(m_hs_rwlock);
+		if(m_rhs.empty()) {
+			hslk.unlock();
+			share->incr_error_renew_count();
+			throw std::runtime_error("No server");
+		}
+		num = active_replicas_of(m_rhs, h, replicas, offsets);
+	}
+
+	if(num == 0) {
+		route->offset = 0;
+		shared_session s(server_for<HS_READ>(h));
+		leg.session = s.get();
+		return s;
+	}
+
+	// power of two choices: compare two of the replicas and
+	// choose the one which has smaller expected latency
+	unsigned int x = 0;
+	read_stat* stat = read_stat_of(replicas[0]);
+	if(num > 1) {
+		unsigned int rr = __sync_fetch_and_add(&m_read_rr, 1);
+		unsigned int a = rr % num;
+		unsigned int b = (a + 1 + (rr / num) % (num - 1)) % num;
+		read_stat* sa = read_stat_of(replicas[a]);
+		read_stat* sb = read_stat_of(replicas[b]);
+		if((sa->ewma_usec+1) * (sa->outstanding+1) <=
+				(sb->ewma_usec+1) * (sb->outstanding+1)) {
+			x = a;  stat = sa;
+		} else {
+			x = b;  stat = sb;
+		}
+	}
+
+	shared_session s(net->get_session(replicas[x]));
+	__sync_add_and_fetch(&stat->outstanding, 1);
+	leg.stat = stat;
+	leg.session = s.get();
+	route->offset = offsets[x];
+
+	return s;
+}
+
+// the hedged request goes to the replica next to the first server.
+// returns null if the replica is the first server itself.
+framework::shared_session resource::read_hedge_server_for(uint64_t h, read_route* route)
+{
+	unsigned int offset = (route->offset + 1) % read_replication_factor();
+	address addr(server_addr_for<HS_READ>(h, offset));
+	shared_session s(net->get_session(addr));
+	if(s.get() == route->primary.session) {
+		return shared_session();
+	}
+
+	read_leg& leg(route->hedge);
+	leg.start_usec = now_usec();
+	leg.session = s.get();
+	if(m_cfg_read_balance) {
+		read_stat* stat = read_stat_of(addr);
+		__sync_add_and_fetch(&stat->outstanding, 1);
+		leg.stat = stat;
+	}
+
+	return s;
+}
+
+void resource::read_route_cancel(read_route* route)
+{
+	read_stat* stat = route->primary.stat;
+	if(!stat) { return; }
+	route->primary.stat = NULL;
+	__sync_sub_and_fetch(&stat->outstanding, 1);
+}
+
+namespace {
+	// takes the stat of the leg answered by the session
+	read_stat* take_leg_stat(read_leg& leg, const rpc::basic_session* from)
+	{
+		read_stat* stat = leg.stat;
+		if(leg.session != from || !stat ||
+				!__sync_bool_compare_and_swap(&leg.stat, stat, (read_stat*)NULL)) {
+			return NULL;
+		}
+		return stat;
+	}
+}  // noname namespace
+
+// charges the server answered for its own request.
+// returns the response time of the request, 0 if the request is unknown.
+uint64_t resource::read_route_end(read_route* route,
+		const rpc::basic_session* from, bool success)
+{
+	read_leg* leg = NULL;
+	read_stat* stat = NULL;
+	if((stat = take_leg_stat(route->primary, from)) != NULL) {
+		leg = &route->primary;
+	} else if((stat = take_leg_stat(route->hedge, from)) != NULL) {
+		leg = &route->hedge;
+	} else if(route->primary.session == from) {
+		leg = &route->primary;  // not charged
+	} else if(route->hedge.session == from) {
+		leg = &route->hedge;  // not charged
+	} else {
+		return 0;  // fallback to another server
+	}
+
+	uint64_t elapsed = now_usec() - leg->start_usec;
+	if(!stat) { return elapsed; }
+
+	uint64_t sample;
+	if(success) {
+		sample = elapsed;
+	} else {
+		sample = READ_ERROR_PENALTY_USEC;
+	}
+
+	// EWMA with alpha = 1/8
+	uint64_t ewma = stat->ewma_usec;
+	if(ewma == 0) {
+		stat->ewma_usec = sample;
+	} else {
+		stat->ewma_usec = ewma - (ewma >> 3) + (sample >> 3);
+	}
+
+	__sync_sub_and_fetch(&stat->outstanding, 1);
+	return elapsed;
+}
+
+
+latency_histogram::latency_histogram() :
+	m_total(0)
+{
+	for(unsigned int i=0; i < BUCKETS; ++i) { m_count[i] = 0; }
+}
+
+latency_histogram::~latency_histogram() { }
+
+void latency_histogram::add(uint64_t usec)
+{
+	unsigned int i = 0;
+	while(usec > 1 && i < BUCKETS-1) {
+		usec >>= 1;
+		++i;
+	}
+	__sync_add_and_fetch(&m_count[i], 1);
+	__sync_add_and_fetch(&m_total, 1);
+}
+
+uint64_t latency_histogram::percentile(unsigned int p) const
+{
+	uint64_t total = m_total;
+	if(total == 0) { return 0; }
+	uint64_t required = total * p / 100;
+	uint64_t sum = 0;
+	for(unsigned int i=0; i < BUCKETS; ++i) {
+		sum += m_count[i];
+		if(sum >= required) {
+			return ((uint64_t)1) << (i+1);  // upper bound of the bucket
+		}
+	}
+	return ((uint64_t)1) << BUCKETS;
+}
+
+void latency_histogram::decay()
+{
+	// halve the counts to forget old samples.
+	// Note: not exact if add() runs concurrently
+	uint32_t total = 0;
+	for(unsigned int i=0; i < BUCKETS; ++i) {
+		m_count[i] = m_count[i] / 2;
+		total += m_count[i];
+	}
+	m_total = total;
+}
+
+
+// precision of the hedge timer
+static const unsigned long HEDGE_TIMER_PRECISION_USEC = 1000;  // 1 msec.
+
+// minimum delay to send a hedged request
+static const uint64_t HEDGE_MIN_DELAY_USEC = 2 * HEDGE_TIMER_PRECISION_USEC;
+
+// number of samples kept by the latency histogram
+static const uint32_t HEDGE_LATENCY_WINDOW = 64 * 1024;
+
+void mod_store_t::start_hedge_timer()
+{
+	struct timespec ts = {HEDGE_TIMER_PRECISION_USEC / 1000000,
+		HEDGE_TIMER_PRECISION_USEC % 1000000 * 1000};
+	wavy::timer(&ts, mp::bind(&mod_store_t::step_hedge, this));
+	LOG_TRACE("start hedge timer percentile = ",share->cfg_hedge_percentile());
+}
+
+void mod_store_t::step_hedge()
+{
+	if(m_latency.total() > HEDGE_LATENCY_WINDOW) {
+		m_latency.decay();
+	}
+	uint64_t delay = m_latency.percentile(share->cfg_hedge_percentile());
+	if(delay != 0) {
+		m_hedge_delay_usec = std::max(delay, HEDGE_MIN_DELAY_USEC);
+	}
+
+	uint64_t now = now_usec();
+	std::vector<mp::function<void ()> > fire;
+
+	{
+		pthread_scoped_lock hglk(m_hedge_mutex);
+		hedge_queue_t::iterator it(m_hedge_queue.begin());
+		for(; it != m_hedge_queue.end() && it->first <= now; ++it) {
+			fire.push_back(it->second);
+		}
+		m_hedge_queue.erase(m_hedge_queue.begin(), it);
+	}
+
+	for(std::vector<mp::function<void ()> >::iterator it(fire.begin());
+			it != fire.end(); ++it) {
+		try {
+			(*it)();
+		} catch (std::exception& e) {
+			LOG_WARN("hedged Get failed: ",e.what());
+		} catch (...) {
+			LOG_WARN("hedged Get failed: unknown error");
+		}
+	}
+}
+
+void mod_store_t::schedule_hedge(mp::function<void ()> fire)
+{
+	uint64_t delay = m_hedge_delay_usec;
+	if(delay == 0) { return; }  // no samples yet
+
+	pthread_scoped_lock hglk(m_hedge_mutex);
+	m_hedge_queue.insert( hedge_queue_t::value_type(now_usec() + delay, fire) );
+}
+
+// interval of requests regarded as idle
+static const uint64_t BATCH_IDLE_GAP_USEC = 1000 * 1000;  // 1 sec.
+
+void mod_store_t::start_batch_timer()
+{
+	unsigned long usec = share->cfg_batch_window_usec();
+	struct timespec ts = {usec / 1000000, usec % 1000000 * 1000};
+	wavy::timer(&ts, mp::bind(&mod_store_t::step_batch, this));
+	LOG_TRACE("start batch timer window = ",usec);
+}
+
+void mod_store_t::step_batch()
+{
+	uint64_t now = now_usec();
+
+	// batches are sent with holding the lock not to overtake
+	// the requests sent without batching
+	pthread_scoped_lock balk(m_batch_mutex);
+	for(batches_t::iterator it(m_batches.begin()); it != m_batches.end(); ) {
+		if(it->second.deadline_usec <= now) {
+			send_batch(it->second);
+			m_batches.erase(it++);
+		} else {
 			++it;
-			for(; it != origin; ++it) {
-				if(*it == *origin || *it == rep1) { continue; }
-				HashSpace::node _rep2_ = *it;
-	
-				if(offset == 0) {
-					if(it->is_active()) { goto node_found; }
-				} else { --offset; }
-	
-				break;
-			}
-			break;
 		}
 	}
+}
+
+uint64_t mod_store_t::batch_window(uint64_t now)
+{
+	uint64_t max = share->cfg_batch_window_usec();
+
+	uint64_t last = m_batch_last_usec;
+	m_batch_last_usec = now;
+	uint64_t sample = (last == 0 || now < last) ? BATCH_IDLE_GAP_USEC :
+		std::min(now - last, BATCH_IDLE_GAP_USEC);
+
+	// EWMA with alpha = 1/8
+	uint64_t gap = m_batch_gap_usec;
+	gap = gap - (gap >> 3) + (sample >> 3);
+	m_batch_gap_usec = gap;
+
+	// low load: the next request won't come in the window.
+	// high load: wait till the batch is expected to be filled.
+	if(gap >= max) { return 0; }
+	return std::min(max, gap * (share->cfg_batch_size() - 1));
+}
+
+template <typename Parameter>
+void mod_store_t::batch_call(rpc::retry<Parameter>* retry,
+		shared_session s, shared_zone& life)
+{
+	if(!share->cfg_batch_window_usec()) {
+		retry->call(s, life, 10);
+		return;
+	}
+
+	uint64_t now = now_usec();
+	uint64_t window = batch_window(now);
+
+	pthread_scoped_lock balk(m_batch_mutex);
+	batches_t::iterator it(m_batches.find(s.get()));
+	if(it == m_batches.end()) {
+		if(window == 0) {
+			balk.unlock();
+			retry->call(s, life, 10);
+			return;
+		}
+		it = m_batches.insert(
+				batches_t::value_type(s.get(), request_batch())).first;
+		it->second.session = s;
+		it->second.buffer = rpc::vrefbuffer_pool::get();
+		it->second.deadline_usec = now + window;
+	}
+
+	request_batch& b(it->second);
+	retry->call_batch(s, *b.buffer, life, 10);
+
+	if(++b.num >= share->cfg_batch_size() || b.deadline_usec <= now) {
+		send_batch(b);
+		m_batches.erase(it);
+	}
+}
+
+void mod_store_t::send_batch(request_batch& b)
+try {
+	LOG_TRACE("send batch of ",b.num," requests");
+	std::auto_ptr<rpc::vrefbuffer> buffer(b.buffer);
+	b.buffer = NULL;
+	b.session->send_batch(buffer);
+} catch (std::exception& e) {
+	LOG_WARN("batch send failed: ",e.what());
+} catch (...) {
+	LOG_WARN("batch send failed: unknown error");
+}
+
+bool mod_store_t::read_response(read_route* route,
+		const rpc::basic_session* from, bool success)
+{
+	uint64_t elapsed = share->read_route_end(route, from, success);
+
+	if(route->done) {
+		return false;  // the other request already won
+	}
+
+	if(success) {
+		if(!__sync_bool_compare_and_swap(&route->done, 0, 1)) {
+			return false;
+		}
+		if(share->cfg_hedge_percentile() && elapsed != 0) {
+			m_latency.add(elapsed);
+		}
+		return true;
+
+	} else {
+		// wait for the response of the other request
+		return __sync_sub_and_fetch(&route->inflight, 1) == 0;
+	}
+}
+
+namespace {
+template <typename Parameter>
+void read_call(rpc::retry<Parameter>* retry, read_route* route,
+		shared_session s, shared_zone& life)
+{
+	__sync_add_and_fetch(&route->inflight, 1);
+	net->mod_store.batch_call(retry, s, life);
+}
+
+template <typename Parameter>
+void hedge_fire(rpc::retry<Parameter>* retry, read_route* route,
+		uint64_t for_hash, shared_zone life)
+{
+	// answered already or waiting for retry_after
+	if(route->done || route->inflight == 0) { return; }
 
-node_found:
-	address addr = it->addr();
-	hslk.unlock();
-	return net->get_session(addr);
+	shared_session s(share->read_hedge_server_for(for_hash, route));
+	if(!s) { return; }  // no other replica
+
+	LOG_DEBUG("hedged Get to the next replica of offset +",route->offset," node");
+	read_call(retry, route, s, life);
 }
+}  // noname namespace
+
 
 template <typename ReqType>
 static msgtype::DBKey dbkey_with_prefix(const ReqType& req, shared_zone& life) {
@@ -158,45 +590,381 @@ catch (std::exception& e) { \
 void mod_store_t::Get(gate::req_get& req)
 try {
 	shared_zone life(req.life);
-	if(!life) { life.reset(new msgpack::zone()); }
+	if(!life) { life = rpc::new_shared_zone(); }
 
 	msgtype::DBKey key = dbkey_with_prefix(req, life);
+	submit_get(key, deadline_after(req.budget_msec),
+			req.callback, req.user, life);
+}
+SUBMIT_CATCH(_get);
+
+
+bool mod_store_t::join_flight(const msgtype::DBKey& key,
+		gate::callback_get* callback, void** user, shared_zone& life)
+{
+	std::pair<uint64_t, std::string> k(key.hash(),
+			std::string(key.data(), key.size()));
+
+	pthread_scoped_lock fllk(m_flights_mutex);
+	flights_t::iterator it(m_flights.find(k));
+	if(it != m_flights.end()) {
+		get_waiter w;
+		w.callback = *callback;
+		w.user     = *user;
+		w.life     = life;
+		it->second->waiters.push_back(w);
+		return true;
+	}
+
+	get_flight* f = life->allocate<get_flight>();
+	f->callback = *callback;
+	f->user     = *user;
+	f->hash     = k.first;
+	f->key      = k.second;
+	m_flights.insert(flights_t::value_type(k, f));
+	fllk.unlock();
+
+	*callback = &mod_store_t::flight_landed;
+	*user     = reinterpret_cast<void*>(f);
+	return false;
+}
+
+void mod_store_t::leave_flight(get_flight* f, std::vector<get_waiter>* waiters)
+{
+	pthread_scoped_lock fllk(m_flights_mutex);
+	flights_t::iterator it(m_flights.find(
+				std::pair<uint64_t, std::string>(f->hash, f->key)));
+	if(it != m_flights.end() && it->second == f) {
+		m_flights.erase(it);
+	}
+	waiters->swap(f->waiters);
+}
+
+void mod_store_t::detach_flight(const msgtype::DBKey& key)
+{
+	if(share->cfg_no_coalesce()) { return; }
+
+	pthread_scoped_lock fllk(m_flights_mutex);
+	if(m_flights.empty()) { return; }
+	m_flights.erase(std::pair<uint64_t, std::string>(
+				key.hash(), std::string(key.data(), key.size())));
+}
+
+void mod_store_t::flight_landed(void* user, gate::res_get& res, auto_zone z)
+{
+	get_flight* f = reinterpret_cast<get_flight*>(user);
+
+	std::vector<get_waiter> waiters;
+	net->mod_store.leave_flight(f, &waiters);
+
+	// f is allocated in the life zone that z refers
+	SHARED_ZONE(life, z);
+
+	{
+		auto_zone kz(new msgpack::zone());
+		kz->allocate<shared_zone>(life);
+		try { (*f->callback)(f->user, res, kz); } catch (...) { }
+	}
+
+	if(!waiters.empty()) {
+		LOG_TRACE("Get shared with ",waiters.size()," requests");
+	}
+	for(std::vector<get_waiter>::iterator it(waiters.begin());
+			it != waiters.end(); ++it) {
+		gate::res_get r(res);
+		auto_zone kz(new msgpack::zone());
+		kz->allocate<shared_zone>(life);
+		kz->allocate<shared_zone>(it->life);
+		try { (*it->callback)(it->user, r, kz); } catch (...) { }
+	}
+}
+
+void mod_store_t::submit_get(const msgtype::DBKey& key, uint64_t deadline,
+		gate::callback_get callback, void* user, shared_zone& life)
+{
+	if(share->cfg_lease()) {
+		msgtype::DBValue leased;
+		if(net->mod_cache.get_leased(key, &leased, life.get())) {
+			gate::res_get res;
+			res.error     = 0;
+			dbkey_remove_prefix(&res, key);
+			res.hash      = key.hash();
+			res.val       = (char*)leased.data();
+			res.vallen    = leased.size();
+			res.clocktime = leased.clocktime().get();
+			wavy::submit(submit_callback_trampoline<gate::callback_get, gate::res_get>,
+					callback, user, res, life);
+			return;
+		}
+	}
+
+	if(net->mod_cache.get_negative(key)) {
+		gate::res_get res;
+		res.error     = 0;
+		dbkey_remove_prefix(&res, key);
+		res.hash      = key.hash();
+		res.val       = NULL;
+		res.vallen    = 0;
+		res.clocktime = 0;
+		wavy::submit(submit_callback_trampoline<gate::callback_get, gate::res_get>,
+				callback, user, res, life);
+		return;
+	}
+
+	if(!share->cfg_no_coalesce() &&
+			join_flight(key, &callback, &user, life)) {
+		return;  // waiting for the response of the same key
+	}
+
+	try {
+		send_get(key, deadline, callback, user, life);
+	} catch (std::exception& e) {
+		// the Gets joined the flight get the error too
+		LOG_WARN("req_get FAILED: ",e.what());
+		gate::res_get res;
+		res.error = 1;
+		wavy::submit(submit_callback_trampoline<gate::callback_get, gate::res_get>,
+				callback, user, res, life);
+	}
+}
+
+void mod_store_t::send_get(const msgtype::DBKey& key, uint64_t deadline,
+		gate::callback_get callback, void* user, shared_zone& life)
+{
+	if(deadline_passed(deadline)) {
+		throw std::runtime_error("deadline exceeded");
+	}
+
 	msgtype::DBValue cached_val_buf;
 
-	if(net->mod_cache.get(key, &cached_val_buf, life.get())) {
+	read_route* route = life->allocate<read_route>();
+	shared_session s(share->read_server_for(key.hash(), route));
+	if(share->server_queue_full(s)) {
+		share->read_route_cancel(route);
+		throw std::runtime_error("server queue is full");
+	}
+
+	// with a single replica the hedge would go to the same server
+	bool hedge = share->cfg_hedge_percentile() &&
+		share->read_replication_factor() >= 2;
+
+	if(share->cfg_lease()) {
+		msgtype::DBValue* cached_val = NULL;
+		ClockTime if_time;
+		if(net->mod_cache.get(key, &cached_val_buf, life.get())) {
+			cached_val = life->allocate<msgtype::DBValue>(cached_val_buf);
+			if_time = cached_val_buf.clocktime();
+		}
+
+		mod_cache_t::lease_ticket* ticket =
+			life->allocate<mod_cache_t::lease_ticket>();
+		net->mod_cache.issue_lease_ticket(key.hash(), ticket);
+
+		rpc::retry<server::mod_store_t::GetLease>* retry =
+			life->allocate< rpc::retry<server::mod_store_t::GetLease> >(
+					server::mod_store_t::GetLease(key, if_time, deadline)
+					);
+
+		retry->set_callback(
+				BIND_RESPONSE(mod_store_t, GetLease, retry,
+					callback, user, cached_val, route, ticket) );
+
+		read_call(retry, route, s, life);
+
+		if(hedge) {
+			schedule_hedge(mp::bind(&hedge_fire<server::mod_store_t::GetLease>,
+						retry, route, key.hash(), life));
+		}
+
+	} else if(net->mod_cache.get(key, &cached_val_buf, life.get())) {
 		msgtype::DBValue* cached_val = life->allocate<msgtype::DBValue>(cached_val_buf);
 
 		rpc::retry<server::mod_store_t::GetIfModified>* retry =
 			life->allocate< rpc::retry<server::mod_store_t::GetIfModified> >(
-					server::mod_store_t::GetIfModified(key, cached_val_buf.clocktime())
+					server::mod_store_t::GetIfModified(key, cached_val_buf.clocktime(),
+						deadline)
 					);
 
 		retry->set_callback(
 				BIND_RESPONSE(mod_store_t, GetIfModified, retry,
-					req.callback, req.user, cached_val) );
+					callback, user, cached_val, route) );
 
-		retry->call(share->server_for<resource::HS_READ>(key.hash()), life, 10);
+		read_call(retry, route, s, life);
+
+		if(hedge) {
+			schedule_hedge(mp::bind(&hedge_fire<server::mod_store_t::GetIfModified>,
+						retry, route, key.hash(), life));
+		}
 
 	} else {
 		rpc::retry<server::mod_store_t::Get>* retry =
 			life->allocate< rpc::retry<server::mod_store_t::Get> >(
-					server::mod_store_t::Get(key)
+					server::mod_store_t::Get(key, deadline)
 					);
 
+		uint32_t negative_ticket = net->mod_cache.negative_ticket(key.hash());
+
 		retry->set_callback(
 				BIND_RESPONSE(mod_store_t, Get, retry,
-					req.callback, req.user) );
+					callback, user, route, negative_ticket) );
 
-		retry->call(share->server_for<resource::HS_READ>(key.hash()), life, 10);
+		read_call(retry, route, s, life);
+
+		if(hedge) {
+			schedule_hedge(mp::bind(&hedge_fire<server::mod_store_t::Get>,
+						retry, route, key.hash(), life));
+		}
+	}
+}
+
+
+namespace {
+	// keys of a GetMulti request sent to a server
+	struct get_multi_group {
+		std::vector<msgtype::DBKey> keys;
+		std::vector<void*> users;
+	};
+}  // noname namespace
+
+void mod_store_t::GetMulti(gate::req_get_multi& req)
+{
+	shared_zone life(req.life);
+	if(!life) { life = rpc::new_shared_zone(); }
+
+	typedef std::map<shared_session, get_multi_group> groups_t;
+	groups_t groups;
+
+	uint64_t deadline = deadline_after(req.budget_msec);
+
+	for(unsigned int i=0; i < req.num; ++i) {
+		gate::req_get kreq;
+		kreq.key    = req.keys[i];
+		kreq.keylen = req.keylens[i];
+		kreq.life   = life;
+		kreq.callback = req.callback;
+		kreq.user   = req.users[i];
+		kreq.budget_msec = req.budget_msec;
+
+		try {
+			msgtype::DBKey key = dbkey_with_prefix(kreq, life);
+
+			// cached keys are validated by GetIfModified one by one
+			msgtype::DBValue cached_val;
+			if(!net->mod_cache.get(key, &cached_val, life.get())) {
+				shared_session s(share->server_for<resource::HS_READ>(key.hash()));
+				get_multi_group& g(groups[s]);
+				g.keys.push_back(key);
+				g.users.push_back(req.users[i]);
+				continue;
+			}
+		} catch (...) {
+			// Get reports the error
+		}
+		kreq.submit();
+	}
+
+	for(groups_t::iterator it(groups.begin()), it_end(groups.end());
+			it != it_end; ++it) {
+		get_multi_group& g(it->second);
+
+		// Get reports the error of each key if the queue is full
+		if(g.keys.size() == 1 || share->server_queue_full(it->first)) {
+			for(size_t i=0; i < g.keys.size(); ++i) {
+				fallback_get(g.keys[i], deadline, req.callback, g.users[i], life);
+			}
+			continue;
+		}
+
+		void** users = (void**)life->malloc(sizeof(void*)*g.users.size());
+		std::copy(g.users.begin(), g.users.end(), users);
+
+		rpc::retry<server::mod_store_t::GetMulti>* retry =
+			life->allocate< rpc::retry<server::mod_store_t::GetMulti> >(
+					server::mod_store_t::GetMulti(g.keys, deadline)
+					);
+
+		retry->set_callback(
+				BIND_RESPONSE(mod_store_t, GetMulti, retry,
+					req.callback, users) );
+		retry->call(it->first, life, 10);
+	}
+}
+
+void mod_store_t::fallback_get(const msgtype::DBKey& key, uint64_t deadline,
+		gate::callback_get callback, void* user, shared_zone& life)
+try {
+	submit_get(key, deadline, callback, user, life);
+} catch (std::exception& e) {
+	LOG_WARN("req_get FAILED: ",e.what());
+	gate::res_get res;
+	res.error = 1;
+	wavy::submit(submit_callback_trampoline<gate::callback_get, gate::res_get>,
+			callback, user, res, life);
+}
+
+
+RPC_REPLY_IMPL(mod_store_t, GetMulti, from, res, err, z,
+		rpc::retry<server::mod_store_t::GetMulti>* retry,
+		gate::callback_get callback, void** users)
+{
+	const std::vector<msgtype::DBKey>& keys(retry->param().dbkeys);
+	LOG_TRACE("ResGetMulti ",err);
+	SHARED_ZONE(life, z);
+
+	if(!err.is_nil() || res.type != msgpack::type::ARRAY ||
+			res.via.array.size != keys.size()) {
+		// Get retries each key with the other replicas
+		LOG_DEBUG("GetMulti error: ",err,", fallback to Get");
+		share->incr_error_renew_count();
+		for(unsigned int i=0; i < keys.size(); ++i) {
+			fallback_get(keys[i], retry->param().deadline,
+					callback, users[i], life);
+		}
+		return;
+	}
+
+	for(unsigned int i=0; i < keys.size(); ++i) {
+		const msgtype::DBKey& key(keys[i]);
+		msgpack::object obj(res.via.array.ptr[i]);
+
+		if(obj.type == msgpack::type::BOOLEAN) {
+			// the key is not assigned to the server
+			fallback_get(key, retry->param().deadline,
+					callback, users[i], life);
+			continue;
+		}
+
+		gate::res_get ret;
+		ret.error     = 0;
+		dbkey_remove_prefix(&ret, key);
+		ret.hash      = key.hash();
+		ret.val       = NULL;
+		ret.vallen    = 0;
+		ret.clocktime = 0;
+		if(!obj.is_nil()) {
+			try {
+				msgtype::DBValue st = obj.as<msgtype::DBValue>();
+				ret.val       = (char*)st.data();
+				ret.vallen    = st.size();
+				ret.clocktime = st.clocktime().get();
+				net->mod_cache.update(key, st);
+			} catch (msgpack::type_error& e) {
+				LOG_ERROR("ResGetMulti FAILED: type error");
+				ret.error = 1;
+			}
+		}
+
+		auto_zone kz(new msgpack::zone());
+		kz->allocate<shared_zone>(life);
+		try { (*callback)(users[i], ret, kz); } catch (...) { }
 	}
 }
-SUBMIT_CATCH(_get);
 
 
 void mod_store_t::Set(gate::req_set& req)
 try {
 	shared_zone life(req.life);
-	if(!life) { life.reset(new msgpack::zone()); }
+	if(!life) { life = rpc::new_shared_zone(); }
 
 	server::set_op_t op;
 	uint64_t clocktime = 0;
@@ -217,21 +985,40 @@ try {
 	case gate::OP_PREPEND:
 		op = server::OP_PREPEND;
 		break;
+	case gate::OP_ADD:
+		op = server::OP_ADD;
+		break;
+	case gate::OP_REPLACE:
+		op = server::OP_REPLACE;
+		break;
 	}
 
 	msgtype::DBKey key = dbkey_with_prefix(req, life);
 
+	shared_session s(share->server_for<resource::HS_WRITE>(key.hash()));
+	if(share->server_queue_full(s)) {
+		throw std::runtime_error("server queue is full");
+	}
+
 	uint16_t meta = 0;
 	rpc::retry<server::mod_store_t::Set>* retry =
 		life->allocate< rpc::retry<server::mod_store_t::Set> >(
 				server::mod_store_t::Set(op,
 					key,
-					msgtype::DBValue(req.val, req.vallen, meta, clocktime))
+					msgtype::DBValue(req.val, req.vallen, meta, clocktime),
+					deadline_after(req.budget_msec))
 				);
 
 	retry->set_callback(
 			BIND_RESPONSE(mod_store_t, Set, retry, req.callback, req.user) );
-	retry->call(share->server_for<resource::HS_WRITE>(key.hash()), life, 10);
+	net->mod_cache.invalidate_negative(key.hash());
+	if(share->cfg_lease()) {
+		// don't read the old value till the invalidation arrives
+		net->mod_cache.invalidate_lease(key.hash());
+	}
+	// Gets after this write don't share the response of a Get before it
+	detach_flight(key);
+	batch_call(retry, s, life);
 }
 SUBMIT_CATCH(_set);
 
@@ -239,26 +1026,83 @@ SUBMIT_CATCH(_set);
 void mod_store_t::Delete(gate::req_delete& req)
 try {
 	shared_zone life(req.life);
-	if(!life) { life.reset(new msgpack::zone()); }
+	if(!life) { life = rpc::new_shared_zone(); }
 
 	msgtype::DBKey key = dbkey_with_prefix(req, life);
 
+	shared_session s(share->server_for<resource::HS_WRITE>(key.hash()));
+	if(share->server_queue_full(s)) {
+		throw std::runtime_error("server queue is full");
+	}
+
 	rpc::retry<server::mod_store_t::Delete>* retry =
 		life->allocate< rpc::retry<server::mod_store_t::Delete> >(
 				server::mod_store_t::Delete(
 					(share->cfg_async_replicate_delete() || req.async) ?
 					 static_cast<server::store_flags>(server::store_flags_async()) :
 					 static_cast<server::store_flags>(server::store_flags_none()),
-					key)
+					key, deadline_after(req.budget_msec))
 				);
 
 	retry->set_callback(
 			BIND_RESPONSE(mod_store_t, Delete, retry, req.callback, req.user) );
-	retry->call(share->server_for<resource::HS_WRITE>(key.hash()), life, 10);
+	if(share->cfg_lease()) {
+		// don't read the old value till the invalidation arrives
+		net->mod_cache.invalidate_lease(key.hash());
+	}
+	// Gets after this write don't share the response of a Get before it
+	detach_flight(key);
+	batch_call(retry, s, life);
 }
 SUBMIT_CATCH(_delete);
 
 
+void mod_store_t::Incr(gate::req_incr& req)
+try {
+	shared_zone life(req.life);
+	if(!life) { life = rpc::new_shared_zone(); }
+
+	msgtype::DBKey key = dbkey_with_prefix(req, life);
+
+	shared_session s(share->server_for<resource::HS_WRITE>(key.hash()));
+	if(share->server_queue_full(s)) {
+		throw std::runtime_error("server queue is full");
+	}
+
+	rpc::retry<server::mod_store_t::Incr>* retry =
+		life->allocate< rpc::retry<server::mod_store_t::Incr> >(
+				server::mod_store_t::Incr(
+					key, req.delta, req.decrement, req.offset,
+					msgtype::raw_ref(req.initial, req.initiallen),
+					deadline_after(req.budget_msec))
+				);
+
+	retry->set_callback(
+			BIND_RESPONSE(mod_store_t, Incr, retry, req.callback, req.user) );
+	net->mod_cache.invalidate_negative(key.hash());
+	if(share->cfg_lease()) {
+		// don't read the old value till the invalidation arrives
+		net->mod_cache.invalidate_lease(key.hash());
+	}
+	// Gets after this write don't share the response of a Get before it
+	detach_flight(key);
+	batch_call(retry, s, life);
+}
+SUBMIT_CATCH(_incr);
+
+
+void mod_store_t::FlushAll(gate::req_flush& req)
+try {
+	shared_zone life(req.life);
+	if(!life) { life = rpc::new_shared_zone(); }
+
+	manager::mod_network_t::FlushAll param;
+	net->get_session(share->manager1())->call(param, life,
+			BIND_RESPONSE(mod_store_t, FlushAll, req.callback, req.user, false), 10);
+}
+SUBMIT_CATCH(_flush);
+
+
 #define GATEWAY_CATCH(NAME, response_type) \
 catch (msgpack::type_error& e) { \
 	LOG_ERROR(#NAME " FAILED: type error"); \
@@ -283,16 +1127,25 @@ template <resource::hash_space_type Hs, typename Parameter>
 struct retry_after_callback {
 	retry_after_callback(
 			rpc::retry<Parameter>* retry, shared_zone life,
-			uint64_t for_hash, unsigned int offset = 0) :
+			uint64_t for_hash, unsigned int offset = 0,
+			read_route* route = NULL) :
 		m_for_hash(for_hash), m_offset(offset),
-		m_retry(retry), m_life(life) { }
+		m_retry(retry), m_life(life), m_route(route) { }
 
 	void operator() ()
 	{
 		// FIXME HS_WRITE?
-		m_retry->call(
-				share->server_for<Hs>(m_for_hash, m_offset),
-				m_life, 10);
+		if(m_route) {
+			read_call(m_retry, m_route,
+					m_offset == 0 ?
+					share->read_server_for(m_for_hash, m_route) :
+					share->server_for<Hs>(m_for_hash, m_offset),
+					m_life);
+		} else {
+			m_retry->call(
+					share->server_for<Hs>(m_for_hash, m_offset),
+					m_life, 10);
+		}
 	}
 
 private:
@@ -300,26 +1153,33 @@ private:
 	unsigned int m_offset;
 	rpc::retry<Parameter>* m_retry;
 	shared_zone m_life;
+	read_route* m_route;
 };
 
 template <resource::hash_space_type Hs, typename Parameter>
 void retry_after(unsigned int steps,
 		rpc::retry<Parameter>* retry, shared_zone life,
-		uint64_t for_hash, unsigned int offset = 0)
+		uint64_t for_hash, unsigned int offset = 0,
+		read_route* route = NULL)
 {
 	net->do_after(steps,
-			retry_after_callback<Hs, Parameter>(retry, life, for_hash, offset));
+			retry_after_callback<Hs, Parameter>(retry, life, for_hash, offset, route));
 }
 }  // noname namespace
 
 
 RPC_REPLY_IMPL(mod_store_t, Get, from, res, err, z,
 		rpc::retry<server::mod_store_t::Get>* retry,
-		gate::callback_get callback, void* user)
+		gate::callback_get callback, void* user,
+		read_route* route, uint32_t negative_ticket)
 try {
 	msgtype::DBKey key(retry->param().dbkey);
 	LOG_TRACE("ResGet ",err);
 
+	if(!read_response(route, from.get(), err.is_nil())) {
+		return;  // discard the response of the duplicated request
+	}
+
 	if(err.is_nil()) {
 		gate::res_get ret;
 		ret.error     = 0;
@@ -329,6 +1189,7 @@ try {
 			ret.val       = NULL;
 			ret.vallen    = 0;
 			ret.clocktime = 0;
+			net->mod_cache.set_negative(key, negative_ticket);
 		} else {
 			msgtype::DBValue st = res.as<msgtype::DBValue>();
 			ret.val       = (char*)st.data();
@@ -338,16 +1199,18 @@ try {
 		}
 		try { (*callback)(user, ret, z); } catch (...) { }
 
-	} else if( retry->retry_incr((NUM_REPLICATION+1) * share->cfg_get_retry_num() - 1) ) {
+	} else if( !deadline_passed(retry->param().deadline) &&
+			retry->retry_incr(share->read_replication_factor() * share->cfg_get_retry_num() - 1) ) {
 		share->incr_error_renew_count();
-		unsigned short offset = retry->num_retried() % (NUM_REPLICATION+1);
+		unsigned short offset = retry->num_retried() % share->read_replication_factor();
 		SHARED_ZONE(life, z);
 		if(offset == 0) {
 			// FIXME configurable steps
 			retry_after<resource::HS_READ>(1*framework::DO_AFTER_BY_SECONDS,
-					retry, life, key.hash(), offset);
+					retry, life, key.hash(), offset, route);
 		} else {
-			retry->call(share->server_for<resource::HS_READ>(key.hash(), offset), life, 10);
+			read_call(retry, route,
+					share->server_for<resource::HS_READ>(key.hash(), offset), life);
 		}
 		LOG_DEBUG("Get error: ",err,", fallback to offset +",offset," node");  // too slow to display it
 
@@ -376,12 +1239,17 @@ GATEWAY_CATCH(ResGet, gate::res_get)
 RPC_REPLY_IMPL(mod_store_t, GetIfModified, from, res, err, z,
 		rpc::retry<server::mod_store_t::GetIfModified>* retry,
 		gate::callback_get callback, void* user,
-		msgtype::DBValue* cached_val)
+		msgtype::DBValue* cached_val,
+		read_route* route)
 try {
 	// FIXME copied code
 	msgtype::DBKey key(retry->param().dbkey);
 	LOG_TRACE("ResGetIfModified ",err);
 
+	if(!read_response(route, from.get(), err.is_nil())) {
+		return;  // discard the response of the duplicated request
+	}
+
 	if(err.is_nil()) {
 		gate::res_get ret;
 		ret.error     = 0;
@@ -406,16 +1274,106 @@ try {
 		}
 		try { (*callback)(user, ret, z); } catch (...) { }
 
-	} else if( retry->retry_incr((NUM_REPLICATION+1) * share->cfg_get_retry_num() - 1) ) {
+	} else if( !deadline_passed(retry->param().deadline) &&
+			retry->retry_incr(share->read_replication_factor() * share->cfg_get_retry_num() - 1) ) {
+		share->incr_error_renew_count();
+		unsigned short offset = retry->num_retried() % share->read_replication_factor();
+		SHARED_ZONE(life, z);
+		if(offset == 0) {
+			// FIXME configurable steps
+			retry_after<resource::HS_READ>(1*framework::DO_AFTER_BY_SECONDS,
+					retry, life, key.hash(), offset, route);
+		} else {
+			read_call(retry, route,
+					share->server_for<resource::HS_READ>(key.hash(), offset), life);
+		}
+		LOG_WARN("Get error: ",err,", fallback to offset +",offset," node");
+
+	} else {
+		if(err.via.u64 == (uint64_t)rpc::protocol::TRANSPORT_LOST_ERROR ||
+				err.via.u64 == (uint64_t)rpc::protocol::SERVER_ERROR) {
+			net->mod_network.renew_hash_space();   // FIXME
+		}
+		gate::res_get ret;
+		ret.error     = 1;  // ERROR
+		dbkey_remove_prefix(&ret, key);
+		ret.hash      = key.hash();
+		ret.val       = NULL;
+		ret.vallen    = 0;
+		ret.clocktime = 0;
+		try { (*callback)(user, ret, z); } catch (...) { }
+		TLOGPACK("eg",3,
+				"key",msgtype::raw_ref(key.data(),key.size()),
+				"err",err.via.u64);
+		LOG_ERROR("Get error: ", err);
+	}
+}
+GATEWAY_CATCH(ResGet, gate::res_get)
+
+
+RPC_REPLY_IMPL(mod_store_t, GetLease, from, res, err, z,
+		rpc::retry<server::mod_store_t::GetLease>* retry,
+		gate::callback_get callback, void* user,
+		msgtype::DBValue* cached_val,
+		read_route* route,
+		mod_cache_t::lease_ticket* ticket)
+try {
+	// FIXME copied code
+	msgtype::DBKey key(retry->param().dbkey);
+	LOG_TRACE("ResGetLease ",err);
+
+	if(!read_response(route, from.get(), err.is_nil())) {
+		return;  // discard the response of the duplicated request
+	}
+
+	if(err.is_nil()) {
+		if(res.type != msgpack::type::ARRAY || res.via.array.size != 2) {
+			throw msgpack::type_error();
+		}
+		msgpack::object val(res.via.array.ptr[0]);
+		uint32_t lease = res.via.array.ptr[1].as<uint32_t>();
+
+		gate::res_get ret;
+		ret.error     = 0;
+		dbkey_remove_prefix(&ret, key);
+		ret.hash      = key.hash();
+		if(val.is_nil()) {
+			ret.val       = NULL;
+			ret.vallen    = 0;
+			ret.clocktime = 0;
+		} else if(val.type == msgpack::type::BOOLEAN &&
+				val.via.boolean == true) {
+			// cached
+			if(!cached_val) {
+				throw msgpack::type_error();
+			}
+			ret.val       = (char*)cached_val->data();
+			ret.vallen    = cached_val->size();
+			ret.clocktime = cached_val->clocktime().get();
+		} else {
+			msgtype::DBValue st = val.as<msgtype::DBValue>();
+			ret.val       = (char*)st.data();
+			ret.vallen    = st.size();
+			ret.clocktime = st.clocktime().get();
+			net->mod_cache.update(key, st);
+		}
+		if(lease != 0 && ret.val) {
+			net->mod_cache.set_lease(key, *ticket, lease);
+		}
+		try { (*callback)(user, ret, z); } catch (...) { }
+
+	} else if( !deadline_passed(retry->param().deadline) &&
+			retry->retry_incr(share->read_replication_factor() * share->cfg_get_retry_num() - 1) ) {
 		share->incr_error_renew_count();
-		unsigned short offset = retry->num_retried() % (NUM_REPLICATION+1);
+		unsigned short offset = retry->num_retried() % share->read_replication_factor();
 		SHARED_ZONE(life, z);
 		if(offset == 0) {
 			// FIXME configurable steps
 			retry_after<resource::HS_READ>(1*framework::DO_AFTER_BY_SECONDS,
-					retry, life, key.hash(), offset);
+					retry, life, key.hash(), offset, route);
 		} else {
-			retry->call(share->server_for<resource::HS_READ>(key.hash(), offset), life, 10);
+			read_call(retry, route,
+					share->server_for<resource::HS_READ>(key.hash(), offset), life);
 		}
 		LOG_WARN("Get error: ",err,", fallback to offset +",offset," node");
 
@@ -441,6 +1399,31 @@ try {
 GATEWAY_CATCH(ResGet, gate::res_get)
 
 
+namespace {
+void cache_write_through(server::set_op_t op,
+		const msgtype::DBKey& key, const msgtype::DBValue& val,
+		ClockTime clocktime, msgpack::zone* z)
+{
+	if(!net->mod_cache.is_enabled()) { return; }
+
+	if(op == server::OP_APPEND || op == server::OP_PREPEND) {
+		// the stored value is not known
+		net->mod_cache.remove(key);
+		return;
+	}
+
+	// the value sent to the server is not serialized;
+	// builds the raw value with the clocktime the server returned
+	size_t raw_vallen = val.size() + Storage::VALUE_META_SIZE;
+	char* raw_val = (char*)z->malloc(raw_vallen);
+	Storage::clocktime_to(clocktime, raw_val);
+	Storage::meta_to(val.meta(), raw_val);
+	memcpy(raw_val + Storage::VALUE_META_SIZE, val.data(), val.size());
+
+	net->mod_cache.update(key, msgtype::DBValue(raw_val, raw_vallen));
+}
+}  // noname namespace
+
 RPC_REPLY_IMPL(mod_store_t, Set, from, res, err, z,
 		rpc::retry<server::mod_store_t::Set>* retry,
 		gate::callback_set callback, void* user)
@@ -459,14 +1442,20 @@ try {
 		if(res.type == msgpack::type::BOOLEAN && res.via.boolean == false) {
 			ret.cas_success = false;
 			ret.clocktime = 0;
+			// the cached value may differ from the stored one
+			net->mod_cache.remove(key);
 		} else {
 			ret.cas_success = true;
 			ret.clocktime = res.as<ClockTime>().get();
+			// Gets sent while the Set is in flight may read the old state
+			net->mod_cache.invalidate_negative(key.hash());
+			cache_write_through(retry->param().operation,
+					key, val, res.as<ClockTime>(), z.get());
 		}
-		//net->mod_cache.update(key, val);  // FIXME raw_data() is invalid
 		try { (*callback)(user, ret, z); } catch (...) { }
 
-	} else if( retry->retry_incr(share->cfg_set_retry_num()) ) {
+	} else if( !deadline_passed(retry->param().deadline) &&
+			retry->retry_incr(share->cfg_set_retry_num()) ) {
 		share->incr_error_renew_count();
 		// FIXME configurable steps
 		SHARED_ZONE(life, z);
@@ -486,6 +1475,7 @@ try {
 		ret.val       = val.data();
 		ret.vallen    = val.size();
 		ret.clocktime = 0;
+		net->mod_cache.remove(key);
 		try { (*callback)(user, ret, z); } catch (...) { }
 		TLOGPACK("es",3,
 				"key",msgtype::raw_ref(key.data(),key.size()),
@@ -504,6 +1494,9 @@ try {
 	msgtype::DBKey key(retry->param().dbkey);
 	LOG_TRACE("ResDelete ",err);
 
+	// removed even if it failed because it may be deleted on the servers
+	net->mod_cache.remove(key);
+
 	if(!res.is_nil()) {
 		bool st = res.as<bool>();
 		gate::res_delete ret;
@@ -513,7 +1506,8 @@ try {
 		ret.deleted   = st;
 		try { (*callback)(user, ret, z); } catch (...) { }
 
-	} else if( retry->retry_incr(share->cfg_delete_retry_num()) ) {
+	} else if( !deadline_passed(retry->param().deadline) &&
+			retry->retry_incr(share->cfg_delete_retry_num()) ) {
 		share->incr_error_renew_count();
 		// FIXME configurable steps
 		SHARED_ZONE(life, z);
@@ -540,6 +1534,110 @@ try {
 }
 GATEWAY_CATCH(ResDelete, gate::res_delete)
 
+RPC_REPLY_IMPL(mod_store_t, Incr, from, res, err, z,
+		rpc::retry<server::mod_store_t::Incr>* retry,
+		gate::callback_incr callback, void* user)
+try {
+	msgtype::DBKey key(retry->param().dbkey);
+	LOG_TRACE("ResIncr ",err);
+
+	// the counter is updated on the servers
+	net->mod_cache.remove(key);
+
+	if(err.is_nil() && !res.is_nil()) {
+		gate::res_incr ret;
+		ret.error     = 0;
+		dbkey_remove_prefix(&ret, key);
+		ret.hash      = key.hash();
+		ret.non_numeric = false;
+		if(res.type == msgpack::type::BOOLEAN && res.via.boolean == false) {
+			ret.found     = false;
+			ret.value     = 0;
+			ret.clocktime = 0;
+		} else if(res.type == msgpack::type::BOOLEAN) {
+			ret.found     = true;
+			ret.non_numeric = true;
+			ret.value     = 0;
+			ret.clocktime = 0;
+		} else {
+			if(res.type != msgpack::type::ARRAY || res.via.array.size != 2) {
+				throw msgpack::type_error();
+			}
+			ret.found     = true;
+			ret.value     = res.via.array.ptr[0].as<uint64_t>();
+			ret.clocktime = res.via.array.ptr[1].as<ClockTime>().get();
+			net->mod_cache.invalidate_negative(key.hash());
+		}
+		try { (*callback)(user, ret, z); } catch (...) { }
+
+	} else if( err.is_nil() &&
+			!deadline_passed(retry->param().deadline) &&
+			retry->retry_incr(share->cfg_set_retry_num()) ) {
+		// the server didn't apply it. errors are not retried because
+		// the counter may be incremented twice if the response is lost
+		share->incr_error_renew_count();
+		// FIXME configurable steps
+		SHARED_ZONE(life, z);
+		retry_after<resource::HS_WRITE>(1*framework::DO_AFTER_BY_SECONDS,
+				retry, life, key.hash());
+		LOG_WARN("Incr error: ",err,", retry ",retry->num_retried());
+
+	} else {
+		if(err.via.u64 == (uint64_t)rpc::protocol::TRANSPORT_LOST_ERROR ||
+				err.via.u64 == (uint64_t)rpc::protocol::SERVER_ERROR) {
+			net->mod_network.renew_hash_space();   // FIXME
+		}
+		gate::res_incr ret;
+		ret.error     = 1;  // ERROR
+		dbkey_remove_prefix(&ret, key);
+		ret.hash      = key.hash();
+		ret.found     = false;
+		ret.non_numeric = false;
+		ret.value     = 0;
+		ret.clocktime = 0;
+		try { (*callback)(user, ret, z); } catch (...) { }
+		TLOGPACK("ei",3,
+				"key",msgtype::raw_ref(key.data(),key.size()),
+				"err",err.via.u64);
+		LOG_ERROR("Incr error: ",err);
+	}
+}
+GATEWAY_CATCH(ResIncr, gate::res_incr)
+
+RPC_REPLY_IMPL(mod_store_t, FlushAll, from, res, err, z,
+		gate::callback_flush callback, void* user, bool retried)
+try {
+	LOG_TRACE("ResFlushAll ",err);
+
+	if(err.is_nil()) {
+		ClockTime ct(res.as<ClockTime>());
+		// the manager pushes it to the other gateways
+		net->mod_cache.flush(ct);
+		gate::res_flush ret;
+		ret.error     = 0;
+		ret.clocktime = ct.get();
+		try { (*callback)(user, ret, z); } catch (...) { }
+
+	} else if(!retried && share->manager2().connectable()) {
+		SHARED_ZONE(life, z);
+		manager::mod_network_t::FlushAll param;
+		net->get_session(share->manager2())->call(param, life,
+				BIND_RESPONSE(mod_store_t, FlushAll, callback, user, true), 10);
+		LOG_WARN("FlushAll error: ",err,", retry");
+
+	} else {
+		gate::res_flush ret;
+		ret.error     = 1;  // ERROR
+		ret.clocktime = 0;
+		try { (*callback)(user, ret, z); } catch (...) { }
+		TLOGPACK("ef",3,
+				"err",err.via.u64);
+		LOG_ERROR("FlushAll error: ",err);
+	}
+}
+GATEWAY_CATCH(ResFlushAll, gate::res_flush)
+
+
 
 }  // namespace gateway
 }  // namespace kumo
@@ -20,11 +20,98 @@
 
 #include "gate/interface.h"
 #include "server/mod_store.h"
+#include "gateway/mod_cache.h"
+#include <mp/functional.h>
+#include <mp/pthread.h>
+#include <map>
+#include <string>
+#include <vector>
 
 namespace kumo {
 namespace gateway {
 
 
+// latency statistics of a server used by read routing
+struct read_stat {
+	read_stat() : ewma_usec(0), outstanding(0) { }
+	volatile uint64_t ewma_usec;
+	volatile unsigned int outstanding;
+};
+
+// a request of a read sent to a server
+struct read_leg {
+	read_leg() :
+		stat(NULL), start_usec(0), session(NULL) { }
+	read_stat* volatile stat;  // NULL if it is not charged
+	uint64_t start_usec;
+	const rpc::basic_session* session;  // server of the response
+};
+
+// kept in the life zone of a read request
+struct read_route {
+	read_route() :
+		offset(0), inflight(0), done(0) { }
+	read_leg primary;
+	read_leg hedge;
+	unsigned int offset;  // offset of the first server in the replicas
+
+	// a hedged Get sends the same request to two servers.
+	// the first response wins and the other one is discarded.
+	// each server is charged for its own response.
+	volatile unsigned int inflight;
+	volatile int done;
+};
+
+
+// histogram of response time in power-of-two microseconds
+class latency_histogram {
+public:
+	latency_histogram();
+	~latency_histogram();
+
+public:
+	void add(uint64_t usec);
+	uint64_t percentile(unsigned int p) const;
+	uint32_t total() const { return m_total; }
+	void decay();
+
+private:
+	static const unsigned int BUCKETS = 32;
+	volatile uint32_t m_count[BUCKETS];
+	volatile uint32_t m_total;
+
+private:
+	latency_histogram(const latency_histogram&);
+};
+
+
+// requests to a server gathered by the batching stage
+struct request_batch {
+	request_batch() : buffer(NULL), num(0), deadline_usec(0) { }
+	shared_session session;
+	rpc::vrefbuffer* buffer;
+	unsigned int num;
+	uint64_t deadline_usec;
+};
+
+
+// a Get waiting for the response of the same key
+struct get_waiter {
+	gate::callback_get callback;
+	void* user;
+	shared_zone life;
+};
+
+// kept in the life zone of the first Get of a key
+struct get_flight {
+	gate::callback_get callback;
+	void* user;
+	uint64_t hash;
+	std::string key;
+	std::vector<get_waiter> waiters;  // locked by m_flights_mutex
+};
+
+
 class mod_store_t {
 public:
 	mod_store_t();
@@ -33,19 +120,101 @@ public:
 public:
 	void Get(gate::req_get& req);
 
+	void GetMulti(gate::req_get_multi& req);
+
 	void Set(gate::req_set& req);
 
 	void Delete(gate::req_delete& req);
 
+	void Incr(gate::req_incr& req);
+
+	void FlushAll(gate::req_flush& req);
+
+public:
+	// hedged Get
+	void start_hedge_timer();
+	void step_hedge();
+
+public:
+	// cross-connection request batching
+	void start_batch_timer();
+	void step_batch();
+
+	// send the request with other requests to the same server
+	template <typename Parameter>
+	void batch_call(rpc::retry<Parameter>* retry,
+			shared_session s, shared_zone& life);
+
+private:
+	// deadline is wall clock msec (0: none). see deadline_after()
+	void submit_get(const msgtype::DBKey& key, uint64_t deadline,
+			gate::callback_get callback, void* user, shared_zone& life);
+	void fallback_get(const msgtype::DBKey& key, uint64_t deadline,
+			gate::callback_get callback, void* user, shared_zone& life);
+	void send_get(const msgtype::DBKey& key, uint64_t deadline,
+			gate::callback_get callback, void* user, shared_zone& life);
+
+	// single-flight Get: concurrent Gets for the same key share
+	// one request to the server
+	bool join_flight(const msgtype::DBKey& key,
+			gate::callback_get* callback, void** user, shared_zone& life);
+	void leave_flight(get_flight* f, std::vector<get_waiter>* waiters);
+	static void flight_landed(void* user, gate::res_get& res, auto_zone z);
+
+	// called when a write to the key is submitted.
+	// Gets joined the flight get the value before the write,
+	// and Gets after it start a new flight.
+	void detach_flight(const msgtype::DBKey& key);
+
+	mp::pthread_mutex m_flights_mutex;
+	typedef std::map<std::pair<uint64_t, std::string>,
+			get_flight*> flights_t;
+	flights_t m_flights;
+
+	bool read_response(read_route* route,
+			const rpc::basic_session* from, bool success);
+
+	void schedule_hedge(mp::function<void ()> fire);
+
+	mp::pthread_mutex m_hedge_mutex;
+	typedef std::multimap<uint64_t, mp::function<void ()> > hedge_queue_t;
+	hedge_queue_t m_hedge_queue;
+
+	latency_histogram m_latency;
+	volatile uint64_t m_hedge_delay_usec;
+
+	uint64_t batch_window(uint64_t now);
+	void send_batch(request_batch& b);
+
+	mp::pthread_mutex m_batch_mutex;
+	typedef std::map<rpc::session*, request_batch> batches_t;
+	batches_t m_batches;
+
+	volatile uint64_t m_batch_last_usec;
+	volatile uint64_t m_batch_gap_usec;  // EWMA of the interval of requests
+
 private:
 	RPC_REPLY_DECL(Get, from, res, err, z,
 			rpc::retry<server::mod_store_t::Get>* retry,
-			gate::callback_get callback, void* user);
+			gate::callback_get callback, void* user,
+			read_route* route, uint32_t negative_ticket);
 
 	RPC_REPLY_DECL(GetIfModified, from, res, err, z,
 			rpc::retry<server::mod_store_t::GetIfModified>* retry,
 			gate::callback_get callback, void* user,
-			msgtype::DBValue* cached_val);
+			msgtype::DBValue* cached_val,
+			read_route* route);
+
+	RPC_REPLY_DECL(GetLease, from, res, err, z,
+			rpc::retry<server::mod_store_t::GetLease>* retry,
+			gate::callback_get callback, void* user,
+			msgtype::DBValue* cached_val,
+			read_route* route,
+			mod_cache_t::lease_ticket* ticket);
+
+	RPC_REPLY_DECL(GetMulti, from, res, err, z,
+			rpc::retry<server::mod_store_t::GetMulti>* retry,
+			gate::callback_get callback, void** users);
 
 	RPC_REPLY_DECL(Set, from, res, err, z,
 			rpc::retry<server::mod_store_t::Set>* retry,
@@ -54,6 +223,13 @@ private:
 	RPC_REPLY_DECL(Delete, from, res, err, z,
 			rpc::retry<server::mod_store_t::Delete>* retry,
 			gate::callback_delete callback, void* user);
+
+	RPC_REPLY_DECL(Incr, from, res, err, z,
+			rpc::retry<server::mod_store_t::Incr>* retry,
+			gate::callback_incr callback, void* user);
+
+	RPC_REPLY_DECL(FlushAll, from, res, err, z,
+			gate::callback_flush callback, void* user, bool retried);
 };
 
 
@@ -21,7 +21,12 @@
 #include "log/mlogger.h"
 #include "config.h"
 
-#define NUM_REPLICATION 2
+// number of nodes which store a key: the coordinator and the replicas.
+// it is held in the hash space and can be changed at runtime.
+#define DEFAULT_REPLICATION_FACTOR 3
+
+// upper bound of the replication factor
+#define MAX_REPLICATION_FACTOR 8
 
 #ifndef MANAGER_DEFAULT_PORT
 #define MANAGER_DEFAULT_PORT  19700
@@ -25,8 +25,9 @@ namespace kumo {
 static const size_t HASHSPACE_VIRTUAL_NODE_NUMBER = 128;
 
 
-HashSpace::HashSpace(ClockTime clocktime) :
-	m_timestamp(clocktime) {}
+HashSpace::HashSpace(ClockTime clocktime, unsigned int replication_factor) :
+	m_timestamp(clocktime),
+	m_replication_factor(replication_factor) {}
 
 HashSpace::~HashSpace() {}
 
@@ -105,6 +106,16 @@ bool HashSpace::recover_server(ClockTime clocktime, const address& addr)
 	return false;
 }
 
+bool HashSpace::set_replication_factor(ClockTime clocktime, unsigned int factor)
+{
+	if(factor < 1 || factor > MAX_REPLICATION_FACTOR) {
+		return false;
+	}
+	m_replication_factor = factor;
+	m_timestamp = clocktime;
+	return true;
+}
+
 bool HashSpace::remove_fault_servers(ClockTime clocktime)
 {
 	bool ret = false;
@@ -124,6 +135,106 @@ bool HashSpace::remove_fault_servers(ClockTime clocktime)
 	return false;
 }
 
+bool HashSpace::apply_nodes(nodes_t& nodes, const Delta& delta)
+{
+	if(delta.m_full) {
+		nodes = delta.m_changed;
+		return true;
+	}
+
+	for(std::vector<address>::const_iterator it(delta.m_removed.begin()),
+			it_end(delta.m_removed.end()); it != it_end; ++it) {
+		nodes_t::iterator n = std::find_if(nodes.begin(), nodes.end(),
+				node_address_equal(*it));
+		if(n == nodes.end()) { return false; }
+		nodes.erase(n);
+	}
+
+	// nodes are added at the end as add_server does
+	for(nodes_t::const_iterator it(delta.m_changed.begin()),
+			it_end(delta.m_changed.end()); it != it_end; ++it) {
+		nodes_t::iterator n = std::find_if(nodes.begin(), nodes.end(),
+				node_address_equal(it->addr()));
+		if(n == nodes.end()) {
+			nodes.push_back(*it);
+		} else {
+			*n = *it;
+		}
+	}
+
+	return true;
+}
+
+bool HashSpace::apply(const Delta& delta)
+{
+	if(!delta.m_full && delta.m_base != m_timestamp) {
+		return false;
+	}
+
+	nodes_t nodes(m_nodes);
+	if(!apply_nodes(nodes, delta)) {
+		return false;
+	}
+
+	m_nodes.swap(nodes);
+	m_timestamp = delta.m_clocktime;
+	m_replication_factor = delta.m_replication_factor;
+	rehash();
+	return true;
+}
+
+
+HashSpace::Delta::Delta() :
+	m_full(true), m_base(0), m_clocktime(0),
+	m_replication_factor(DEFAULT_REPLICATION_FACTOR) { }
+
+HashSpace::Delta::Delta(const Seed& hs)
+{
+	set_full(hs);
+}
+
+HashSpace::Delta::Delta(const Seed& base, const Seed& hs) :
+	m_full(false),
+	m_base(base.clocktime()),
+	m_clocktime(hs.clocktime()),
+	m_replication_factor(hs.replication_factor())
+{
+	const nodes_t& from(base.nodes());
+	const nodes_t& to(hs.nodes());
+
+	for(nodes_t::const_iterator it(from.begin()), it_end(from.end());
+			it != it_end; ++it) {
+		if(std::find_if(to.begin(), to.end(),
+					node_address_equal(it->addr())) == to.end()) {
+			m_removed.push_back(it->addr());
+		}
+	}
+
+	for(nodes_t::const_iterator it(to.begin()), it_end(to.end());
+			it != it_end; ++it) {
+		if(std::find(from.begin(), from.end(), *it) == from.end()) {
+			m_changed.push_back(*it);
+		}
+	}
+
+	// order of the nodes may not be reproduced if a node is removed and
+	// added again. falls back to the full delta in that case.
+	nodes_t check(from);
+	if(!apply_nodes(check, *this) || check != to) {
+		set_full(hs);
+	}
+}
+
+void HashSpace::Delta::set_full(const Seed& hs)
+{
+	m_full = true;
+	m_base = ClockTime(0);
+	m_clocktime = hs.clocktime();
+	m_replication_factor = hs.replication_factor();
+	m_changed = hs.nodes();
+	m_removed.clear();
+}
+
 void HashSpace::add_virtual_nodes(const node& n)
 {
 	uint64_t x = HashSpace::hash(n.addr().dump(), n.addr().dump_size());
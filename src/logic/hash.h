@@ -20,6 +20,7 @@
 
 #include "rpc/address.h"
 #include "logic/clock.h"
+#include "logic/global.h"
 #include <vector>
 #include <algorithm>
 #include <ostream>
@@ -33,8 +34,10 @@ using rpc::address;
 class HashSpace {
 public:
 	class Seed;
+	class Delta;
 
-	HashSpace(ClockTime clocktime = ClockTime(0,0));
+	HashSpace(ClockTime clocktime = ClockTime(0,0),
+			unsigned int replication_factor = DEFAULT_REPLICATION_FACTOR);
 	HashSpace(const Seed& seed);
 	~HashSpace();
 
@@ -81,11 +84,18 @@ private:
 
 	ClockTime m_timestamp;
 
+	unsigned int m_replication_factor;
+
 public:
 	class iterator;
 
 	iterator find(uint64_t h) const;
 
+	// stores the nodes assigned to the hash into the result in order of
+	// the coordinator and the replicas, and returns the number of them.
+	// the result must have room for MAX_REPLICATION_FACTOR nodes.
+	unsigned int assigned_nodes(uint64_t h, node* result) const;
+
 	size_t active_node_count() const;
 	void get_active_nodes(std::vector<address>& result) const;
 
@@ -96,14 +106,23 @@ public:
 	bool recover_server(ClockTime clocktime, const address& addr);
 	bool remove_fault_servers(ClockTime clocktime);
 
+	// returns false if the base of the delta is not this hash space
+	bool apply(const Delta& delta);
+
 	bool empty() const;
 
 	ClockTime clocktime() const
 		{ return m_timestamp; }
 
-	// compare nodes (clocktime is ignored)
+	// number of nodes which store a key (the coordinator and the replicas)
+	unsigned int replication_factor() const
+		{ return m_replication_factor; }
+	bool set_replication_factor(ClockTime clocktime, unsigned int factor);
+
+	// compare nodes and replication factor (clocktime is ignored)
 	bool operator== (const HashSpace& other) const
-		{ return m_nodes == other.m_nodes; }
+		{ return m_nodes == other.m_nodes &&
+			m_replication_factor == other.m_replication_factor; }
 
 	void nodes_diff(const HashSpace& other, std::vector<address>& result) const;
 
@@ -115,13 +134,16 @@ private:
 	void add_virtual_nodes(const node& n);
 	void rehash();
 
+	static bool apply_nodes(nodes_t& nodes, const Delta& delta);
+
 public:
 	static uint64_t hash(const char* data, unsigned long len);
 
 public:
 	friend class Seed;
+	friend class Delta;
 
-	// compare nodes (clocktime is ignored)
+	// compare nodes and replication factor (clocktime is ignored)
 	bool operator== (const Seed& other) const;
 };
 
@@ -210,26 +232,116 @@ inline msgpack::packer<Stream>& operator<< (msgpack::packer<Stream>& o, const Ha
 }
 
 
-class HashSpace::Seed : public msgpack::define<
-		msgpack::type::tuple<nodes_t, ClockTime> > {
+class HashSpace::Seed {
 public:
-	Seed() { }
+	Seed() : m_clocktime(0), m_replication_factor(DEFAULT_REPLICATION_FACTOR) { }
 	Seed(HashSpace& hs) :
-		define_type(msgpack_type( hs.m_nodes, hs.m_timestamp )) {}
-	const nodes_t& nodes()     const { return get<0>(); }
-	ClockTime      clocktime() const { return get<1>(); }
+		m_nodes(hs.m_nodes), m_clocktime(hs.m_timestamp),
+		m_replication_factor(hs.m_replication_factor) { }
+	const nodes_t& nodes()     const { return m_nodes; }
+	ClockTime      clocktime() const { return m_clocktime; }
 	bool           empty()     const;
+	unsigned int   replication_factor() const { return m_replication_factor; }
+
+	template <typename Packer>
+	void msgpack_pack(Packer& pk) const
+	{
+		pk.pack_array(3);
+		pk.pack(m_nodes);
+		pk.pack(m_clocktime);
+		pk.pack(m_replication_factor);
+	}
+
+	void msgpack_unpack(msgpack::object o)
+	{
+		if(o.type != msgpack::type::ARRAY || o.via.array.size < 2) {
+			throw msgpack::type_error();
+		}
+		m_nodes = o.via.array.ptr[0].as<nodes_t>();
+		m_clocktime = o.via.array.ptr[1].as<ClockTime>();
+		if(o.via.array.size > 2) {
+			m_replication_factor = o.via.array.ptr[2].as<unsigned int>();
+			if(m_replication_factor < 1 ||
+					m_replication_factor > MAX_REPLICATION_FACTOR) {
+				throw msgpack::type_error();
+			}
+		} else {
+			// seed of older version: [nodes, clocktime]
+			m_replication_factor = DEFAULT_REPLICATION_FACTOR;
+		}
+	}
+
+private:
+	nodes_t m_nodes;
+	ClockTime m_clocktime;
+	unsigned int m_replication_factor;
+};
+
+// difference of the nodes between two versions of a hash space.
+// a full delta has all nodes and can be applied to any hash space.
+class HashSpace::Delta {
+public:
+	Delta();
+	Delta(const Seed& hs);
+	Delta(const Seed& base, const Seed& hs);
+
+	bool      full()      const { return m_full; }
+	ClockTime base()      const { return m_base; }
+	ClockTime clocktime() const { return m_clocktime; }
+
+	template <typename Packer>
+	void msgpack_pack(Packer& pk) const
+	{
+		pk.pack_array(6);
+		pk.pack(m_full);
+		pk.pack(m_base);
+		pk.pack(m_clocktime);
+		pk.pack(m_replication_factor);
+		pk.pack(m_changed);
+		pk.pack(m_removed);
+	}
+
+	void msgpack_unpack(msgpack::object o)
+	{
+		if(o.type != msgpack::type::ARRAY || o.via.array.size < 6) {
+			throw msgpack::type_error();
+		}
+		m_full = o.via.array.ptr[0].as<bool>();
+		m_base = o.via.array.ptr[1].as<ClockTime>();
+		m_clocktime = o.via.array.ptr[2].as<ClockTime>();
+		m_replication_factor = o.via.array.ptr[3].as<unsigned int>();
+		m_changed = o.via.array.ptr[4].as<nodes_t>();
+		m_removed = o.via.array.ptr[5].as<std::vector<address> >();
+		if(m_replication_factor < 1 ||
+				m_replication_factor > MAX_REPLICATION_FACTOR) {
+			throw msgpack::type_error();
+		}
+	}
+
+private:
+	void set_full(const Seed& hs);
+
+	friend class HashSpace;
+
+	bool m_full;
+	ClockTime m_base;
+	ClockTime m_clocktime;
+	unsigned int m_replication_factor;
+	nodes_t m_changed;  // added nodes and nodes whose status is changed
+	std::vector<address> m_removed;
 };
 
 inline HashSpace::HashSpace(const Seed& seed) :
-	m_nodes(seed.nodes()), m_timestamp(seed.clocktime())
+	m_nodes(seed.nodes()), m_timestamp(seed.clocktime()),
+	m_replication_factor(seed.replication_factor())
 {
 	rehash();
 }
 
 inline bool HashSpace::operator== (const Seed& other) const
 {
-	return m_nodes == other.nodes();
+	return m_nodes == other.nodes() &&
+		m_replication_factor == other.replication_factor();
 }
 
 
@@ -245,6 +357,27 @@ inline HashSpace::iterator HashSpace::find(uint64_t h) const
 	}
 }
 
+inline unsigned int HashSpace::assigned_nodes(uint64_t h, node* result) const
+{
+	if(m_hashspace.empty()) { return 0; }
+
+	unsigned int limit = std::min(m_replication_factor,
+			(unsigned int)MAX_REPLICATION_FACTOR);
+	unsigned int n = 0;
+
+	iterator it(find(h));
+	iterator origin(it);
+	do {
+		if(std::find_if(result, result+n,
+					node_address_equal(it->addr())) == result+n) {
+			result[n++] = *it;
+		}
+		++it;
+	} while(n < limit && it != origin);
+
+	return n;
+}
+
 inline bool HashSpace::empty() const
 {
 	for(nodes_t::const_iterator it(m_nodes.begin()), it_end(m_nodes.end());
@@ -256,7 +389,7 @@ inline bool HashSpace::empty() const
 
 inline bool HashSpace::Seed::empty() const
 {
-	for(nodes_t::const_iterator it(get<0>().begin()), it_end(get<0>().end());
+	for(nodes_t::const_iterator it(m_nodes.begin()), it_end(m_nodes.end());
 			it != it_end; ++it) {
 		if(it->is_active()) { return false; }
 	}
@@ -20,6 +20,7 @@
 #include "logic/cluster_logic.h"
 #include <msgpack.hpp>
 #include <string>
+#include <deque>
 #include <stdint.h>
 
 namespace kumo {
@@ -31,6 +32,8 @@ namespace manager {
 @message mod_network_t::HashSpaceSync       =   2
 @message mod_network_t::WHashSpaceRequest   =   4
 @message mod_network_t::RHashSpaceRequest   =   5
+@message mod_network_t::HashSpaceSubscribe  =   6
+@message mod_network_t::FlushAll            =   7
 @message mod_replace_t::ReplaceCopyEnd      =  10
 @message mod_replace_t::ReplaceDeleteEnd    =  11
 @message mod_replace_t::ReplaceElection     =  12
@@ -40,11 +43,13 @@ namespace manager {
 @message mod_control_t::CreateBackup        = 102
 @message mod_control_t::SetAutoReplace      = 103
 @message mod_control_t::StartReplace        = 104
+@message mod_control_t::SetReplicationFactor = 105
 
 
 @rpc mod_network_t
 	message KeepAlive +cluster {
 		Clock adjust_clock;
+		uint64_t flush_clocktime = 0;
 		// ok: UNDEFINED
 	};
 
@@ -64,10 +69,26 @@ namespace manager {
 		msgtype::HSSeed wseed;
 		msgtype::HSSeed rseed;
 		Clock adjust_clock;
+		msgtype::HSSeed staged_target = msgtype::HSSeed();
+		// staged_target: empty if staged replacing is not in progress
 		// success: true
 		// obsolete: nil
 	};
 
+	message HashSpaceSubscribe {
+		ClockTime wbase;
+		ClockTime rbase;
+		// success: gateway::mod_network_t::HashSpaceDeltaPush
+	};
+
+	message FlushAll {
+		// success: flush_clocktime:ClockTime
+	};
+
+public:
+	mod_network_t();
+	~mod_network_t();
+
 public:
 	void keep_alive();
 
@@ -75,10 +96,34 @@ public:
 	void sync_hash_space_partner(REQUIRE_HSLK);
 	void push_hash_space_clients(REQUIRE_HSLK);
 
+	// values stored before the flush clocktime are invisible.
+	// it is sent with KeepAlive and pushed with the hash space.
+	void update_flush_clocktime(ClockTime flush_clocktime);
+
 private:
 	RPC_REPLY_DECL(KeepAlive, from, res, err, z);
 	RPC_REPLY_DECL(HashSpaceSync, from, res, err, z);
+	RPC_REPLY_DECL(HashSpaceDeltaSync, from, res, err, z);
 	RPC_REPLY_DECL(HashSpacePush, from, res, err, z);
+	RPC_REPLY_DECL(HashSpaceDeltaPush, from, res, err, z);
+	RPC_REPLY_DECL(FlushKeepAlive, from, res, err, z,
+			volatile unsigned int* remain,
+			rpc::weak_responder response, ClockTime flush_clocktime);
+
+private:
+	// recent versions of the hash spaces which are sent to the servers
+	// or the clients. deltas for HashSpaceSubscribe are made from them.
+	typedef std::deque<HashSpace::Seed> history_t;
+	history_t m_whs_history;
+	history_t m_rhs_history;
+
+	void remember_hash_space(REQUIRE_HSLK);
+
+	// last versions sent to the servers and the clients
+	HashSpace::Seed m_server_wseed;
+	HashSpace::Seed m_server_rseed;
+	HashSpace::Seed m_client_wseed;
+	HashSpace::Seed m_client_rseed;
 @end
 
 
@@ -118,6 +163,15 @@ public:
 	void add_server(const address& addr, shared_node& s);
 	void remove_server(const address& addr);
 
+	// hash space which servers are attached to or detached from.
+	// it is whs unless staged replacing is in progress.
+	HashSpace& target_hs(REQUIRE_HSLK);
+
+	// the staged target is synchronized with the partner along with whs
+	// so that the partner can continue the waves.
+	HashSpace::Seed staged_target(REQUIRE_HSLK);
+	void sync_staged_target(REQUIRE_HSLK, const HashSpace::Seed& target);
+
 private:
 	void replace_election();
 	void delayed_replace_election();
@@ -131,6 +185,13 @@ private:
 	void finish_replace_copy(REQUIRE_RELK);
 	void finish_replace(REQUIRE_RELK);
 
+	// staged replacing: whs is moved toward m_staged_target by at most
+	// cfg_replace_wave servers in each wave of replace.
+	bool stage_replace(REQUIRE_HSLK, bool full);
+	void start_next_wave();
+	bool m_staging;
+	HashSpace m_staged_target;
+
 private:
 	class progress {
 	public:
@@ -179,6 +240,11 @@ private:
 		bool full = false;
 	};
 
+	message SetReplicationFactor {
+		uint32_t factor;
+		bool replace;
+	};
+
 
 public:
 	mod_control_t();
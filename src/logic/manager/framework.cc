@@ -51,12 +51,15 @@ try {
 	// FIXME try & catch
 	switch(method.get()) {
 	RPC_DISPATCH(mod_network, HashSpaceRequest);
+	RPC_DISPATCH(mod_network, HashSpaceSubscribe);
+	RPC_DISPATCH(mod_network, FlushAll);
 	RPC_DISPATCH(mod_control, GetNodesInfo);
 	RPC_DISPATCH(mod_control, AttachNewServers);
 	RPC_DISPATCH(mod_control, DetachFaultServers);
 	RPC_DISPATCH(mod_control, CreateBackup);
 	RPC_DISPATCH(mod_control, SetAutoReplace);
 	RPC_DISPATCH(mod_control, StartReplace);
+	RPC_DISPATCH(mod_control, SetReplicationFactor);
 	default:
 		throw unknown_method_error();
 	}
@@ -84,6 +84,7 @@ private:
 	mp::pthread_mutex m_hs_mutex;
 	HashSpace m_rhs;
 	HashSpace m_whs;
+	ClockTime m_flush_clocktime;  // locked by hs_mutex
 
 	// connected but not joined servers
 	mp::pthread_mutex m_new_servers_mutex;
@@ -93,11 +94,13 @@ private:
 
 	bool m_cfg_auto_replace;
 	const short m_cfg_replace_delay_seconds;
+	const unsigned short m_cfg_replace_wave;
 
 public:
 	RESOURCE_ACCESSOR(mp::pthread_mutex, hs_mutex);
 	RESOURCE_ACCESSOR(HashSpace, rhs);
 	RESOURCE_ACCESSOR(HashSpace, whs);
+	RESOURCE_ACCESSOR(ClockTime, flush_clocktime);
 
 	RESOURCE_ACCESSOR(mp::pthread_mutex, new_servers_mutex);
 	RESOURCE_ACCESSOR(new_servers_t, new_servers);
@@ -106,6 +109,7 @@ public:
 
 	RESOURCE_ACCESSOR(bool, cfg_auto_replace);
 	RESOURCE_CONST_ACCESSOR(short, cfg_replace_delay_seconds);
+	RESOURCE_CONST_ACCESSOR(unsigned short, cfg_replace_wave);
 
 private:
 	resource();
@@ -48,9 +48,13 @@ void framework::run(const Config& cfg)
 
 template <typename Config>
 resource::resource(const Config& cfg) :
+	m_rhs(ClockTime(0,0), cfg.replication_factor),
+	m_whs(ClockTime(0,0), cfg.replication_factor),
+	m_flush_clocktime(0),
 	m_partner(cfg.partner),
 	m_cfg_auto_replace(cfg.auto_replace),
-	m_cfg_replace_delay_seconds(cfg.replace_delay_seconds)
+	m_cfg_replace_delay_seconds(cfg.replace_delay_seconds),
+	m_cfg_replace_wave(cfg.replace_wave)
 { }
 
 template <typename Config>
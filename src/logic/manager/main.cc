@@ -23,6 +23,9 @@ using namespace kumo;
 
 struct arg_t : cluster_args {
 	unsigned short replace_delay_seconds;
+	unsigned short replace_wave;
+
+	unsigned int replication_factor;
 
 	bool auto_replace;
 
@@ -34,10 +37,16 @@ struct arg_t : cluster_args {
 	{
 		cluster_args::convert();
 		partner = rpc::address(partner_in);
+
+		if(replication_factor < 1 || replication_factor > MAX_REPLICATION_FACTOR) {
+			throw std::runtime_error("--replication-factor must be between 1 and 8");
+		}
 	}
 
 	arg_t(int argc, char** argv) :
-		replace_delay_seconds(4)
+		replace_delay_seconds(4),
+		replace_wave(0),
+		replication_factor(DEFAULT_REPLICATION_FACTOR)
 	{
 		using namespace kazuhiki;
 		set_basic_args();
@@ -49,6 +58,10 @@ struct arg_t : cluster_args {
 				type::boolean(&auto_replace));
 		on("-Rs", "--replace-delay",
 				type::numeric(&replace_delay_seconds, replace_delay_seconds));
+		on("-Rw", "--replace-wave",
+				type::numeric(&replace_wave, replace_wave));
+		on("-rf", "--replication-factor",
+				type::numeric(&replication_factor, replication_factor));
 		parse(argc, argv);
 	}
 
@@ -65,6 +78,10 @@ struct arg_t : cluster_args {
 			"--auto-replace   enable auto replacing\n"
 		"  -Rs <number="<<replace_delay_seconds  <<">            "
 			"--replace-delay  delay time of auto replacing in sec.\n"
+		"  -Rw <number="<<replace_wave           <<">            "
+			"--replace-wave   servers attached or detached in a wave of replacing\n"
+		"  -rf <number="<<replication_factor     <<">            "
+			"--replication-factor  initial number of copies of a key\n"
 		;
 		cluster_args::show_usage();
 	}
@@ -111,6 +111,27 @@ RPC_IMPL(mod_control_t, SetAutoReplace, req, z, response)
 	response.null();
 }
 
+RPC_IMPL(mod_control_t, SetReplicationFactor, req, z, response)
+{
+	{
+		pthread_scoped_lock hslk(share->hs_mutex());
+		ClockTime ct = net->clock_incr_clocktime();
+		if(!net->mod_replace.target_hs(hslk).set_replication_factor(ct, req.param().factor)) {
+			hslk.unlock();
+			std::string msg("invalid replication factor");
+			response.error(msg);
+			return;
+		}
+		LOG_INFO("replication factor is set to ",req.param().factor);
+
+		net->mod_network.sync_hash_space_partner(hslk);
+		if(req.param().replace) {
+			net->mod_replace.start_replace(hslk);
+		}
+	}
+	response.null();
+}
+
 RPC_IMPL(mod_control_t, StartReplace, req, z, response)
 {
 	{
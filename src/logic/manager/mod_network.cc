@@ -36,9 +36,69 @@ namespace kumo {
 namespace manager {
 
 
+mod_network_t::mod_network_t() { }
+
+mod_network_t::~mod_network_t() { }
+
+
+namespace {
+	static const size_t HASH_SPACE_HISTORY_SIZE = 16;
+
+	// delta from the version sent last time; full delta if nothing is sent yet
+	HashSpace::Delta* delta_since(HashSpace::Seed& last,
+			HashSpace& current, msgpack::zone* z)
+	{
+		HashSpace::Seed seed(current);
+		HashSpace::Delta* delta;
+		if(last.clocktime() == ClockTime(0)) {
+			delta = z->allocate<HashSpace::Delta>(seed);
+		} else {
+			delta = z->allocate<HashSpace::Delta>(last, seed);
+		}
+		last = seed;
+		return delta;
+	}
+
+	template <typename History>
+	HashSpace::Delta* delta_from(ClockTime base, const History& history,
+			HashSpace& current, msgpack::zone* z)
+	{
+		HashSpace::Seed seed(current);
+		if(base == current.clocktime()) {
+			return z->allocate<HashSpace::Delta>(seed, seed);
+		}
+		for(typename History::const_reverse_iterator it(history.rbegin()),
+				it_end(history.rend()); it != it_end; ++it) {
+			if(it->clocktime() == base) {
+				return z->allocate<HashSpace::Delta>(*it, seed);
+			}
+		}
+		return z->allocate<HashSpace::Delta>(seed);
+	}
+
+	template <typename History>
+	void remember(History& history, HashSpace& current)
+	{
+		if(history.empty() || history.back().clocktime() != current.clocktime()) {
+			history.push_back(HashSpace::Seed(current));
+			if(history.size() > HASH_SPACE_HISTORY_SIZE) {
+				history.pop_front();
+			}
+		}
+	}
+}  // noname namespace
+
+void mod_network_t::remember_hash_space(REQUIRE_HSLK)
+{
+	remember(m_whs_history, share->whs());
+	remember(m_rhs_history, share->rhs());
+}
+
+
 RPC_IMPL(mod_network_t, KeepAlive, req, z, response)
 {
 	net->clock_update(req.param().adjust_clock);
+	update_flush_clocktime(ClockTime(req.param().flush_clocktime));
 	response.null();
 }
 
@@ -58,6 +118,25 @@ RPC_IMPL(mod_network_t, HashSpaceRequest, req, z, response)
 }
 
 
+RPC_IMPL(mod_network_t, HashSpaceSubscribe, req, z, response)
+{
+	HashSpace::Delta* wdelta;
+	HashSpace::Delta* rdelta;
+	ClockTime flush_clocktime;
+	{
+		pthread_scoped_lock hslk(share->hs_mutex());
+		remember_hash_space(hslk);
+		wdelta = delta_from(req.param().wbase, m_whs_history, share->whs(), z.get());
+		rdelta = delta_from(req.param().rbase, m_rhs_history, share->rhs(), z.get());
+		flush_clocktime = share->flush_clocktime();
+	}
+
+	gateway::mod_network_t::HashSpaceDeltaPush arg(*wdelta, *rdelta,
+			flush_clocktime.get());
+	response.result(arg, z);
+}
+
+
 RPC_IMPL(mod_network_t, WHashSpaceRequest, req, z, response)
 {
 	HashSpace::Seed* seed;
@@ -83,18 +162,64 @@ RPC_IMPL(mod_network_t, RHashSpaceRequest, req, z, response)
 
 void mod_network_t::sync_hash_space_servers(REQUIRE_HSLK)
 {
+	remember_hash_space(hslk);
+
 	shared_zone life(new msgpack::zone());
-	HashSpace::Seed* wseed = life->allocate<HashSpace::Seed>(share->whs());
-	HashSpace::Seed* rseed = life->allocate<HashSpace::Seed>(share->rhs());
+	HashSpace::Delta* wdelta = delta_since(m_server_wseed, share->whs(), life.get());
+	HashSpace::Delta* rdelta = delta_since(m_server_rseed, share->rhs(), life.get());
 
-	server::mod_network_t::HashSpaceSync param(*wseed, *rseed, net->clock_incr());
+	server::mod_network_t::HashSpaceDeltaSync param(*wdelta, *rdelta, net->clock_incr());
 
-	rpc::callback_t callback( BIND_RESPONSE(mod_network_t, HashSpaceSync) );
+	rpc::callback_t callback( BIND_RESPONSE(mod_network_t, HashSpaceDeltaSync) );
 
 	net->for_each_node(ROLE_SERVER,
 			for_each_call(param, life, callback, 10));
 }
 
+RPC_REPLY_IMPL(mod_network_t, HashSpaceDeltaSync, from, res, err, z)
+{
+	if(!err.is_nil()) {
+		if(err.type == msgpack::type::POSITIVE_INTEGER &&
+				err.via.u64 == (uint64_t)rpc::protocol::PROTOCOL_ERROR &&
+				SESSION_IS_ACTIVE(from)) {
+			// the server doesn't know HashSpaceDeltaSync; send HashSpaceSync
+			LOG_DEBUG("HashSpaceSync to old server");
+			shared_zone life(new msgpack::zone());
+			HashSpace::Seed* wseed;
+			HashSpace::Seed* rseed;
+			{
+				pthread_scoped_lock hslk(share->hs_mutex());
+				wseed = life->allocate<HashSpace::Seed>(share->whs());
+				rseed = life->allocate<HashSpace::Seed>(share->rhs());
+			}
+
+			server::mod_network_t::HashSpaceSync param(*wseed, *rseed, net->clock_incr());
+			from->call(param, life,
+					BIND_RESPONSE(mod_network_t, HashSpaceSync), 10);
+		}
+		return;
+	}
+
+	if(res.type != msgpack::type::BOOLEAN || res.via.boolean) {
+		return;
+	}
+
+	// the server doesn't have the base version; send whole hash space
+	LOG_DEBUG("full HashSpaceDeltaSync");
+	shared_zone life(new msgpack::zone());
+	HashSpace::Delta* wdelta;
+	HashSpace::Delta* rdelta;
+	{
+		pthread_scoped_lock hslk(share->hs_mutex());
+		wdelta = life->allocate<HashSpace::Delta>(HashSpace::Seed(share->whs()));
+		rdelta = life->allocate<HashSpace::Delta>(HashSpace::Seed(share->rhs()));
+	}
+
+	server::mod_network_t::HashSpaceDeltaSync param(*wdelta, *rdelta, net->clock_incr());
+	from->call(param, life,
+			BIND_RESPONSE(mod_network_t, HashSpaceSync), 10);
+}
+
 
 void mod_network_t::sync_hash_space_partner(REQUIRE_HSLK)
 {
@@ -103,8 +228,10 @@ void mod_network_t::sync_hash_space_partner(REQUIRE_HSLK)
 	shared_zone life(new msgpack::zone());
 	HashSpace::Seed* wseed = life->allocate<HashSpace::Seed>(share->whs());
 	HashSpace::Seed* rseed = life->allocate<HashSpace::Seed>(share->rhs());
+	HashSpace::Seed* staged = life->allocate<HashSpace::Seed>(
+			net->mod_replace.staged_target(hslk));
 
-	manager::mod_network_t::HashSpaceSync param(*wseed, *rseed, net->clock_incr());
+	manager::mod_network_t::HashSpaceSync param(*wseed, *rseed, net->clock_incr(), *staged);
 	net->get_node(share->partner())->call(
 			param, life,
 			BIND_RESPONSE(mod_network_t, HashSpaceSync), 10);
@@ -118,10 +245,11 @@ RPC_REPLY_IMPL(mod_network_t, HashSpaceSync, from, res, err, z)
 
 namespace {
 	struct each_client_push {
-		each_client_push(HashSpace::Seed* whs, HashSpace::Seed* rhs,
+		each_client_push(HashSpace::Delta* whs, HashSpace::Delta* rhs,
+				ClockTime flush_clocktime,
 				rpc::callback_t cb, shared_zone& l) :
 			life(l),
-			param(*whs, *rhs),
+			param(*whs, *rhs, flush_clocktime.get()),
 			callback(cb) { }
 
 		void operator() (rpc::shared_peer p)
@@ -132,7 +260,7 @@ namespace {
 
 	private:
 		rpc::shared_zone& life;
-		gateway::mod_network_t::HashSpacePush param;
+		gateway::mod_network_t::HashSpaceDeltaPush param;
 		rpc::callback_t callback;
 	};
 }  // noname namespace
@@ -141,12 +269,15 @@ void mod_network_t::push_hash_space_clients(REQUIRE_HSLK)
 try {
 	LOG_DEBUG("push hash space ...");
 
+	remember_hash_space(hslk);
+
 	shared_zone life(new msgpack::zone());
-	HashSpace::Seed* wseed = life->allocate<HashSpace::Seed>(share->whs());
-	HashSpace::Seed* rseed = life->allocate<HashSpace::Seed>(share->rhs());
+	HashSpace::Delta* wdelta = delta_since(m_client_wseed, share->whs(), life.get());
+	HashSpace::Delta* rdelta = delta_since(m_client_rseed, share->rhs(), life.get());
 
-	rpc::callback_t callback( BIND_RESPONSE(mod_network_t, HashSpacePush) );
-	net->subsystem().for_each_peer( each_client_push(wseed, rseed, callback, life) );
+	rpc::callback_t callback( BIND_RESPONSE(mod_network_t, HashSpaceDeltaPush) );
+	net->subsystem().for_each_peer( each_client_push(wdelta, rdelta,
+				share->flush_clocktime(), callback, life) );
 
 	// ignore error
 } catch (std::runtime_error& e) {
@@ -155,10 +286,137 @@ try {
 	LOG_ERROR("HashSpacePush failed: unknown error");
 }
 
+RPC_REPLY_IMPL(mod_network_t, HashSpaceDeltaPush, from, res, err, z)
+{
+	if(!err.is_nil()) {
+		if(err.type == msgpack::type::POSITIVE_INTEGER &&
+				err.via.u64 == (uint64_t)rpc::protocol::PROTOCOL_ERROR &&
+				SESSION_IS_ACTIVE(from)) {
+			// the client doesn't know HashSpaceDeltaPush; send HashSpacePush
+			LOG_DEBUG("HashSpacePush to old client");
+			shared_zone life(new msgpack::zone());
+			HashSpace::Seed* wseed;
+			HashSpace::Seed* rseed;
+			{
+				pthread_scoped_lock hslk(share->hs_mutex());
+				wseed = life->allocate<HashSpace::Seed>(share->whs());
+				rseed = life->allocate<HashSpace::Seed>(share->rhs());
+			}
+
+			gateway::mod_network_t::HashSpacePush param(*wseed, *rseed);
+			from->call(param, life,
+					BIND_RESPONSE(mod_network_t, HashSpacePush), 10);
+		}
+		return;
+	}
+
+	if(res.type != msgpack::type::BOOLEAN || res.via.boolean) {
+		return;
+	}
+
+	// the client doesn't have the base version; send whole hash space
+	LOG_DEBUG("full HashSpaceDeltaPush");
+	shared_zone life(new msgpack::zone());
+	HashSpace::Delta* wdelta;
+	HashSpace::Delta* rdelta;
+	ClockTime flush_clocktime;
+	{
+		pthread_scoped_lock hslk(share->hs_mutex());
+		wdelta = life->allocate<HashSpace::Delta>(HashSpace::Seed(share->whs()));
+		rdelta = life->allocate<HashSpace::Delta>(HashSpace::Seed(share->rhs()));
+		flush_clocktime = share->flush_clocktime();
+	}
+
+	gateway::mod_network_t::HashSpaceDeltaPush param(*wdelta, *rdelta,
+			flush_clocktime.get());
+	from->call(param, life,
+			BIND_RESPONSE(mod_network_t, HashSpacePush), 10);
+}
+
 RPC_REPLY_IMPL(mod_network_t, HashSpacePush, from, res, err, z)
 { }
 
 
+void mod_network_t::update_flush_clocktime(ClockTime flush_clocktime)
+{
+	pthread_scoped_lock hslk(share->hs_mutex());
+	if(share->flush_clocktime() < flush_clocktime) {
+		LOG_INFO("flush clocktime is updated to ",flush_clocktime.get());
+		share->flush_clocktime() = flush_clocktime;
+		push_hash_space_clients(hslk);
+		// the servers and the partner receive it with next KeepAlive
+	}
+}
+
+
+namespace {
+	struct collect_nodes {
+		collect_nodes(std::vector<shared_node>* nodes) : m_nodes(nodes) { }
+		void operator() (shared_node& n)
+		{
+			m_nodes->push_back(n);
+		}
+	private:
+		std::vector<shared_node>* m_nodes;
+	};
+}  // noname namespace
+
+RPC_IMPL(mod_network_t, FlushAll, req, z, response)
+{
+	ClockTime ct = net->clock_incr_clocktime();
+	LOG_INFO("flush all at ",ct.get());
+
+	{
+		pthread_scoped_lock hslk(share->hs_mutex());
+		if(share->flush_clocktime() < ct) {
+			share->flush_clocktime() = ct;
+		}
+		push_hash_space_clients(hslk);
+	}
+
+	std::vector<shared_node> nodes;
+	net->for_each_node(ROLE_SERVER, collect_nodes(&nodes));
+	if(share->partner().connectable()) {
+		nodes.push_back(net->get_node(share->partner()));
+	}
+
+	// reply after all servers know the flush clocktime
+	// so that following requests never see the flushed values.
+	SHARED_ZONE(life, z);
+	volatile unsigned int* remain =
+		(volatile unsigned int*)life->malloc(sizeof(volatile unsigned int));
+	*remain = nodes.size() + 1;
+
+	server::mod_network_t::KeepAlive param(net->clock_incr(), ct.get());
+
+	rpc::callback_t callback( BIND_RESPONSE(mod_network_t, FlushKeepAlive,
+				remain, response, ct) );
+
+	for(std::vector<shared_node>::iterator it(nodes.begin()),
+			it_end(nodes.end()); it != it_end; ++it) {
+		(*it)->call(param, life, callback, 10);
+	}
+
+	if(__sync_sub_and_fetch(remain, 1) == 0) {
+		response.result(ct);
+	}
+}
+
+RPC_REPLY_IMPL(mod_network_t, FlushKeepAlive, from, res, err, z,
+		volatile unsigned int* remain,
+		rpc::weak_responder response, ClockTime flush_clocktime)
+{
+	if(!err.is_nil()) {
+		// the server receives it with next KeepAlive
+		LOG_WARN("FlushAll KeepAlive failed: ",err);
+	}
+
+	if(__sync_sub_and_fetch(remain, 1) == 0) {
+		response.result(flush_clocktime);
+	}
+}
+
+
 
 RPC_IMPL(mod_network_t, HashSpaceSync, req, z, response)
 {
@@ -176,6 +434,7 @@ RPC_IMPL(mod_network_t, HashSpaceSync, req, z, response)
 	if(!req.param().wseed.empty() && (share->whs().empty() ||
 			share->whs().clocktime() <= ClockTime(req.param().wseed.clocktime()))) {
 		share->whs() = HashSpace(req.param().wseed);
+		net->mod_replace.sync_staged_target(hslk, req.param().staged_target);
 		ret = true;
 	}
 
@@ -210,7 +469,13 @@ void mod_network_t::keep_alive()
 {
 	LOG_TRACE("keep alive ...");
 	shared_zone nullz;
-	server::mod_network_t::KeepAlive param(net->clock_incr());
+	ClockTime flush_clocktime;
+	{
+		pthread_scoped_lock hslk(share->hs_mutex());
+		flush_clocktime = share->flush_clocktime();
+	}
+	server::mod_network_t::KeepAlive param(net->clock_incr(),
+			flush_clocktime.get());
 
 	rpc::callback_t callback( BIND_RESPONSE(mod_network_t, KeepAlive) );
 
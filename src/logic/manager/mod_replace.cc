@@ -18,13 +18,15 @@
 #include "manager/framework.h"
 #include "manager/mod_replace.h"
 #include "server/mod_replace.h"
+#include <limits>
 
 namespace kumo {
 namespace manager {
 
 
 mod_replace_t::mod_replace_t() :
-	m_delayed_replace_cas(0)
+	m_delayed_replace_cas(0),
+	m_staging(false)
 { }
 
 mod_replace_t::~mod_replace_t() { }
@@ -41,7 +43,7 @@ void mod_replace_t::add_server(const address& addr, shared_node& s)
 	pthread_scoped_lock hslk(share->hs_mutex());
 	pthread_scoped_lock nslk(share->new_servers_mutex());
 
-	if(!share->whs().server_is_active(addr)) {
+	if(!target_hs(hslk).server_is_active(addr)) {
 		change = true;
 		share->new_servers().push_back( weak_node(s) );
 	}
@@ -68,6 +70,9 @@ void mod_replace_t::remove_server(const address& addr)
 
 	bool wfault = share->whs().fault_server(ct, addr);
 	bool rfault = share->rhs().fault_server(ct, addr);
+	if(m_staging) {
+		m_staged_target.fault_server(ct, addr);
+	}
 
 	if(wfault || rfault) {
 		net->mod_network.sync_hash_space_partner(hslk);
@@ -166,12 +171,12 @@ void mod_replace_t::attach_new_servers(REQUIRE_HSLK)
 			it_end(share->new_servers().end()); it != it_end; ++it) {
 		shared_node srv(it->lock());
 		if(srv) {
-			if(share->whs().server_is_include(srv->addr())) {
+			if(target_hs(hslk).server_is_include(srv->addr())) {
 				LOG_INFO("recover server: ",srv->addr());
-				share->whs().recover_server(ct, srv->addr());
+				target_hs(hslk).recover_server(ct, srv->addr());
 			} else {
 				LOG_INFO("new server: ",srv->addr());
-				share->whs().add_server(ct, srv->addr());
+				target_hs(hslk).add_server(ct, srv->addr());
 			}
 		}
 	}
@@ -188,7 +193,7 @@ void mod_replace_t::detach_fault_servers(REQUIRE_HSLK)
 {
 	ClockTime ct = net->clock_incr_clocktime();
 
-	share->whs().remove_fault_servers(ct);
+	target_hs(hslk).remove_fault_servers(ct);
 
 	net->mod_network.sync_hash_space_partner(hslk);
 	//net->mod_network.sync_hash_space_servers(hslk);
@@ -249,8 +254,127 @@ namespace {
 	};
 }  // noname namespace
 
+HashSpace& mod_replace_t::target_hs(REQUIRE_HSLK)
+{
+	return m_staging ? m_staged_target : share->whs();
+}
+
+HashSpace::Seed mod_replace_t::staged_target(REQUIRE_HSLK)
+{
+	if(!m_staging) { return HashSpace::Seed(); }
+	return HashSpace::Seed(m_staged_target);
+}
+
+void mod_replace_t::sync_staged_target(REQUIRE_HSLK, const HashSpace::Seed& target)
+{
+	if(target.empty()) {
+		m_staging = false;
+	} else {
+		m_staged_target = HashSpace(target);
+		m_staging = true;
+	}
+}
+
+namespace {
+	// moves the nodes of base toward target by at most max_changes servers
+	HashSpace next_wave_of(const HashSpace& base, HashSpace& target,
+			unsigned int max_changes, ClockTime ct)
+	{
+		HashSpace next(base);
+		unsigned int changes = 0;
+
+		std::vector<address> removed;
+		base.nodes_diff(target, removed);
+		for(std::vector<address>::iterator it(removed.begin()),
+				it_end(removed.end()); it != it_end && changes < max_changes; ++it) {
+			next.remove_server(ct, *it);
+			++changes;
+		}
+
+		HashSpace::Seed seed(target);
+		for(std::vector<HashSpace::node>::const_iterator it(seed.nodes().begin()),
+				it_end(seed.nodes().end()); it != it_end && changes < max_changes; ++it) {
+			if(!next.server_is_include(it->addr())) {
+				next.add_server(ct, it->addr());
+				if(!it->is_active()) {
+					next.fault_server(ct, it->addr());
+				}
+			} else if(next.server_is_active(it->addr()) && !it->is_active()) {
+				next.fault_server(ct, it->addr());
+			} else if(!next.server_is_active(it->addr()) && it->is_active()) {
+				next.recover_server(ct, it->addr());
+			} else {
+				continue;
+			}
+			++changes;
+		}
+
+		if(changes < max_changes &&
+				next.replication_factor() != target.replication_factor()) {
+			next.set_replication_factor(ct, target.replication_factor());
+		}
+
+		return next;
+	}
+}  // noname namespace
+
+bool mod_replace_t::stage_replace(REQUIRE_HSLK, bool full)
+{
+	unsigned int wave = share->cfg_replace_wave();
+
+	if(!m_staging) {
+		if(full || wave == 0 || share->whs() == share->rhs()) {
+			return true;  // replace at once
+		}
+		m_staged_target = share->whs();
+		m_staging = true;
+
+	} else if(full || wave == 0) {
+		wave = std::numeric_limits<unsigned int>::max();
+
+	} else {
+		pthread_scoped_lock relk(m_replace_mutex);
+		if(m_copying.clocktime() != ClockTime(0) ||
+				m_deleting.clocktime() != ClockTime(0)) {
+			LOG_INFO("staged replace: wait for current wave");
+			return false;
+		}
+	}
+
+	ClockTime ct = net->clock_incr_clocktime();
+	HashSpace next(next_wave_of(share->rhs(), m_staged_target, wave, ct));
+
+	if(next == share->rhs()) {
+		LOG_INFO("staged replace finished");
+		m_staging = false;
+		net->mod_network.sync_hash_space_partner(hslk);
+		return full;
+	}
+
+	if(next == m_staged_target) {
+		LOG_INFO("staged replace: last wave");
+		m_staging = false;
+	} else {
+		LOG_INFO("staged replace: next wave");
+	}
+
+	share->whs() = next;
+	net->mod_network.sync_hash_space_partner(hslk);
+	return true;
+}
+
+void mod_replace_t::start_next_wave()
+{
+	pthread_scoped_lock hslk(share->hs_mutex());
+	if(m_staging) {
+		start_replace(hslk);
+	}
+}
+
 void mod_replace_t::start_replace(REQUIRE_HSLK, bool full)
 {
+	if(!stage_replace(hslk, full)) { return; }
+
 	LOG_INFO("start replace copy; full=",full);
 	pthread_scoped_lock relk(m_replace_mutex);
 
@@ -400,6 +524,11 @@ inline void mod_replace_t::finish_replace(REQUIRE_RELK)
 {
 	LOG_INFO("replace finished time(",m_deleting.clocktime().get(),")");
 	m_deleting.invalidate();
+
+	if(m_staging) {
+		net->do_after(1*framework::DO_AFTER_BY_SECONDS,
+				mp::bind(&mod_replace_t::start_next_wave, this));
+	}
 }
 
 
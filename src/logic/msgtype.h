@@ -28,6 +28,7 @@ namespace msgtype {
 using namespace msgpack::type;
 using msgpack::type_error;
 typedef HashSpace::Seed HSSeed;
+typedef HashSpace::Delta HSDelta;
 
 
 struct DBKey {
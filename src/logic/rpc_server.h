@@ -51,10 +51,6 @@ public:
 
 	~rpc_server() { }
 
-	// precision of the timer thread
-	static const unsigned long TIMER_PRECISION_USEC = 500 * 1000;  // 0.5 sec.
-	static const unsigned long DO_AFTER_BY_SECONDS = 1000*1000 / TIMER_PRECISION_USEC;
-
 protected:
 	void start_keepalive(unsigned long interval)
 	{
@@ -66,8 +62,10 @@ protected:
 
 protected:
 	// call Framework::step_timeout() every `interval_usec' microseconds.
+	// RPC callbacks time out after (timeout_steps+1) * `interval_usec'.
 	void start_timeout_step(unsigned long interval_usec)
 	{
+		rpc::basic_session::set_timeout_step(interval_usec);
 		m_timer_interval_steps = interval_usec / TIMER_PRECISION_USEC;
 		m_timer_remain_steps = m_timer_interval_steps;
 		struct timespec ts = {TIMER_PRECISION_USEC / 1000000, TIMER_PRECISION_USEC % 1000000 * 1000};
@@ -87,8 +85,6 @@ protected:
 		} else {
 			--m_timer_remain_steps;
 		}
-
-		static_cast<Framework*>(this)->step_do_after();
 	}
 
 	unsigned long m_timer_remain_steps;
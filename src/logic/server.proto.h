@@ -20,6 +20,7 @@
 #include "logic/cluster_logic.h"
 #include <msgpack.hpp>
 #include <string>
+#include <map>
 #include <stdint.h>
 
 namespace kumo {
@@ -28,6 +29,7 @@ namespace server {
 
 @message mod_network_t::KeepAlive           =   0
 @message mod_network_t::HashSpaceSync       =   2
+@message mod_network_t::HashSpaceDeltaSync  =   3
 @message mod_replace_t::ReplaceCopyStart    =   8
 @message mod_replace_t::ReplaceDeleteStart  =   9
 @message mod_replace_stream_t::ReplaceOffer =  16
@@ -37,6 +39,9 @@ namespace server {
 @message mod_store_t::Set                   =  35
 @message mod_store_t::Delete                =  36
 @message mod_store_t::GetIfModified         =  37
+@message mod_store_t::GetMulti              =  38
+@message mod_store_t::GetLease              =  39
+@message mod_store_t::Incr                  =  40
 @message mod_control_t::CreateBackup        =  96
 @message mod_control_t::GetStatus           =  97
 @message mod_control_t::SetConfig           =  98
@@ -45,6 +50,7 @@ namespace server {
 @rpc mod_network_t
 	message KeepAlive +cluster {
 		Clock adjust_clock;
+		uint64_t flush_clocktime = 0;
 		// ok: UNDEFINED
 	};
 
@@ -56,6 +62,14 @@ namespace server {
 		// obsolete: nil
 	};
 
+	message HashSpaceDeltaSync {
+		msgtype::HSDelta wdelta;
+		msgtype::HSDelta rdelta;
+		Clock adjust_clock;
+		// success: true
+		// obsolete: nil
+	};
+
 public:
 	void keep_alive();
 	void renew_w_hash_space();
@@ -75,6 +89,8 @@ static const set_op_t OP_SET_ASYNC = 0x01;
 static const set_op_t OP_CAS       = 0x02;
 static const set_op_t OP_APPEND    = 0x04;
 static const set_op_t OP_PREPEND   = 0x08;
+static const set_op_t OP_ADD       = 0x10;
+static const set_op_t OP_REPLACE   = 0x20;
 
 struct store_flags;
 typedef msgtype::flags<store_flags, 0>    store_flags_none;
@@ -96,35 +112,79 @@ struct replicate_flags : msgtype::flags_base {
 @rpc mod_store_t
 	message Get {
 		msgtype::DBKey dbkey;
+		uint64_t deadline = 0;
 		// success: value:DBValue
 		// not found: nil
+		// deadline is wall clock time in msec. the request is dropped
+		// with TIMEOUT_ERROR after it. 0 means no deadline.
 	};
 
 	message GetIfModified {
 		msgtype::DBKey dbkey;
 		ClockTime if_time;
+		uint64_t deadline = 0;
 		// success: value:DBValue
 		// not-modified: true  // FIXME ClockTime?
 		// not found: nil
 	};
 
+	message GetMulti {
+		std::vector<msgtype::DBKey> dbkeys;
+		uint64_t deadline = 0;
+		// success: array of value:DBValue, nil if not found or
+		//          false if the key is not assigned to the server
+	};
+
+	message GetLease {
+		msgtype::DBKey dbkey;
+		ClockTime if_time;
+		uint64_t deadline = 0;
+		// success: [value:DBValue, lease:uint32]
+		// not-modified: [true, lease:uint32]
+		// not found: [nil, 0]
+		// the value is valid in the gateway for lease msec.
+		// the lease is 0 if it is not granted
+	};
+
 	message Set {
 		set_op_t operation;
 		msgtype::DBKey dbkey;
 		msgtype::DBValue dbval;
+		uint64_t deadline = 0;
 		// success: clocktime:ClockTime
 		// failed:  nil
-		// cas is tried and failed: false
+		// cas, add or replace is tried and failed: false
 	};
 
 	message Delete {
 		store_flags flags;
 		msgtype::DBKey dbkey;
+		uint64_t deadline = 0;
 		// success: true
 		// not foud: false
 		// failed: nil
 	};
 
+	message Incr {
+		msgtype::DBKey dbkey;
+		uint64_t delta;
+		bool decrement;
+		uint16_t offset;
+		msgtype::raw_ref initial;
+		uint64_t deadline = 0;
+		// success: [value:uint64, clocktime:ClockTime]
+		// not found: false
+		// not a number: true
+		// not applied: nil
+		// the value is replied once it is stored on this node,
+		// even if its replication fails. Incr is not idempotent
+		// and it is retried only if it is not applied.
+		// the counter is decimal digits after offset bytes of the value.
+		// decrement stops at 0 and increment wraps at 2^64.
+		// initial is stored as the value if the key is not found
+		// and it is not empty.
+	};
+
 	message ReplicateSet {
 		Clock adjust_clock;
 		replicate_flags flags;
@@ -132,6 +192,8 @@ struct replicate_flags : msgtype::flags_base {
 		msgtype::DBValue dbval;
 		// success: true
 		// ignored: false
+		// replication is not bounded by the deadline of the request
+		// because the value is already stored by the coordinator
 	};
 
 	message ReplicateDelete {
@@ -143,6 +205,28 @@ struct replicate_flags : msgtype::flags_base {
 		// ignored: false
 	};
 
+public:
+	mod_store_t();
+	~mod_store_t();
+
+public:
+	// leases of the caches in gateways
+	void expire_leases();
+
+private:
+	uint32_t grant_lease(uint64_t h, rpc::basic_shared_session& s);
+	void invalidate_leases(uint64_t h);
+	RPC_REPLY_DECL(LeaseInvalidate, from, res, err, z);
+
+	struct lease_holder {
+		rpc::basic_weak_session session;
+		uint64_t expire_usec;
+	};
+
+	mp::pthread_mutex m_leases_mutex;
+	typedef std::multimap<uint64_t, lease_holder> leases_t;
+	leases_t m_leases;
+
 private:
 	static void check_replicator_assign(HashSpace& hs, uint64_t h);
 	static void check_coordinator_assign(HashSpace& hs, uint64_t h);
@@ -151,10 +235,12 @@ private:
 			shared_node* rrepto, unsigned int* rrep_num,
 			shared_node* wrepto, unsigned int* wrep_num);
 
+	// counter is NULL if it is not replicated by Incr
 	RPC_REPLY_DECL(ReplicateSet, from, res, err, z,
 			rpc::retry<ReplicateSet>* retry,
 			volatile unsigned int* copy_required,
-			rpc::weak_responder response, ClockTime clocktime);
+			rpc::weak_responder response, ClockTime clocktime,
+			uint64_t* counter);
 
 	RPC_REPLY_DECL(ReplicateDelete, from, res, err, z,
 			rpc::retry<ReplicateDelete>* retry,
@@ -342,6 +428,7 @@ enum status_type {
 	STAT_RHS			= 9,
 	STAT_WHS			= 10,
 	STAT_REPLACE		= 11,
+	STAT_EXPIRED		= 12,
 };
 
 enum config_type {
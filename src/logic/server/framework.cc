@@ -32,6 +32,7 @@ try {
 	switch(method.get()) {
 	RPC_DISPATCH(mod_network, KeepAlive);
 	RPC_DISPATCH(mod_network, HashSpaceSync);
+	RPC_DISPATCH(mod_network, HashSpaceDeltaSync);
 	RPC_DISPATCH(mod_store,   ReplicateSet);
 	RPC_DISPATCH(mod_store,   ReplicateDelete);
 	RPC_DISPATCH(mod_replace, ReplaceCopyStart);
@@ -52,7 +53,10 @@ try {
 	RPC_DISPATCH(mod_store,   Get);
 	RPC_DISPATCH(mod_store,   Set);
 	RPC_DISPATCH(mod_store,   Delete);
+	RPC_DISPATCH(mod_store,   Incr);
 	RPC_DISPATCH(mod_store,   GetIfModified);
+	RPC_DISPATCH(mod_store,   GetMulti);
+	RPC_DISPATCH(mod_store,   GetLease);
 	RPC_DISPATCH(mod_control, GetStatus);
 	RPC_DISPATCH(mod_control, SetConfig);
 	default:
@@ -28,26 +28,11 @@
 
 #define EACH_ASSIGN(HS, HASH, REAL, CODE) \
 { \
-	HashSpace::iterator _it_(HS.find(HASH)); \
-	HashSpace::iterator _origin_(_it_); \
-	HashSpace::node REAL; \
-	REAL = *_it_; \
-	CODE; \
-	++_it_; \
-	for(; _it_ != _origin_; ++_it_) { \
-		if(*_it_ == *_origin_) { continue; } \
-		HashSpace::node _rep1_ = *_it_; \
-		REAL = _rep1_; \
+	HashSpace::node _assigned_[MAX_REPLICATION_FACTOR]; \
+	unsigned int _nassigned_ = (HS).assigned_nodes(HASH, _assigned_); \
+	for(unsigned int _i_=0; _i_ < _nassigned_; ++_i_) { \
+		HashSpace::node REAL = _assigned_[_i_]; \
 		CODE; \
-		++_it_; \
-		for(; _it_ != _origin_; ++_it_) { \
-			if(*_it_ == *_origin_ || *_it_ == _rep1_) { continue; } \
-			HashSpace::node _rep2_ = *_it_; \
-			REAL = _rep2_; \
-			CODE; \
-			break; \
-		} \
-		break; \
 	} \
 }
 
@@ -81,6 +66,7 @@ public:
 	void keep_alive()
 	{
 		mod_network.keep_alive();
+		mod_store.expire_leases();
 	}
 
 	// override rpc_server<framework>::timer_handler
@@ -133,10 +119,14 @@ private:
 	const unsigned short m_cfg_replicate_delete_retry_num;
 	const unsigned short m_cfg_replace_set_limit_mem;
 
+	const unsigned int m_cfg_lease_time_msec;
+	const size_t m_cfg_lease_limit;
+
 	const time_t m_stat_start_time;  // FIXME m_start_time -> m_stat_start_time
 	volatile uint64_t m_stat_num_get;
 	volatile uint64_t m_stat_num_set;
 	volatile uint64_t m_stat_num_delete;
+	volatile uint64_t m_stat_num_expired;
 
 public:
 	RESOURCE_ACCESSOR(mp::pthread_rwlock, rhs_mutex);
@@ -155,12 +145,16 @@ public:
 	RESOURCE_CONST_ACCESSOR(unsigned short, cfg_replicate_delete_retry_num);
 	RESOURCE_CONST_ACCESSOR(unsigned short, cfg_replace_set_limit_mem);
 
+	RESOURCE_CONST_ACCESSOR(unsigned int, cfg_lease_time_msec);
+	RESOURCE_CONST_ACCESSOR(size_t, cfg_lease_limit);
+
 	RESOURCE_CONST_ACCESSOR(time_t, stat_start_time);
 
 	// FIXME incr_stat_num_{get,set,delete} + const accessor
 	RESOURCE_ACCESSOR(volatile uint64_t, stat_num_get);
 	RESOURCE_ACCESSOR(volatile uint64_t, stat_num_set);
 	RESOURCE_ACCESSOR(volatile uint64_t, stat_num_delete);
+	RESOURCE_ACCESSOR(volatile uint64_t, stat_num_expired);
 
 private:
 	resource();
@@ -64,11 +64,14 @@ resource::resource(const Config& cfg) :
 	m_cfg_replicate_set_retry_num(cfg.replicate_set_retry_num),
 	m_cfg_replicate_delete_retry_num(cfg.replicate_delete_retry_num),
 	m_cfg_replace_set_limit_mem(cfg.replace_set_limit_mem),
+	m_cfg_lease_time_msec(cfg.lease_time_msec),
+	m_cfg_lease_limit(cfg.lease_limit),
 
 	m_stat_start_time(time(NULL)),
 	m_stat_num_get(0),
 	m_stat_num_set(0),
-	m_stat_num_delete(0)
+	m_stat_num_delete(0),
+	m_stat_num_expired(0)
 { }
 
 template <typename Config>
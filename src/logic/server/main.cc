@@ -48,6 +48,9 @@ struct arg_t : cluster_args {
 	unsigned int garbage_max_time_sec;
 	size_t garbage_mem_limit_kb;
 
+	unsigned int lease_time_msec;
+	size_t lease_limit;
+
 	virtual void convert()
 	{
 		cluster_args::convert();
@@ -78,7 +81,9 @@ struct arg_t : cluster_args {
 		replace_set_limit_mem(0),
 		garbage_min_time_sec(60),
 		garbage_max_time_sec(60*60),
-		garbage_mem_limit_kb(2*1024)
+		garbage_mem_limit_kb(2*1024),
+		lease_time_msec(0),
+		lease_limit(1024*1024)
 	{
 		clock_interval = 8.0;
 
@@ -108,6 +113,10 @@ struct arg_t : cluster_args {
 				type::numeric(&garbage_max_time_sec, garbage_max_time_sec));
 		on("-gS", "--garbage-mem-limit",
 				type::numeric(&garbage_mem_limit_kb, garbage_mem_limit_kb));
+		on("-Lt", "--lease-time",
+				type::numeric(&lease_time_msec, lease_time_msec));
+		on("-Ln", "--lease-limit",
+				type::numeric(&lease_limit, lease_limit));
 		parse(argc, argv);
 	}
 
@@ -144,6 +153,10 @@ struct arg_t : cluster_args {
 			"--garbage-max-time       maximum time to maintenance deleted key\n"
 		"  -gS <kilobytes="<<garbage_mem_limit_kb<<">   "
 			"--garbage-mem-limit      maximum memory usage to memory deleted key\n"
+		"  -Lt <msec="<<lease_time_msec<<">          "
+			"--lease-time             lease time of caches in gateways (0: disabled)\n"
+		"  -Ln <number="<<lease_limit<<">  "
+			"--lease-limit            maximum number of leases\n"
 		;
 		cluster_args::show_usage();
 	}
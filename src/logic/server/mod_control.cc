@@ -96,6 +96,10 @@ RPC_IMPL(mod_control_t, GetStatus, req, z, response)
 		response.result(share->stat_num_delete());
 		break;
 
+	case STAT_EXPIRED:
+		response.result(share->stat_num_expired());
+		break;
+
 	case STAT_DB_ITEMS:
 		response.result( share->db().rnum() );
 		break;
@@ -26,6 +26,9 @@ namespace server {
 RPC_IMPL(mod_network_t, KeepAlive, req, z, response)
 {
 	net->clock_update(req.param().adjust_clock);
+	if(share->db().flush(ClockTime(req.param().flush_clocktime))) {
+		LOG_INFO("flushed at ",req.param().flush_clocktime);
+	}
 	response.null();
 }
 
@@ -34,7 +37,8 @@ void mod_network_t::keep_alive()
 {
 	LOG_TRACE("keep alive ...");
 	shared_zone nullz;
-	manager::mod_network_t::KeepAlive param(net->clock_incr());
+	manager::mod_network_t::KeepAlive param(net->clock_incr(),
+			share->db().flush_clocktime().get());
 
 	using namespace mp::placeholders;
 	rpc::callback_t callback( BIND_RESPONSE(mod_network_t, KeepAlive) );
@@ -120,6 +124,67 @@ RPC_IMPL(mod_network_t, HashSpaceSync, req, z, response)
 
 
 
+namespace {
+	// returns false if the base of the delta is unknown
+	bool apply_delta(HashSpace& hs, const HashSpace::Delta& delta, bool* updated)
+	{
+		if(delta.clocktime() < hs.clocktime()) {
+			return true;  // obsolete
+		}
+		if(delta.full()) {
+			HashSpace tmp;
+			tmp.apply(delta);
+			if(!tmp.empty()) {
+				hs = tmp;
+				*updated = true;
+			}
+			return true;
+		}
+		if(delta.clocktime() == hs.clocktime()) {
+			*updated = true;
+			return true;
+		}
+		// apply into a copy not to install an empty ring
+		HashSpace tmp(hs);
+		if(!tmp.apply(delta)) {
+			return false;
+		}
+		if(!tmp.empty()) {
+			hs = tmp;
+			*updated = true;
+		}
+		return true;
+	}
+}  // noname namespace
+
+RPC_IMPL(mod_network_t, HashSpaceDeltaSync, req, z, response)
+{
+	LOG_DEBUG("HashSpaceDeltaSync");
+
+	net->clock_update(req.param().adjust_clock);
+
+	bool ret = false;
+	bool known = true;
+
+	pthread_scoped_wrlock whlk(share->whs_mutex());
+	known = apply_delta(share->whs(), req.param().wdelta, &ret) && known;
+
+	pthread_scoped_wrlock rhlk(share->rhs_mutex());
+	known = apply_delta(share->rhs(), req.param().rdelta, &ret) && known;
+
+	rhlk.unlock();
+	whlk.unlock();
+
+	if(!known) {
+		response.result(false);
+	} else if(ret) {
+		response.result(true);
+	} else {
+		response.null();
+	}
+}
+
+
 // FIXME needed?: renew_w_hash_space, renew_r_hash_space
 // COPY A-1
 void mod_network_t::renew_w_hash_space()
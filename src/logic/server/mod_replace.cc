@@ -149,10 +149,10 @@ struct mod_replace_t::for_each_replace_copy {
 		offer(offer_storage), fault_nodes(faults),
 		replace_time(rtime)
 	{
-		Sa.reserve(NUM_REPLICATION+1);
-		Da.reserve(NUM_REPLICATION+1);
-		current_owners.reserve(NUM_REPLICATION+1);
-		newbies.reserve(NUM_REPLICATION+1);
+		Sa.reserve(MAX_REPLICATION_FACTOR);
+		Da.reserve(MAX_REPLICATION_FACTOR);
+		current_owners.reserve(MAX_REPLICATION_FACTOR);
+		newbies.reserve(MAX_REPLICATION_FACTOR);
 	}
 
 	inline void operator() (Storage::iterator& kv);
@@ -17,6 +17,10 @@
 //
 #include "server/framework.h"
 #include "server/mod_control.h"
+#include "gateway/mod_network.h"
+#include <algorithm>
+#include <string.h>
+#include <sys/time.h>
 
 #define EACH_ASSIGNED_ACTIVE_NODE_EXCLUDE_ONE(EXCLUDE, HS, HASH, NODE, CODE) \
 	EACH_ASSIGN(HS, HASH, _real_, \
@@ -45,6 +49,11 @@ namespace kumo {
 namespace server {
 
 
+mod_store_t::mod_store_t() { }
+
+mod_store_t::~mod_store_t() { }
+
+
 void mod_store_t::check_replicator_assign(HashSpace& hs, uint64_t h)
 {
 	if(hs.empty()) {
@@ -71,6 +80,19 @@ void mod_store_t::check_coordinator_assign(HashSpace& hs, uint64_t h)
 			})
 }
 
+// drops the request if the gateway has given up on it.
+// called before touching the storage.
+static bool drop_expired(uint64_t deadline, rpc::weak_responder& response)
+{
+	if(!deadline_passed(deadline)) {
+		return false;
+	}
+	LOG_DEBUG("request expired before processing");
+	++share->stat_num_expired();
+	response.error((uint8_t)rpc::protocol::TIMEOUT_ERROR);
+	return true;
+}
+
 void mod_store_t::calc_replicators(uint64_t h,
 		shared_node* rrepto, unsigned int* rrep_num,
 		shared_node* wrepto, unsigned int* wrep_num)
@@ -93,7 +115,7 @@ void mod_store_t::calc_replicators(uint64_t h,
 			throw std::runtime_error("server not ready");
 		}
 
-		address wrep_addrs[NUM_REPLICATION+1];
+		address wrep_addrs[MAX_REPLICATION_FACTOR];
 
 		EACH_ASSIGNED_ACTIVE_NODE_EXCLUDE_ONE(net->addr(),
 				share->whs(), h, n, {
@@ -119,6 +141,8 @@ void mod_store_t::calc_replicators(uint64_t h,
 
 RPC_IMPL(mod_store_t, Get, req, z, response)
 {
+	if(drop_expired(req.param().deadline, response)) { return; }
+
 	msgtype::DBKey key(req.param().dbkey);
 	LOG_DEBUG("Get '",
 			/*std::string(key.data(),key.size()),*/"' with hash ",
@@ -148,8 +172,90 @@ RPC_IMPL(mod_store_t, Get, req, z, response)
 }
 
 
+namespace {
+	struct raw_key_less {
+		raw_key_less(const std::vector<msgtype::DBKey>& keys) : m(keys) { }
+		bool operator() (unsigned int x, unsigned int y) const
+		{
+			const msgtype::DBKey& a(m[x]);
+			const msgtype::DBKey& b(m[y]);
+			int r = memcmp(a.raw_data(), b.raw_data(),
+					std::min(a.raw_size(), b.raw_size()));
+			return r < 0 || (r == 0 && a.raw_size() < b.raw_size());
+		}
+	private:
+		const std::vector<msgtype::DBKey>& m;
+	};
+}  // noname namespace
+
+RPC_IMPL(mod_store_t, GetMulti, req, z, response)
+{
+	if(drop_expired(req.param().deadline, response)) { return; }
+
+	const std::vector<msgtype::DBKey>& keys(req.param().dbkeys);
+	const unsigned int num = keys.size();
+	LOG_DEBUG("GetMulti ",num," keys");
+
+	msgpack::object* vals = (msgpack::object*)z->malloc(
+			sizeof(msgpack::object)*num);
+
+	bool* assigned = (bool*)z->malloc(sizeof(bool)*num);
+	{
+		pthread_scoped_rdlock rhlk(share->rhs_mutex());
+		if(share->rhs().empty()) {
+			throw std::runtime_error("server not ready");
+		}
+		for(unsigned int i=0; i < num; ++i) {
+			try {
+				check_replicator_assign(share->rhs(), keys[i].hash());
+				assigned[i] = true;
+			} catch (std::runtime_error& e) {
+				assigned[i] = false;
+			}
+		}
+	}
+
+	// look up in order of the keys: it is the order of the B+ tree storage
+	unsigned int* order = (unsigned int*)z->malloc(sizeof(unsigned int)*num);
+	for(unsigned int i=0; i < num; ++i) { order[i] = i; }
+	std::sort(order, order+num, raw_key_less(keys));
+
+	for(unsigned int n=0; n < num; ++n) {
+		unsigned int i = order[n];
+		if(!assigned[i]) {
+			vals[i].type = msgpack::type::BOOLEAN;
+			vals[i].via.boolean = false;
+			continue;
+		}
+
+		uint32_t raw_vallen;
+		const char* raw_val = share->db().get(
+				keys[i].raw_data(), keys[i].raw_size(),
+				&raw_vallen, z.get());
+
+		if(raw_val) {
+			vals[i].type = msgpack::type::RAW;
+			vals[i].via.raw.ptr  = raw_val;
+			vals[i].via.raw.size = raw_vallen;
+		} else {
+			vals[i].type = msgpack::type::NIL;
+		}
+	}
+
+	msgpack::object res;
+	res.type = msgpack::type::ARRAY;
+	res.via.array.ptr  = vals;
+	res.via.array.size = num;
+	response.result(res, z);
+
+	share->stat_num_get() += num;
+}
+
+
 RPC_IMPL(mod_store_t, GetIfModified, req, z, response)
 {
+	if(drop_expired(req.param().deadline, response)) { return; }
+
 	msgtype::DBKey key(req.param().dbkey);
 	LOG_DEBUG("GetIfModified '",
 			/*std::string(key.data(),key.size()),*/"' with hash ",
@@ -186,11 +292,161 @@ RPC_IMPL(mod_store_t, GetIfModified, req, z, response)
 }
 
 
+namespace {
+static uint64_t now_usec()
+{
+	struct timeval v;
+	gettimeofday(&v, NULL);
+	return (uint64_t)v.tv_sec * 1000 * 1000 + v.tv_usec;
+}
+}  // noname namespace
+
+uint32_t mod_store_t::grant_lease(uint64_t h, rpc::basic_shared_session& s)
+{
+	uint32_t msec = share->cfg_lease_time_msec();
+	if(msec == 0 || !s) { return 0; }
+
+	uint64_t expire = now_usec() + (uint64_t)msec * 1000;
+
+	pthread_scoped_lock lslk(m_leases_mutex);
+	std::pair<leases_t::iterator, leases_t::iterator> range(m_leases.equal_range(h));
+	for(leases_t::iterator it(range.first); it != range.second; ++it) {
+		if(it->second.session.lock() == s) {
+			it->second.expire_usec = expire;
+			return msec;
+		}
+	}
+
+	if(m_leases.size() >= share->cfg_lease_limit()) {
+		return 0;
+	}
+
+	lease_holder lh;
+	lh.session = s;
+	lh.expire_usec = expire;
+	m_leases.insert(leases_t::value_type(h, lh));
+	return msec;
+}
+
+void mod_store_t::invalidate_leases(uint64_t h)
+{
+	if(share->cfg_lease_time_msec() == 0) { return; }
+
+	uint64_t now = now_usec();
+	std::vector<rpc::basic_shared_session> holders;
+	{
+		pthread_scoped_lock lslk(m_leases_mutex);
+		std::pair<leases_t::iterator, leases_t::iterator> range(m_leases.equal_range(h));
+		for(leases_t::iterator it(range.first); it != range.second; ++it) {
+			if(it->second.expire_usec > now) {
+				rpc::basic_shared_session s(it->second.session.lock());
+				if(s) { holders.push_back(s); }
+			}
+		}
+		m_leases.erase(range.first, range.second);
+	}
+
+	if(holders.empty()) { return; }
+	LOG_DEBUG("invalidate ",holders.size()," leases of hash ",h);
+
+	shared_zone life(rpc::new_shared_zone());
+	gateway::mod_network_t::LeaseInvalidate param(h);
+
+	using namespace mp::placeholders;
+	rpc::callback_t callback( BIND_RESPONSE(mod_store_t, LeaseInvalidate) );
+
+	for(std::vector<rpc::basic_shared_session>::iterator it(holders.begin());
+			it != holders.end(); ++it) {
+		(*it)->call(param, life, callback, 10);
+	}
+}
+
+RPC_REPLY_IMPL(mod_store_t, LeaseInvalidate, from, res, err, z)
+{
+	// the lease expires even if the gateway didn't receive it
+	if(!err.is_nil()) {
+		LOG_DEBUG("LeaseInvalidate failed: ",err);
+	}
+}
+
+void mod_store_t::expire_leases()
+{
+	if(share->cfg_lease_time_msec() == 0) { return; }
+
+	uint64_t now = now_usec();
+	pthread_scoped_lock lslk(m_leases_mutex);
+	for(leases_t::iterator it(m_leases.begin()); it != m_leases.end(); ) {
+		if(it->second.expire_usec <= now) {
+			m_leases.erase(it++);
+		} else {
+			++it;
+		}
+	}
+}
+
+
+RPC_IMPL(mod_store_t, GetLease, req, z, response)
+{
+	if(drop_expired(req.param().deadline, response)) { return; }
+
+	msgtype::DBKey key(req.param().dbkey);
+	LOG_DEBUG("GetLease with hash ",key.hash());
+
+	{
+		pthread_scoped_rdlock rhlk(share->rhs_mutex());
+		check_replicator_assign(share->rhs(), key.hash());
+	}
+
+	// grant the lease before reading the value so that
+	// writes after reading invalidate it
+	uint32_t lease = grant_lease(key.hash(), req.session());
+
+	msgpack::object* ret = (msgpack::object*)z->malloc(
+			sizeof(msgpack::object)*2);
+
+	if(req.param().if_time.get() != 0 && share->db().cache_is_valid(
+				key.raw_data(), key.raw_size(),
+				req.param().if_time)) {
+		ret[0].type = msgpack::type::BOOLEAN;
+		ret[0].via.boolean = true;
+
+	} else {
+		uint32_t raw_vallen;
+		const char* raw_val = share->db().get(
+				key.raw_data(), key.raw_size(),
+				&raw_vallen, z.get());
+
+		if(raw_val) {
+			ret[0].type = msgpack::type::RAW;
+			ret[0].via.raw.ptr  = raw_val;
+			ret[0].via.raw.size = raw_vallen;
+		} else {
+			ret[0].type = msgpack::type::NIL;
+			lease = 0;
+		}
+	}
+
+	ret[1].type = msgpack::type::POSITIVE_INTEGER;
+	ret[1].via.u64 = lease;
+
+	msgpack::object res;
+	res.type = msgpack::type::ARRAY;
+	res.via.array.ptr  = ret;
+	res.via.array.size = 2;
+	response.result(res, z);
+
+	++share->stat_num_get();
+}
+
+
 RPC_IMPL(mod_store_t, Set, req, z, response)
 {
+	if(drop_expired(req.param().deadline, response)) { return; }
+
 	set_op_t op = req.param().operation;
 	switch(op) {
 	case OP_SET: case OP_SET_ASYNC: case OP_CAS:
+	case OP_ADD: case OP_REPLACE:
 	//case OP_APPEND: case OP_PREPEND:  // FIXME
 		break;
 	default:
@@ -208,8 +464,8 @@ RPC_IMPL(mod_store_t, Set, req, z, response)
 
 	unsigned int rrep_num;
 	unsigned int wrep_num;
-	shared_node rrepto[NUM_REPLICATION];
-	shared_node wrepto[NUM_REPLICATION];
+	shared_node rrepto[MAX_REPLICATION_FACTOR];
+	shared_node wrepto[MAX_REPLICATION_FACTOR];
 	calc_replicators(key.hash(), rrepto, &rrep_num, wrepto, &wrep_num);
 
 	ClockTime ct(net->clock_incr_clocktime());
@@ -234,6 +490,26 @@ RPC_IMPL(mod_store_t, Set, req, z, response)
 			}
 		} break;
 
+	case OP_ADD: {
+			bool success = share->db().add(
+					key.raw_data(), key.raw_size(),
+					val.raw_data(), val.raw_size());
+			if(!success) {
+				response.result(false);
+				return;
+			}
+		} break;
+
+	case OP_REPLACE: {
+			bool success = share->db().replace(
+					key.raw_data(), key.raw_size(),
+					val.raw_data(), val.raw_size());
+			if(!success) {
+				response.result(false);
+				return;
+			}
+		} break;
+
 	case OP_PREPEND:
 		// FIXME
 		break;
@@ -263,7 +539,7 @@ RPC_IMPL(mod_store_t, Set, req, z, response)
 		rretry->set_callback( BIND_RESPONSE(mod_store_t, ReplicateSet,
 				rretry,
 				pcr,
-				response, ct) );
+				response, ct, (uint64_t*)NULL) );
 
 		for(unsigned int i=0; i < rrep_num; ++i) {
 			rretry->call(rrepto[i], life, 10);
@@ -282,7 +558,7 @@ RPC_IMPL(mod_store_t, Set, req, z, response)
 		wretry->set_callback( BIND_RESPONSE(mod_store_t, ReplicateSet,
 				wretry,
 				pcr,
-				response, ct) );
+				response, ct, (uint64_t*)NULL) );
 
 		for(unsigned int i=0; i < wrep_num; ++i) {
 			wretry->call(wrepto[i], life, 10);
@@ -298,6 +574,8 @@ RPC_IMPL(mod_store_t, Set, req, z, response)
 		} break;
 
 	case OP_CAS:
+	case OP_ADD:
+	case OP_REPLACE:
 	case OP_PREPEND:
 	case OP_APPEND:
 		break;
@@ -306,6 +584,8 @@ RPC_IMPL(mod_store_t, Set, req, z, response)
 		throw std::logic_error("unknown operation");
 	}
 
+	invalidate_leases(key.hash());
+
 	LOG_DEBUG("set copy required: ", wrep_num+rrep_num);
 	if((wrep_num == 0 && rrep_num == 0) || op == OP_SET_ASYNC) {
 		response.result(ct);
@@ -317,6 +597,8 @@ RPC_IMPL(mod_store_t, Set, req, z, response)
 
 RPC_IMPL(mod_store_t, Delete, req, z, response)
 {
+	if(drop_expired(req.param().deadline, response)) { return; }
+
 	msgtype::DBKey key(req.param().dbkey);
 	bool is_async = req.param().flags.is_async();
 	LOG_DEBUG("Delete '",
@@ -325,14 +607,16 @@ RPC_IMPL(mod_store_t, Delete, req, z, response)
 
 	unsigned int rrep_num;
 	unsigned int wrep_num;
-	shared_node rrepto[NUM_REPLICATION];
-	shared_node wrepto[NUM_REPLICATION];
+	shared_node rrepto[MAX_REPLICATION_FACTOR];
+	shared_node wrepto[MAX_REPLICATION_FACTOR];
 	calc_replicators(key.hash(), rrepto, &rrep_num, wrepto, &wrep_num);
 
 	ClockTime ct(net->clock_incr_clocktime());
 
 	bool deleted = share->db().remove(key.raw_data(), key.raw_size(), ct);
-	if(!deleted) {
+	if(deleted) {
+		invalidate_leases(key.hash());
+	} else {
 		if(rrep_num != 0) {
 			//response.result(false);
 			// the key is not stored
@@ -400,11 +684,210 @@ RPC_IMPL(mod_store_t, Delete, req, z, response)
 }
 
 
+namespace {
+static const size_t COUNTER_MAX_DIGITS = 20;  // 18446744073709551615
+
+static bool parse_counter(const char* p, size_t len, uint64_t* result)
+{
+	if(len == 0 || len > COUNTER_MAX_DIGITS) {
+		return false;
+	}
+	uint64_t n = 0;
+	for(const char* const pend = p + len; p != pend; ++p) {
+		if(*p < '0' || '9' < *p) {
+			return false;
+		}
+		uint64_t x = n * 10 + (*p - '0');
+		if(x / 10 != n) {
+			return false;  // overflow
+		}
+		n = x;
+	}
+	*result = n;
+	return true;
+}
+
+static size_t format_counter(uint64_t n, char* buf)
+{
+	char tmp[COUNTER_MAX_DIGITS];
+	size_t len = 0;
+	do {
+		tmp[len++] = '0' + (n % 10);
+		n /= 10;
+	} while(n > 0);
+	for(size_t i=0; i < len; ++i) {
+		buf[i] = tmp[len-1-i];
+	}
+	return len;
+}
+}  // noname namespace
+
+RPC_IMPL(mod_store_t, Incr, req, z, response)
+{
+	if(drop_expired(req.param().deadline, response)) { return; }
+
+	msgtype::DBKey key(req.param().dbkey);
+	uint64_t delta = req.param().delta;
+	bool decrement = req.param().decrement;
+	size_t offset = req.param().offset;
+	const msgtype::raw_ref& initial(req.param().initial);
+	LOG_DEBUG("Incr '",
+			/*std::string(key.data(),key.size()),*/"' with hash ",
+			key.hash()," by ",(decrement ? "-" : "+"),delta);
+
+	unsigned int rrep_num;
+	unsigned int wrep_num;
+	shared_node rrepto[MAX_REPLICATION_FACTOR];
+	shared_node wrepto[MAX_REPLICATION_FACTOR];
+	try {
+		calc_replicators(key.hash(), rrepto, &rrep_num, wrepto, &wrep_num);
+	} catch (std::runtime_error& e) {
+		// not applied; the gateway retries it
+		LOG_DEBUG("Incr is not applied: ",e.what());
+		response.null();
+		return;
+	}
+
+	ClockTime ct;
+
+	SHARED_ZONE(life, z);
+
+	uint64_t* counter = (uint64_t*)life->malloc(sizeof(uint64_t));
+	char* raw_val;
+	uint32_t raw_vallen;
+
+	// compare-and-swap in the update proc of the storage.
+	// retried if the value is updated after it is read.
+	while(true) {
+		uint32_t old_raw_vallen;
+		const char* old_raw_val = share->db().get(
+				key.raw_data(), key.raw_size(),
+				&old_raw_vallen, life.get());
+
+		// taken for each try; the value may be updated by a newer
+		// clocktime since the last try. replicas reject the value
+		// unless its clocktime is newer than the stored one.
+		ct = net->clock_incr_clocktime();
+		if(old_raw_val) {
+			ClockTime old_ct(Storage::clocktime_of(old_raw_val));
+			if(!(old_ct < ct)) {
+				// stored with a clocktime of a node whose clock is ahead
+				net->clock_update(old_ct.clock());
+				ct = ClockTime(old_ct.get() + 1);
+			}
+		}
+
+		if(!old_raw_val) {
+			if(initial.size <= offset ||
+					!parse_counter(initial.ptr + offset,
+						initial.size - offset, counter)) {
+				response.result(false);
+				return;
+			}
+
+			raw_vallen = Storage::VALUE_META_SIZE + initial.size;
+			raw_val = (char*)life->malloc(raw_vallen);
+			Storage::clocktime_to(ct, raw_val);
+			Storage::meta_to(0, raw_val);
+			memcpy(raw_val + Storage::VALUE_META_SIZE, initial.ptr, initial.size);
+
+			if(share->db().add(
+					key.raw_data(), key.raw_size(),
+					raw_val, raw_vallen)) {
+				break;
+			}
+			continue;  // stored by another request
+		}
+
+		size_t head = Storage::VALUE_META_SIZE + offset;
+		uint64_t n;
+		if(old_raw_vallen < head ||
+				!parse_counter(old_raw_val + head,
+					old_raw_vallen - head, &n)) {
+			response.result(true);  // not a number
+			return;
+		}
+
+		if(decrement) {
+			n = (n < delta) ? 0 : n - delta;
+		} else {
+			n += delta;
+		}
+		*counter = n;
+
+		// keeps the meta and the bytes before the counter
+		raw_val = (char*)life->malloc(head + COUNTER_MAX_DIGITS);
+		memcpy(raw_val, old_raw_val, head);
+		Storage::clocktime_to(ct, raw_val);
+		raw_vallen = head + format_counter(n, raw_val + head);
+
+		if(share->db().cas(
+				key.raw_data(), key.raw_size(),
+				raw_val, raw_vallen,
+				Storage::clocktime_of(old_raw_val))) {
+			break;
+		}
+	}
+
+	volatile unsigned int* pcr =
+		(volatile unsigned int*)life->malloc(sizeof(volatile unsigned int));
+	*pcr = wrep_num + rrep_num;
+
+	if(rrep_num != 0) {
+		// rhs Replication
+		rpc::retry<ReplicateSet>* rretry =
+			life->allocate< rpc::retry<ReplicateSet> >(
+					ReplicateSet(
+						ct.clock(), replicate_flags_by_rhs(),  // flags = by rhs
+						msgtype::DBKey(key.raw_data(), key.raw_size()),
+						msgtype::DBValue(raw_val, raw_vallen))
+					);
+		rretry->set_callback( BIND_RESPONSE(mod_store_t, ReplicateSet,
+				rretry,
+				pcr,
+				response, ct, counter) );
+
+		for(unsigned int i=0; i < rrep_num; ++i) {
+			rretry->call(rrepto[i], life, 10);
+		}
+	}
+
+	{	// whs Replication
+		rpc::retry<ReplicateSet>* wretry =
+			life->allocate< rpc::retry<ReplicateSet> >(
+					ReplicateSet(
+						ct.clock(), replicate_flags_none(),  // flags = none
+						msgtype::DBKey(key.raw_data(), key.raw_size()),
+						msgtype::DBValue(raw_val, raw_vallen))
+					);
+
+		wretry->set_callback( BIND_RESPONSE(mod_store_t, ReplicateSet,
+				wretry,
+				pcr,
+				response, ct, counter) );
+
+		for(unsigned int i=0; i < wrep_num; ++i) {
+			wretry->call(wrepto[i], life, 10);
+		}
+	}
+
+	invalidate_leases(key.hash());
+
+	LOG_DEBUG("incr copy required: ", wrep_num+rrep_num);
+	if(wrep_num == 0 && rrep_num == 0) {
+		response.result(msgtype::tuple<uint64_t, ClockTime>(*counter, ct));
+	}
+
+	++share->stat_num_set();
+}
+
+
 
 RPC_REPLY_IMPL(mod_store_t, ReplicateSet, from, res, err, z,
 		rpc::retry<ReplicateSet>* retry,
 		volatile unsigned int* copy_required,
-		rpc::weak_responder response, ClockTime clocktime)
+		rpc::weak_responder response, ClockTime clocktime,
+		uint64_t* counter)
 {
 	LOG_DEBUG("ResReplicateSet ",res,",",err," remain:",*copy_required);
 	// retry if failed
@@ -419,7 +902,12 @@ RPC_REPLY_IMPL(mod_store_t, ReplicateSet, from, res, err, z,
 			}
 		}
 		if(!retry->param().flags.is_rhs()) {  // FIXME ?
-			response.null();
+			if(counter) {
+				// Incr is already applied on this node; don't let it be retried
+				response.result(msgtype::tuple<uint64_t, ClockTime>(*counter, clocktime));
+			} else {
+				response.null();
+			}
 			TLOGPACK("ers",4,
 					"key",msgtype::raw_ref(
 						retry->param().dbkey.data(),
@@ -440,7 +928,11 @@ RPC_REPLY_IMPL(mod_store_t, ReplicateSet, from, res, err, z,
 	LOG_DEBUG("ReplicateSet succeeded");
 
 	if(__sync_sub_and_fetch(copy_required, 1) == 0) {
-		response.result(clocktime);
+		if(counter) {
+			response.result(msgtype::tuple<uint64_t, ClockTime>(*counter, clocktime));
+		} else {
+			response.result(clocktime);
+		}
 	}
 }
 
@@ -506,6 +998,9 @@ RPC_IMPL(mod_store_t, ReplicateSet, req, z, response)
 	bool updated = share->db().update(
 			key.raw_data(), key.raw_size(),
 			val.raw_data(), val.raw_size());
+	if(updated) {
+		invalidate_leases(key.hash());
+	}
 
 	response.result(updated);
 }
@@ -528,6 +1023,9 @@ RPC_IMPL(mod_store_t, ReplicateDelete, req, z, response)
 
 	bool deleted = share->db().remove(key.raw_data(), key.raw_size(),
 			req.param().delete_clocktime);
+	if(deleted) {
+		invalidate_leases(key.hash());
+	}
 
 	response.result(deleted);
 }
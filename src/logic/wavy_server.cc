@@ -29,34 +29,17 @@ wavy_server::wavy_server()
 wavy_server::~wavy_server() { }
 
 
-void wavy_server::do_after(unsigned int steps, mp::function<void ()> func)
-{
-	mp::pthread_scoped_lock dalk(m_do_after_mutex);
-	m_do_after.push_back( do_after_entry(steps, func) );
-}
+namespace {
+	void do_after_real(mp::function<void ()> func)
+	try {
+		func();
+	} catch (...) { }  // FIXME log
+}  // noname namespace
 
-void wavy_server::step_do_after()
+void wavy_server::do_after(unsigned int steps, mp::function<void ()> func)
 {
-	do_after_t fire;
-
-	{
-		mp::pthread_scoped_lock dalk(m_do_after_mutex);
-		for(do_after_t::iterator it(m_do_after.begin()); it != m_do_after.end(); ) {
-			if(it->remain_steps == 0) {
-				fire.splice(fire.end(), m_do_after, it++);
-			} else {
-				--it->remain_steps;
-				++it;
-			}
-		}
-	}
-
-	for(do_after_t::iterator it(fire.begin()); it != fire.end(); ++it) {
-		try {
-			// FIXME wavy::submit?
-			it->func();
-		} catch (...) { }  // FIXME log
-	}
+	wavy::add_timer((unsigned long)steps * TIMER_PRECISION_USEC / 1000,
+			mp::bind(&do_after_real, func));
 }
 
 
@@ -72,7 +55,8 @@ namespace {
 }  // noname namespace
 
 
-void wavy_server::init_wavy(unsigned short rthreads, unsigned short wthreads)
+void wavy_server::init_wavy(unsigned short rthreads, unsigned short wthreads,
+		bool handle_signals)
 {
 	// ignore SIGPIPE
 	if( signal(SIGPIPE, SIG_IGN) == SIG_ERR ) {
@@ -81,15 +65,17 @@ void wavy_server::init_wavy(unsigned short rthreads, unsigned short wthreads)
 	}
 
 	// initialize signal handler before starting threads
-	sigset_t ss;
-	sigemptyset(&ss);
-	sigaddset(&ss, SIGHUP);
-	sigaddset(&ss, SIGINT);
-	sigaddset(&ss, SIGTERM);
-
-	s_pth.reset( new mp::pthread_signal(ss,
-				get_signal_handler(),
-				reinterpret_cast<void*>(this)) );
+	if(handle_signals) {
+		sigset_t ss;
+		sigemptyset(&ss);
+		sigaddset(&ss, SIGHUP);
+		sigaddset(&ss, SIGINT);
+		sigaddset(&ss, SIGTERM);
+
+		s_pth.reset( new mp::pthread_signal(ss,
+					get_signal_handler(),
+					reinterpret_cast<void*>(this)) );
+	}
 
 	wavy::add_core_thread(rthreads);
 	wavy::add_output_thread(wthreads);
@@ -23,7 +23,6 @@
 #include "log/logpacker.h"
 #include <mp/pthread.h>
 #include <mp/functional.h>
-#include <list>
 
 namespace kumo {
 
@@ -36,16 +35,22 @@ public:
 	wavy_server();
 	~wavy_server();
 
+	// precision of the timers
+	static const unsigned long TIMER_PRECISION_USEC = 500 * 1000;  // 0.5 sec.
+	static const unsigned long DO_AFTER_BY_SECONDS = 1000*1000 / TIMER_PRECISION_USEC;
+
+	// call func on a worker thread after `steps' * TIMER_PRECISION_USEC.
 	void do_after(unsigned int steps, mp::function<void ()> func);
 
 protected:
-	// call this function before starting any threads
-	void init_wavy(unsigned short rthreads, unsigned short wthreads);
+	// call this function before starting any threads.
+	// SIGINT and SIGTERM are left to the host program unless handle_signals
+	// is set; embedded clients don't take them over.
+	void init_wavy(unsigned short rthreads, unsigned short wthreads,
+			bool handle_signals = true);
 
 	virtual void end_preprocess() { }
 
-	void step_do_after();
-
 public:
 	virtual void join();
 
@@ -57,17 +62,6 @@ private:
 	unsigned short m_core_threads;
 	unsigned short m_output_threads;
 	std::auto_ptr<mp::pthread_signal> s_pth;
-
-	struct do_after_entry {
-		do_after_entry(unsigned int steps, mp::function<void ()> f) :
-			remain_steps(steps), func(f) { }
-		unsigned int remain_steps;
-		mp::function<void ()> func;
-	};
-
-	mp::pthread_mutex m_do_after_mutex;
-	typedef std::list<do_after_entry> do_after_t;
-	do_after_t m_do_after;
 };
 
 
@@ -24,6 +24,7 @@
 namespace mp {
 	using std::tr1::shared_ptr;
 	using std::tr1::wak_ptr;
+	using std::tr1::enable_shared_from_this;
 	//using std::tr2::scoped_ptr;
 	using std::tr1::static_pointer_cast;
 	using std::tr1::dynamic_pointer_cast;
@@ -32,10 +33,12 @@ namespace mp {
 #ifdef MP_MEMORY_BOOST_ORG
 #include <boost/shared_ptr.hpp>
 #include <boost/weak_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
 //#include <boost/scoped_ptr.hpp>
 namespace mp {
 	using boost::shared_ptr;
 	using boost::weak_ptr;
+	using boost::enable_shared_from_this;
 	//using boost::scoped_ptr;
 	using boost::static_pointer_cast;
 	using boost::dynamic_pointer_cast;
@@ -46,6 +49,7 @@ namespace mp {
 namespace mp {
 	using std::tr1::shared_ptr;
 	using std::tr1::weak_ptr;
+	using std::tr1::enable_shared_from_this;
 	//using std::tr2::scoped_ptr;
 	using std::tr1::static_pointer_cast;
 	using std::tr1::dynamic_pointer_cast;
@@ -55,6 +59,7 @@ namespace mp {
 namespace mp {
 	using std::shared_ptr;
 	using std::weak_ptr;
+	using std::enable_shared_from_this;
 	//using std::scoped_ptr;
 	using std::static_pointer_cast;
 	using std::dynamic_pointer_cast;
@@ -29,6 +29,7 @@
 #include <time.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <stdint.h>
 #include <memory>
 #include <queue>
 
@@ -82,6 +83,24 @@ public:
 	typedef function<void ()> timer_callback_t;
 	void timer(const timespec* interval, timer_callback_t callback);
 
+	// calls the callback once on a worker thread after msec.
+	// timers are kept in a hierarchical timing wheel which ticks
+	// every msec; adding and canceling them are O(1).
+	typedef uint64_t timer_id;
+	timer_id add_timer(unsigned long msec, timer_callback_t callback);
+
+	// returns false if the timer is already expired or canceled.
+	bool cancel_timer(timer_id id);
+
+
+	// stops read events of the fd after read_event() returns.
+	// call it in read_event() of the handler of the fd.
+	void suspend_read(int fd);
+
+	// restarts read events stopped by suspend_read().
+	// it can be called from any thread.
+	void resume_read(int fd);
+
 
 	template <typename Handler>
 	Handler* add(int fd);
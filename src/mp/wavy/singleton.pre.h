@@ -67,6 +67,14 @@ struct singleton {
 	typedef core::timer_callback_t timer_callback_t;
 	static void timer(const timespec* interval, timer_callback_t callback);
 
+	typedef core::timer_id timer_id;
+	static timer_id add_timer(unsigned long msec, timer_callback_t callback);
+	static bool cancel_timer(timer_id id);
+
+
+	static void suspend_read(int fd);
+	static void resume_read(int fd);
+
 
 	template <typename Handler>
 	static Handler* add(int fd);
@@ -183,6 +191,24 @@ inline void singleton<Instance>::timer(
 		const timespec* interval, timer_callback_t callback)
 	{ s_core->timer(interval, callback); }
 
+template <typename Instance>
+inline typename singleton<Instance>::timer_id singleton<Instance>::add_timer(
+		unsigned long msec, timer_callback_t callback)
+	{ return s_core->add_timer(msec, callback); }
+
+template <typename Instance>
+inline bool singleton<Instance>::cancel_timer(timer_id id)
+	{ return s_core->cancel_timer(id); }
+
+
+template <typename Instance>
+inline void singleton<Instance>::suspend_read(int fd)
+	{ s_core->suspend_read(fd); }
+
+template <typename Instance>
+inline void singleton<Instance>::resume_read(int fd)
+	{ s_core->resume_read(fd); }
+
 
 template <typename Instance>
 template <typename Handler>
@@ -31,19 +31,28 @@ namespace mp {
 namespace wavy {
 
 
+// states of read events of the fds
+static const int READ_ACTIVE     = 0;
+static const int READ_SUSPENDING = 1;  // suspend_read() in read_event()
+static const int READ_SUSPENDED  = 2;  // not reactivated after read_event()
+
+
 core::core() : m_impl(new impl()) { }
 
 core::impl::impl() :
 	m_off(0),
 	m_num(0),
 	m_pollable(true),
-	m_end_flag(false)
+	m_end_flag(false),
+	m_timer_wheel(create_timer_wheel()),
+	m_timer_started(0)
 {
 	struct rlimit rbuf;
 	if(::getrlimit(RLIMIT_NOFILE, &rbuf) < 0) {
 		throw system_error(errno, "getrlimit() failed");
 	}
 	m_state = new shared_handler[rbuf.rlim_cur];
+	m_read_state = new volatile int[rbuf.rlim_cur];
 }
 
 
@@ -61,6 +70,8 @@ core::impl::~impl()
 		delete *it;
 	}
 	delete[] m_state;
+	delete[] m_read_state;
+	destroy_timer_wheel(m_timer_wheel);
 }
 
 
@@ -72,6 +83,7 @@ void core::impl::end()
 		pthread_scoped_lock lk(m_mutex);
 		m_cond.broadcast();
 	}
+	wake_timer_wheel(m_timer_wheel);
 }
 
 bool core::is_end() const { return m_impl->is_end(); }
@@ -134,12 +146,40 @@ void core::impl::add_impl(int fd, handler* newh)
 	}
 	m_state[fd].reset(newh);
 	newh->m_shared_self = &m_state[fd];
+	m_read_state[fd] = READ_ACTIVE;
 	m_edge.add_notify(fd, EVEDGE_READ);
 }
 void core::add_impl(int fd, handler* newh)
 	{ m_impl->add_impl(fd, newh); }
 
 
+void core::impl::suspend_read(int fd)
+{
+	m_read_state[fd] = READ_SUSPENDING;
+}
+void core::suspend_read(int fd)
+	{ m_impl->suspend_read(fd); }
+
+void core::impl::resume_read(int fd)
+{
+	while(true) {
+		int state = m_read_state[fd];
+		if(state == READ_ACTIVE) {
+			return;
+		}
+		if(__sync_bool_compare_and_swap(&m_read_state[fd], state, READ_ACTIVE)) {
+			// READ_SUSPENDING: operator() reactivates the fd
+			if(state == READ_SUSPENDED) {
+				m_edge.shot_reactivate(fd, EVEDGE_READ);
+			}
+			return;
+		}
+	}
+}
+void core::resume_read(int fd)
+	{ m_impl->resume_read(fd); }
+
+
 void core::impl::operator() ()
 {
 	retry:
@@ -199,6 +239,12 @@ void core::impl::operator() ()
 			m_edge.shot_remove(fd, EVEDGE_READ);
 			m_state[fd]->m_shared_self = NULL;
 			m_state[fd].reset();
+			m_read_state[fd] = READ_ACTIVE;
+			goto retry;
+		}
+
+		if(__sync_bool_compare_and_swap(&m_read_state[fd],
+					READ_SUSPENDING, READ_SUSPENDED)) {
 			goto retry;
 		}
 
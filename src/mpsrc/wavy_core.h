@@ -46,12 +46,23 @@ public:
 	class listen_handler;
 	void listen(int lsock, listen_callback_t callback);
 
+	class timer_wheel;
+	static timer_wheel* create_timer_wheel();
+	static void destroy_timer_wheel(timer_wheel* w);
+	static void wake_timer_wheel(timer_wheel* w);
 	class timer_thread;
+	void start_timer_wheel(core* c);
+	void timer(core* c, const timespec* interval, timer_callback_t callback);
+	timer_id add_timer(core* c, unsigned long msec, timer_callback_t callback);
+	bool cancel_timer(timer_id id);
 
 public:
 	inline void add_impl(int fd, handler* newh);
 	inline void submit_impl(task_t& f);
 
+	void suspend_read(int fd);
+	void resume_read(int fd);
+
 public:
 	void operator() ();
 
@@ -65,6 +76,9 @@ private:
 	typedef shared_ptr<handler> shared_handler;
 	shared_handler* m_state;
 
+	// READ_ACTIVE, READ_SUSPENDING or READ_SUSPENDED
+	volatile int* m_read_state;
+
 	edge m_edge;
 
 	pthread_mutex m_mutex;
@@ -79,6 +93,10 @@ private:
 	typedef std::vector<pthread_thread*> workers_t;
 	workers_t m_workers;
 
+	// started by the first timer. see wavy_timer.cc
+	timer_wheel* m_timer_wheel;
+	volatile int m_timer_started;
+
 private:
 	impl(const impl&);
 };
@@ -17,12 +17,371 @@
 //
 
 #include "wavy_core.h"
+#include <vector>
 #include <time.h>
 
 namespace mp {
 namespace wavy {
 
 
+// Hierarchical timing wheel.
+// WHEEL_LEVELS wheels of WHEEL_SLOTS slots; a slot of the level n
+// covers WHEEL_SLOTS^n ticks. timers in the higher levels are moved
+// to the lower levels when the lower wheel wraps around, so that
+// only the timers which expire in the current tick are touched.
+static const unsigned int WHEEL_BITS   = 8;
+static const unsigned int WHEEL_SLOTS  = 1 << WHEEL_BITS;
+static const unsigned int WHEEL_MASK   = WHEEL_SLOTS - 1;
+static const unsigned int WHEEL_LEVELS = 4;
+static const uint64_t WHEEL_MAX_TICKS  = ((uint64_t)1 << (WHEEL_BITS*WHEEL_LEVELS)) - 1;
+
+static const uint32_t NIL = 0xffffffff;
+
+static const uint64_t NEVER = 0xffffffffffffffffULL;
+
+static const long TICK_NSEC = 1000 * 1000;  // 1 msec.
+
+
+class core::impl::timer_wheel {
+public:
+	timer_wheel();
+	~timer_wheel();
+
+public:
+	timer_id add(uint64_t ticks, uint64_t period, timer_callback_t& callback);
+	bool cancel(timer_id id);
+
+	// runs on a worker thread till the core ends
+	void run(core* c);
+
+	// wakes up the thread sleeping in run()
+	void wake();
+
+private:
+	struct entry {
+		entry() : generation(1), linked(false) { }
+		uint64_t expire;
+		uint64_t period;  // 0 if it is not periodic
+		timer_callback_t callback;
+		uint32_t generation;
+		bool linked;
+		uint32_t prev;
+		uint32_t next;
+		uint32_t* head;
+	};
+
+	void link(uint32_t i);
+	void unlink(uint32_t i);
+	void release(uint32_t i);
+	void cascade(unsigned int level);
+	void step(std::vector<timer_callback_t>* fired);
+	uint64_t next_tick() const;
+
+	static uint64_t monotonic_msec();
+
+private:
+	pthread_mutex m_mutex;
+	pthread_cond m_cond;  // CLOCK_MONOTONIC
+	uint64_t m_wakeup;    // tick run() sleeps till, 0 if it is not sleeping
+
+	uint64_t m_now;   // next tick to process
+	uint64_t m_base;  // monotonic_msec() at tick 0
+
+	std::vector<entry> m_entries;
+	std::vector<uint32_t> m_free;
+
+	uint32_t m_wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+
+private:
+	timer_wheel(const timer_wheel&);
+};
+
+
+namespace {
+	class monotonic_condattr {
+	public:
+		monotonic_condattr()
+		{
+			pthread_condattr_init(&m_attr);
+			pthread_condattr_setclock(&m_attr, CLOCK_MONOTONIC);
+		}
+		~monotonic_condattr()
+		{
+			pthread_condattr_destroy(&m_attr);
+		}
+		const pthread_condattr_t* get() const { return &m_attr; }
+	private:
+		pthread_condattr_t m_attr;
+	};
+}  // noname namespace
+
+core::impl::timer_wheel::timer_wheel() :
+	m_cond(monotonic_condattr().get()),
+	m_wakeup(0),
+	m_now(0), m_base(monotonic_msec())
+{
+	for(unsigned int l=0; l < WHEEL_LEVELS; ++l) {
+		for(unsigned int s=0; s < WHEEL_SLOTS; ++s) {
+			m_wheel[l][s] = NIL;
+		}
+	}
+}
+
+core::impl::timer_wheel::~timer_wheel() { }
+
+uint64_t core::impl::timer_wheel::monotonic_msec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void core::impl::timer_wheel::link(uint32_t i)
+{
+	entry& e(m_entries[i]);
+
+	if(e.expire < m_now) {
+		e.expire = m_now;
+	} else if(e.expire - m_now > WHEEL_MAX_TICKS) {
+		e.expire = m_now + WHEEL_MAX_TICKS;
+	}
+	uint64_t delta = e.expire - m_now;
+
+	unsigned int level = 0;
+	while(level < WHEEL_LEVELS-1 && delta >= ((uint64_t)1 << (WHEEL_BITS*(level+1)))) {
+		++level;
+	}
+	uint32_t* head = &m_wheel[level][(e.expire >> (WHEEL_BITS*level)) & WHEEL_MASK];
+
+	e.prev = NIL;
+	e.next = *head;
+	if(*head != NIL) {
+		m_entries[*head].prev = i;
+	}
+	*head = i;
+	e.head = head;
+	e.linked = true;
+}
+
+void core::impl::timer_wheel::unlink(uint32_t i)
+{
+	entry& e(m_entries[i]);
+	if(e.prev != NIL) {
+		m_entries[e.prev].next = e.next;
+	} else {
+		*e.head = e.next;
+	}
+	if(e.next != NIL) {
+		m_entries[e.next].prev = e.prev;
+	}
+	e.linked = false;
+}
+
+void core::impl::timer_wheel::release(uint32_t i)
+{
+	entry& e(m_entries[i]);
+	e.callback = timer_callback_t();
+	++e.generation;
+	if(e.generation == 0) { e.generation = 1; }  // 0 is not a valid id
+	m_free.push_back(i);
+}
+
+core::timer_id core::impl::timer_wheel::add(
+		uint64_t ticks, uint64_t period, timer_callback_t& callback)
+{
+	pthread_scoped_lock lk(m_mutex);
+
+	uint32_t i;
+	if(m_free.empty()) {
+		i = m_entries.size();
+		m_entries.push_back(entry());
+	} else {
+		i = m_free.back();
+		m_free.pop_back();
+	}
+
+	// the wheel may lag behind the clock; count from the current time.
+	// +1 tick because the clock is truncated to a tick.
+	uint64_t now = monotonic_msec() - m_base;
+	if(now < m_now) { now = m_now; }
+
+	entry& e(m_entries[i]);
+	e.expire = now + ticks + 1;
+	e.period = period;
+	e.callback = callback;
+	link(i);
+
+	if(e.expire < m_wakeup) {
+		m_cond.signal();
+	}
+
+	return ((uint64_t)e.generation << 32) | i;
+}
+
+bool core::impl::timer_wheel::cancel(timer_id id)
+{
+	uint32_t i = id & 0xffffffff;
+	uint32_t generation = id >> 32;
+
+	pthread_scoped_lock lk(m_mutex);
+	if(i >= m_entries.size()) {
+		return false;
+	}
+	entry& e(m_entries[i]);
+	if(e.generation != generation || !e.linked) {
+		return false;
+	}
+	unlink(i);
+	release(i);
+	return true;
+}
+
+// moves the timers in the current slot of the level to the lower levels
+void core::impl::timer_wheel::cascade(unsigned int level)
+{
+	uint32_t* head = &m_wheel[level][(m_now >> (WHEEL_BITS*level)) & WHEEL_MASK];
+	uint32_t i = *head;
+	*head = NIL;
+	while(i != NIL) {
+		uint32_t next = m_entries[i].next;
+		link(i);
+		i = next;
+	}
+}
+
+void core::impl::timer_wheel::step(std::vector<timer_callback_t>* fired)
+{
+	for(unsigned int level = 1; level < WHEEL_LEVELS; ++level) {
+		if(((m_now >> (WHEEL_BITS*(level-1))) & WHEEL_MASK) != 0) {
+			break;
+		}
+		cascade(level);
+	}
+
+	uint32_t* head = &m_wheel[0][m_now & WHEEL_MASK];
+	uint32_t i = *head;
+	*head = NIL;
+	while(i != NIL) {
+		entry& e(m_entries[i]);
+		uint32_t next = e.next;
+		e.linked = false;
+		fired->push_back(e.callback);
+		if(e.period) {
+			e.expire += e.period;
+			link(i);
+		} else {
+			release(i);
+		}
+		i = next;
+	}
+
+	++m_now;
+}
+
+// returns the tick when the first timer expires or the first slot
+// of the higher levels which has timers is cascaded
+uint64_t core::impl::timer_wheel::next_tick() const
+{
+	if(m_entries.size() == m_free.size()) {
+		return NEVER;
+	}
+
+	uint64_t next = NEVER;
+	for(unsigned int k=0; k < WHEEL_SLOTS; ++k) {
+		if(m_wheel[0][(m_now + k) & WHEEL_MASK] != NIL) {
+			next = m_now + k;
+			break;
+		}
+	}
+
+	for(unsigned int level = 1; level < WHEEL_LEVELS; ++level) {
+		unsigned int shift = WHEEL_BITS*level;
+		uint64_t cur = m_now >> shift;
+		for(unsigned int k=0; k < WHEEL_SLOTS; ++k) {
+			if(m_wheel[level][(cur + k) & WHEEL_MASK] == NIL) {
+				continue;
+			}
+			uint64_t tick = (cur + k) << shift;
+			if(tick < m_now) {
+				tick += (uint64_t)WHEEL_SLOTS << shift;  // next round
+			}
+			if(tick < next) {
+				next = tick;
+			}
+		}
+	}
+
+	return next;
+}
+
+void core::impl::timer_wheel::wake()
+{
+	pthread_scoped_lock lk(m_mutex);
+	m_cond.signal();
+}
+
+void core::impl::timer_wheel::run(core* c)
+{
+	std::vector<timer_callback_t> fired;
+
+	while(true) {
+		{
+			pthread_scoped_lock lk(m_mutex);
+			if(c->is_end()) {
+				break;
+			}
+
+			uint64_t now = monotonic_msec() - m_base;
+			if(m_entries.size() == m_free.size()) {
+				if(m_now <= now) { m_now = now + 1; }  // nothing to step
+			} else {
+				while(m_now <= now) {
+					step(&fired);
+				}
+			}
+
+			if(fired.empty()) {
+				// sleep till the next tick which has something to do,
+				// or till an earlier timer is added
+				m_wakeup = next_tick();
+				if(m_wakeup == NEVER) {
+					m_cond.wait(m_mutex);
+				} else {
+					uint64_t msec = m_base + m_wakeup;
+					struct timespec abstime = {msec / 1000, msec % 1000 * 1000000};
+					m_cond.timedwait(m_mutex, &abstime);
+				}
+				m_wakeup = 0;
+				continue;
+			}
+		}
+
+		for(std::vector<timer_callback_t>::iterator it(fired.begin()),
+				it_end(fired.end()); it != it_end; ++it) {
+			c->submit(*it);
+		}
+		fired.clear();
+	}
+}
+
+
+core::impl::timer_wheel* core::impl::create_timer_wheel()
+{
+	return new timer_wheel();
+}
+
+void core::impl::destroy_timer_wheel(timer_wheel* w)
+{
+	delete w;
+}
+
+void core::impl::wake_timer_wheel(timer_wheel* w)
+{
+	w->wake();
+}
+
+
+// periodic timer shorter than a tick of the wheel
 class core::impl::timer_thread {
 public:
 	timer_thread(core* c,
@@ -46,13 +405,52 @@ private:
 	timer_thread();
 };
 
-void core::timer(const timespec* interval, timer_callback_t callback)
+// the wheel takes one worker thread when the first timer is added
+void core::impl::start_timer_wheel(core* c)
 {
-	add_thread(1);
-	impl::timer_thread t(this, interval, callback);
-	submit(t);
+	if(__sync_bool_compare_and_swap(&m_timer_started, 0, 1)) {
+		c->add_thread(1);
+		c->submit(bind(&timer_wheel::run, m_timer_wheel, c));
+	}
 }
 
+core::timer_id core::impl::add_timer(core* c,
+		unsigned long msec, timer_callback_t callback)
+{
+	start_timer_wheel(c);
+	return m_timer_wheel->add(msec, 0, callback);
+}
+
+bool core::impl::cancel_timer(timer_id id)
+{
+	return m_timer_wheel->cancel(id);
+}
+
+void core::impl::timer(core* c,
+		const timespec* interval, timer_callback_t callback)
+{
+	if(interval->tv_sec == 0 && interval->tv_nsec < TICK_NSEC) {
+		// the wheel can't run it; it takes its own thread
+		c->add_thread(1);
+		c->submit(timer_thread(c, interval, callback));
+		return;
+	}
+
+	uint64_t msec = (uint64_t)interval->tv_sec * 1000 + interval->tv_nsec / 1000000;
+	start_timer_wheel(c);
+	m_timer_wheel->add(msec, msec, callback);
+}
+
+
+void core::timer(const timespec* interval, timer_callback_t callback)
+	{ m_impl->timer(this, interval, callback); }
+
+core::timer_id core::add_timer(unsigned long msec, timer_callback_t callback)
+	{ return m_impl->add_timer(this, msec, callback); }
+
+bool core::cancel_timer(timer_id id)
+	{ return m_impl->cancel_timer(id); }
+
 
 }  // namespace wavy
 }  // namespace mp
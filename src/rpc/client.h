@@ -36,8 +36,11 @@ public:
 	typedef mp::function<void (shared_session, msgobj, msgobj, shared_zone)> callback_t;
 
 public:
+	// connections_per_peer connections are opened to each address
+	// and requests are sent through the least loaded one.
 	client_tmpl(unsigned int connect_timeout_msec,
-			unsigned short connect_retry_limit);
+			unsigned short connect_retry_limit,
+			unsigned short connections_per_peer = 1);
 
 	virtual ~client_tmpl();
 
@@ -48,12 +51,19 @@ public:
 		transport_lost(s);
 	}
 
+	// number of connections opened to the address
+	virtual unsigned short connections_per_peer(const address& addr)
+	{
+		return m_connections_per_peer;
+	}
+
 	virtual void dispatch(
 			shared_session from, weak_responder response,
 			method_id method, msgobj param, auto_zone z) = 0;
 
 public:
-	// step callback timeout count
+	// remove lost sessions.
+	// callbacks are timed out by the timer of the wavy core.
 	void step_timeout();
 
 	// get/create RPC stub instance for the address.
@@ -74,11 +84,21 @@ public:
 	template <typename F>
 	void for_each_session(F f);
 
+	// apply function to all connected sessions with their addresses.
+	// F is required to implement
+	// void operator() (const address&, shared_session);
+	template <typename F>
+	void for_each_peer_session(F f);
+
 protected:
 	// connect session to the address and return true if
 	// it is not bound.
 	bool async_connect(const address& addr, shared_session& s);
 
+	// open connections to the address till the bound session has
+	// m_connections_per_peer connections.
+	void fill_pool(const address& addr, shared_session& s);
+
 private:
 	template <bool CONNECT>
 	shared_session get_session_impl(const address& addr);
@@ -95,10 +115,12 @@ private:
 	};
 
 	void connect_callback(address addr, shared_session s, int fd, int err);
+	void pool_connect_callback(address addr, shared_session s, int fd, int err);
 
 protected:
 	unsigned int m_connect_timeout_msec;
 	unsigned short m_connect_retry_limit;
+	unsigned short m_connections_per_peer;
 
 public:
 	virtual void dispatch_request(
@@ -29,9 +29,11 @@ namespace rpc {
 template <typename Transport, typename Session>
 client_tmpl<Transport, Session>::client_tmpl(
 		unsigned int connect_timeout_msec,
-		unsigned short connect_retry_limit) :
+		unsigned short connect_retry_limit,
+		unsigned short connections_per_peer) :
 	m_connect_timeout_msec(connect_timeout_msec),
-	m_connect_retry_limit(connect_retry_limit)
+	m_connect_retry_limit(connect_retry_limit),
+	m_connections_per_peer(connections_per_peer)
 { }
 
 template <typename Transport, typename Session>
@@ -53,7 +55,13 @@ client_tmpl<Transport, Session>::get_session_impl(const address& addr)
 
 		while(pair.first != pair.second) {
 			s = pair.first->second.lock();
-			if(s && !s->is_lost()) { return s; }
+			if(s && !s->is_lost()) {
+				// reopen pooled connections closed by the peer
+				if(CONNECT && m_connections_per_peer > 1) {
+					fill_pool(addr, s);
+				}
+				return s;
+			}
 			++pair.first;
 			//m_sessions.erase(pair.first++);
 		}
@@ -147,6 +155,49 @@ void client_tmpl<Transport, Session>::for_each_session(F f)
 
 
 
+namespace detail {
+	template <typename Session, typename F>
+	struct client_tmpl_each_peer_session {
+		client_tmpl_each_peer_session(F f) : m(f) { }
+		inline void operator() (std::pair<const address, mp::weak_ptr<Session> >& x)
+		{
+			mp::shared_ptr<Session> s(x.second.lock());
+			if(s && !s->is_lost()) {
+				m(x.first, s);
+			}
+		}
+	private:
+		F m;
+		client_tmpl_each_peer_session();
+	};
+}  // namespace detail
+
+template <typename Transport, typename Session>
+template <typename F>
+void client_tmpl<Transport, Session>::for_each_peer_session(F f)
+{
+	pthread_scoped_rdlock rdlk(m_sessions_rwlock);
+	detail::client_tmpl_each_peer_session<Session, F> e(f);
+	std::for_each(m_sessions.begin(), m_sessions.end(), e);
+}
+
+
+
+namespace detail {
+	inline void client_tmpl_set_sockopt(int fd)
+	{
+#ifndef NO_TCP_NODELAY
+		// XXX
+		int on = 1;
+		::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));  // ignore error
+#endif
+#ifndef NO_SO_LINGER
+		struct linger opt = {0, 0};
+		::setsockopt(fd, SOL_SOCKET, SO_LINGER, (void *)&opt, sizeof(opt));  // ignore error
+#endif
+	}
+}  // namespace detail
+
 template <typename Transport, typename Session>
 bool client_tmpl<Transport, Session>::async_connect(
 		const address& addr, shared_session& s)
@@ -175,15 +226,7 @@ void client_tmpl<Transport, Session>::connect_callback(
 		address addr, shared_session s, int fd, int err)
 {
 	if(fd >= 0) {
-#ifndef NO_TCP_NODELAY
-		// XXX
-		int on = 1;
-		::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));  // ignore error
-#endif
-#ifndef NO_SO_LINGER
-		struct linger opt = {0, 0};
-		::setsockopt(fd, SOL_SOCKET, SO_LINGER, (void *)&opt, sizeof(opt));  // ignore error
-#endif
+		detail::client_tmpl_set_sockopt(fd);
 		LOG_INFO("connect success ",addr," fd(",fd,")");
 		try {
 			basic_shared_session bs(mp::static_pointer_cast<basic_session>(s));
@@ -192,6 +235,9 @@ void client_tmpl<Transport, Session>::connect_callback(
 			::close(fd);
 			throw;
 		}
+		if(m_connections_per_peer > 1) {
+			fill_pool(addr, s);
+		}
 		return;
 	}
 
@@ -208,6 +254,56 @@ void client_tmpl<Transport, Session>::connect_callback(
 }
 
 
+template <typename Transport, typename Session>
+void client_tmpl<Transport, Session>::fill_pool(
+		const address& addr, shared_session& s)
+{
+	unsigned short pool_size = connections_per_peer(addr);
+	while(s->begin_pool_connect(pool_size)) {
+		LOG_TRACE("connecting pooled connection to ",addr);
+		char addrbuf[addr.addrlen()];
+		addr.getaddr((sockaddr*)&addrbuf);
+
+		using namespace mp::placeholders;
+		try {
+			wavy::connect(PF_INET, SOCK_STREAM, 0,
+					(sockaddr*)addrbuf, sizeof(addrbuf),
+					m_connect_timeout_msec,
+					mp::bind(
+						&client_tmpl<Transport, Session>::pool_connect_callback,
+						this, addr, s, _1, _2));
+		} catch (...) {
+			s->end_pool_connect();
+			throw;
+		}
+	}
+}
+
+template <typename Transport, typename Session>
+void client_tmpl<Transport, Session>::pool_connect_callback(
+		address addr, shared_session s, int fd, int err)
+{
+	if(fd < 0) {
+		// retried by the next get_session()
+		LOG_INFO("pooled connect failed ",addr,": ",strerror(err));
+		s->end_pool_connect(true);
+		return;
+	}
+
+	detail::client_tmpl_set_sockopt(fd);
+	LOG_INFO("pooled connect success ",addr," fd(",fd,")");
+	try {
+		basic_shared_session bs(mp::static_pointer_cast<basic_session>(s));
+		wavy::add<Transport>(fd, bs, this);
+	} catch (...) {
+		::close(fd);
+		s->end_pool_connect(true);
+		throw;
+	}
+	s->end_pool_connect();
+}
+
+
 template <typename Transport, typename Session>
 void client_tmpl<Transport, Session>::transport_lost(shared_session& s)
 {
@@ -242,9 +338,6 @@ void client_tmpl<Transport, Session>::step_timeout()
 			it_end(m_sessions.end()); it != it_end; ) {
 		shared_session s(it->second.lock());
 		if(s && !s->is_lost()) {
-			wavy::submit(&basic_session::step_timeout,
-					s,
-					mp::static_pointer_cast<Session>(s));
 			++it;
 		} else {
 			m_sessions.erase(it++);
@@ -140,7 +140,7 @@ public:
 	}
 
 public:
-	// step timeout count.
+	// remove lost sessions.
 	void step_timeout();
 
 	// add accepted connection
@@ -23,6 +23,7 @@
 #include "rpc/protocol.h"
 #include "rpc/wavy.h"
 #include "rpc/exception.h"
+#include "rpc/read_sizer.h"
 #include <msgpack.hpp>
 #include <stdexcept>
 #include <memory>
@@ -39,6 +40,10 @@
 #define RPC_BUFFER_RESERVATION_SIZE (8*1024)
 #endif
 
+#ifndef RPC_BUFFER_RESERVATION_MAX
+#define RPC_BUFFER_RESERVATION_MAX (1024*1024)
+#endif
+
 namespace rpc {
 
 
@@ -64,6 +69,7 @@ public:
 
 private:
 	msgpack::unpacker m_pac;
+	read_sizer m_sizer;
 
 private:
 	connection();
@@ -74,7 +80,8 @@ private:
 template <typename IMPL>
 connection<IMPL>::connection(int fd) :
 	mp::wavy::handler(fd),
-	m_pac(RPC_INITIAL_BUFFER_SIZE) { }
+	m_pac(RPC_INITIAL_BUFFER_SIZE),
+	m_sizer(RPC_BUFFER_RESERVATION_SIZE, RPC_BUFFER_RESERVATION_MAX) { }
 
 template <typename IMPL>
 connection<IMPL>::~connection() { }
@@ -83,22 +90,35 @@ connection<IMPL>::~connection() { }
 template <typename IMPL>
 void connection<IMPL>::connection::read_event()
 try {
-	m_pac.reserve_buffer(RPC_BUFFER_RESERVATION_SIZE);
-
-	ssize_t rl = ::read(fd(), m_pac.buffer(), m_pac.buffer_capacity());
-	if(rl <= 0) {
-		if(rl == 0) { throw connection_closed_error(); }
-		if(errno == EAGAIN || errno == EINTR) { return; }
-		else { throw connection_broken_error(); }
-	}
-
-	m_pac.buffer_consumed(rl);
-
-	while(m_pac.execute()) {
-		msgobj msg = m_pac.data();
-		std::auto_ptr<msgpack::zone> z( m_pac.release_zone() );
-		m_pac.reset();
-		static_cast<IMPL*>(this)->submit_message(msg, z);
+	// read till the socket is drained to save the round trips
+	// to the event loop, within the budget for fairness.
+	size_t total = 0;
+	while(true) {
+		m_pac.reserve_buffer(m_sizer.size());
+		size_t capacity = m_pac.buffer_capacity();
+
+		ssize_t rl = ::read(fd(), m_pac.buffer(), capacity);
+		if(rl <= 0) {
+			if(rl == 0) { throw connection_closed_error(); }
+			if(errno == EAGAIN || errno == EINTR) { return; }
+			else { throw connection_broken_error(); }
+		}
+
+		m_pac.buffer_consumed(rl);
+
+		while(m_pac.execute()) {
+			msgobj msg = m_pac.data();
+			std::auto_ptr<msgpack::zone> z( m_pac.release_zone() );
+			m_pac.reset();
+			static_cast<IMPL*>(this)->submit_message(msg, z);
+		}
+
+		m_sizer.update(rl, capacity);
+
+		total += rl;
+		if((size_t)rl < capacity || total >= READ_EVENT_BUDGET_SIZE) {
+			return;
+		}
 	}
 
 } catch(connection_error& e) {
@@ -0,0 +1,132 @@
+//
+// kumofs
+//
+// Copyright (C) 2009 FURUHASHI Sadayuki
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+//
+#ifndef RPC_POOL_H__
+#define RPC_POOL_H__
+
+#include "rpc/types.h"
+#include "rpc/vrefbuffer.h"
+#include <msgpack.hpp>
+#include <mp/pthread.h>
+#include <vector>
+
+namespace rpc {
+
+
+inline void pool_reset(vrefbuffer* buf) { buf->clear(); }
+inline void pool_reset(msgpack::zone* z) { z->clear(); }
+
+
+// freelists of the objects allocated for every request.
+// released objects are reset and reused instead of freed.
+//
+// each thread has its own freelist. the freelists exchange
+// BATCH_SIZE objects with the shared depot at once, because
+// objects are allocated on the worker threads and released
+// on the output threads.
+// objects which are not got from the pool can be released to it,
+// and objects got from the pool can be deleted.
+template <typename T>
+class object_pool {
+public:
+	static T* get();
+	static void release(T* obj);
+
+	// finalizer of wavy::request and send_datav
+	static void release_void(void* obj)
+		{ release(static_cast<T*>(obj)); }
+
+private:
+	static const size_t LOCAL_SIZE = 64;
+	static const size_t BATCH_SIZE = 32;
+	static const size_t DEPOT_SIZE = 4096;
+
+	struct freelist {
+		size_t num;
+		T* objs[LOCAL_SIZE];
+	};
+	static __thread freelist s_local;
+
+	struct depot {
+		mp::pthread_mutex mutex;
+		std::vector<T*> objs;
+	};
+	static depot s_depot;
+};
+
+template <typename T>
+__thread typename object_pool<T>::freelist object_pool<T>::s_local;
+
+template <typename T>
+typename object_pool<T>::depot object_pool<T>::s_depot;
+
+
+template <typename T>
+T* object_pool<T>::get()
+{
+	freelist& fl(s_local);
+	if(fl.num == 0) {
+		pthread_scoped_lock lk(s_depot.mutex);
+		while(fl.num < BATCH_SIZE && !s_depot.objs.empty()) {
+			fl.objs[fl.num++] = s_depot.objs.back();
+			s_depot.objs.pop_back();
+		}
+	}
+	if(fl.num == 0) {
+		return new T();
+	}
+	return fl.objs[--fl.num];
+}
+
+template <typename T>
+void object_pool<T>::release(T* obj)
+{
+	if(!obj) { return; }
+	pool_reset(obj);
+
+	freelist& fl(s_local);
+	if(fl.num == LOCAL_SIZE) {
+		pthread_scoped_lock lk(s_depot.mutex);
+		while(fl.num > LOCAL_SIZE - BATCH_SIZE) {
+			T* x = fl.objs[--fl.num];
+			if(s_depot.objs.size() < DEPOT_SIZE) {
+				s_depot.objs.push_back(x);
+			} else {
+				delete x;
+			}
+		}
+	}
+	fl.objs[fl.num++] = obj;
+}
+
+
+typedef object_pool<vrefbuffer> vrefbuffer_pool;
+typedef object_pool<msgpack::zone> zone_pool;
+
+
+// the zone is returned to the pool when the last reference is released.
+// rpc::retry objects allocated in it are reused with the zone.
+inline shared_zone new_shared_zone()
+{
+	return shared_zone(zone_pool::get(), &zone_pool::release);
+}
+
+
+}  // namespace rpc
+
+#endif /* rpc/pool.h */
+
@@ -0,0 +1,83 @@
+//
+// kumofs
+//
+// Copyright (C) 2009 FURUHASHI Sadayuki
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+//
+#ifndef RPC_READ_SIZER_H__
+#define RPC_READ_SIZER_H__
+
+#include <stddef.h>
+
+// read_event reads the socket till it is drained or this number of bytes
+// are read, and then returns to the event loop for other connections.
+#ifndef READ_EVENT_BUDGET_SIZE
+#define READ_EVENT_BUDGET_SIZE (256*1024)
+#endif
+
+namespace rpc {
+
+
+// size of the buffer reserved for each read() in read_event.
+// it grows while the reads fill the buffer or a message doesn't fit
+// in it, and shrinks back after SHRINK_READS small reads.
+class read_sizer {
+public:
+	read_sizer(size_t min_size, size_t max_size) :
+		m_min(min_size), m_max(max_size),
+		m_size(min_size), m_small_reads(0) { }
+
+public:
+	size_t size() const { return m_size; }
+
+	// read_size bytes are read into the buffer of capacity bytes.
+	// pending is the size of the incomplete message in the buffer.
+	void update(size_t read_size, size_t capacity, size_t pending = 0)
+	{
+		if(read_size >= capacity || pending >= m_size) {
+			while(m_size < m_max && (m_size <= read_size || m_size <= pending)) {
+				m_size *= 2;
+			}
+			if(m_size > m_max) { m_size = m_max; }
+			m_small_reads = 0;
+
+		} else if(m_size > m_min && read_size < m_size / 4) {
+			if(++m_small_reads >= SHRINK_READS) {
+				m_size /= 2;
+				if(m_size < m_min) { m_size = m_min; }
+				m_small_reads = 0;
+			}
+
+		} else {
+			m_small_reads = 0;
+		}
+	}
+
+private:
+	static const unsigned int SHRINK_READS = 16;
+
+	size_t m_min;
+	size_t m_max;
+	size_t m_size;
+	unsigned int m_small_reads;
+
+private:
+	read_sizer();
+};
+
+
+}  // namespace rpc
+
+#endif /* rpc/read_sizer.h */
+
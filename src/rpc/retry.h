@@ -44,6 +44,13 @@ public:
 		s->call(m_param, life, m_callbck, timeout_steps);
 	}
 
+	template <typename Session>
+	void call_batch(Session s, vrefbuffer& batch,
+			rpc::shared_zone& life, unsigned short timeout_steps = 10)
+	{
+		s->call_batch(batch, m_param, life, m_callbck, timeout_steps);
+	}
+
 	unsigned short num_retried() const
 	{
 		return m_limit;
@@ -66,7 +66,6 @@ void server::step_timeout()
 			it != it_end; ) {
 		basic_shared_session p(it->second.lock());
 		if(p && !p->is_lost()) {
-			wavy::submit(&basic_session::step_timeout, p.get(), p);
 			++it;
 		} else {
 			m_peers.erase(it++);
@@ -52,7 +52,8 @@ public:
 			method_id method, msgobj param, auto_zone z) = 0;
 
 public:
-	// step timeout count.
+	// remove lost sessions.
+	// callbacks are timed out by the timer of the wavy core.
 	void step_timeout();
 
 	// add accepted connection
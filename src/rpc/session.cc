@@ -19,6 +19,8 @@
 #include "rpc/protocol.h"
 #include "log/mlogger.h" //FIXME
 #include <iterator>
+#include <vector>
+#include <map>
 
 namespace rpc {
 
@@ -29,13 +31,16 @@ class callback_entry {
 public:
 	callback_entry();
 	callback_entry(callback_t callback, shared_zone life,
-			unsigned short timeout_steps);
+			wavy::timer_id timer,
+			const shared_transport_load& load);
 
 public:
 	void callback(basic_shared_session& s, msgobj res, msgobj err, auto_zone& z);
 	void callback(basic_shared_session& s, msgobj res, msgobj err);
 	inline void callback_submit(basic_shared_session& s, msgobj res, msgobj err);
-	inline bool step_timeout();  // Note: NOT thread-safe
+
+	inline void release_load();
+	inline void cancel_timeout();
 
 private:
 	void callback_real(basic_shared_session& s,
@@ -46,9 +51,10 @@ private:
 			msgobj res, msgobj err, shared_zone life);
 
 private:
-	unsigned short m_timeout_steps;
+	wavy::timer_id m_timer;
 	callback_t m_callback;
 	shared_zone m_life;
+	shared_transport_load m_load;  // NULL if the transport is not chosen
 };
 
 class callback_table {
@@ -60,27 +66,86 @@ public:
 	void insert(msgid_t msgid, const callback_entry& entry);
 	bool out(msgid_t msgid, callback_entry* result);
 	template <typename F> void for_each_clear(F f);
-	template <typename F> void erase_if(F f);
 
 private:
-	static const size_t PARTITION_NUM = 4;  // FIXME
-	typedef std::map<msgid_t, callback_entry> callbacks_t;
-	mp::pthread_mutex m_callbacks_mutex[PARTITION_NUM];
-	callbacks_t m_callbacks[PARTITION_NUM];
+	// open addressing table indexed by msgid % capacity.
+	// msgids are sequential in a session, so that requests in flight
+	// take contiguous slots. if the slot is taken by another msgid,
+	// the next free slot in the same group of PROBE_LIMIT slots is
+	// used, and if the group is full the entry goes to the overflow map.
+	// the table grows while it is more than half full and shrinks
+	// when less than 1/8 of it is used.
+	struct slot {
+		slot() : used(false) { }
+		bool used;
+		msgid_t msgid;  // tag to reject stale responses
+		callback_entry entry;
+	};
+
+	typedef std::map<msgid_t, callback_entry> overflow_t;
+
+	static const size_t INITIAL_CAPACITY = 64;
+	static const size_t MAX_CAPACITY = 16384;
+	static const size_t PROBE_LIMIT = 8;
+	static const size_t STRIPE_NUM = 16;
+
+	bool put_slot(msgid_t msgid, const callback_entry& entry);
+	bool take_slot(msgid_t msgid, callback_entry* result);
+	void put_overflow(msgid_t msgid, const callback_entry& entry);
+	bool take_overflow(msgid_t msgid, callback_entry* result);
+	void resize(size_t capacity, size_t next);
+
+	static slot* probe(slot* slots, size_t capacity, msgid_t msgid);
+
+	// slots of a group are guarded by the same mutex
+	mp::pthread_mutex& stripe(msgid_t msgid)
+		{ return m_stripe_mutex[((msgid & (m_capacity - 1)) / PROBE_LIMIT) % STRIPE_NUM]; }
+
+	mp::pthread_rwlock m_table_rwlock;  // write locked while resizing
+	mp::pthread_mutex m_stripe_mutex[STRIPE_NUM];
+	slot* m_slots;  // allocated when the first callback is inserted
+	size_t m_capacity;  // 0 or power of 2
+	volatile size_t m_count;  // entries in the slots and the overflow map
+
+	mp::pthread_mutex m_overflow_mutex;
+	overflow_t m_overflow;
+	volatile size_t m_overflow_count;
 
 private:
 	callback_table(const callback_table&);
 };
 
 
-callback_entry::callback_entry() { }
+callback_entry::callback_entry() : m_timer(0) { }
 
 callback_entry::callback_entry(
 		callback_t callback, shared_zone life,
-		unsigned short timeout_steps) :
-	m_timeout_steps(timeout_steps),
+		wavy::timer_id timer,
+		const shared_transport_load& load) :
+	m_timer(timer),
 	m_callback(callback),
-	m_life(life) { }
+	m_life(life),
+	m_load(load)
+{
+	if(m_load) {
+		__sync_add_and_fetch(&m_load->inflight, 1);
+	}
+}
+
+// called once when the entry is taken out of the table
+inline void callback_entry::release_load()
+{
+	if(m_load) {
+		__sync_sub_and_fetch(&m_load->inflight, 1);
+		m_load.reset();
+	}
+}
+
+// called when the entry is taken out of the table before it times out
+inline void callback_entry::cancel_timeout()
+{
+	wavy::cancel_timer(m_timer);
+}
 
 
 void callback_entry::callback_real(basic_shared_session& s,
@@ -124,12 +189,14 @@ inline void callback_entry::callback(
 	// msgpack::zone::push_finalizer is not thread-safe
 	// m_life may null. see {basic_,}session::call
 	//m_life->push_finalizer(&mp::object_delete<msgpack::zone>, z.release());
+	release_load();
 	callback_real(s, res, err, z);
 }
 
 inline void callback_entry::callback(
 		basic_shared_session& s, msgobj res, msgobj err)
 {
+	release_load();
 	auto_zone z(new msgpack::zone());
 	callback_real(s, res, err, z);
 }
@@ -137,81 +204,221 @@ inline void callback_entry::callback(
 inline void callback_entry::callback_submit(
 		basic_shared_session& s, msgobj res, msgobj err)
 {
+	release_load();
 	wavy::submit(&callback_entry::callback_submit_real,
 			m_callback, s, res, err, m_life);
 }
 
 
-bool callback_entry::step_timeout()
+callback_table::callback_table() :
+	m_slots(NULL), m_capacity(0),
+	m_count(0), m_overflow_count(0) { }
+
+callback_table::~callback_table()
 {
-	if(m_timeout_steps > 0) {
-		--m_timeout_steps;  // FIXME atomic?
-		return true;
+	delete[] m_slots;
+}
+
+// returns the slot of msgid, or a free slot in its group, or NULL
+callback_table::slot* callback_table::probe(
+		slot* slots, size_t capacity, msgid_t msgid)
+{
+	size_t index = msgid & (capacity - 1);
+	size_t group = index & ~(PROBE_LIMIT - 1);
+	slot* free = NULL;
+	for(size_t i=0; i < PROBE_LIMIT; ++i) {
+		slot& sl(slots[group | ((index + i) & (PROBE_LIMIT - 1))]);
+		if(!sl.used) {
+			if(!free) { free = &sl; }
+		} else if(sl.msgid == msgid) {
+			return &sl;
+		}
 	}
-	return false;
+	return free;
 }
 
+// m_table_rwlock must be read locked
+bool callback_table::put_slot(
+		msgid_t msgid, const callback_entry& entry)
+{
+	pthread_scoped_lock lk(stripe(msgid));
 
-callback_table::callback_table() { }
+	slot* sl = probe(m_slots, m_capacity, msgid);
+	if(!sl) {
+		return false;
+	}
 
-callback_table::~callback_table() { }
+	if(sl->used) {
+		sl->entry.release_load();
+		sl->entry.cancel_timeout();
+	} else {
+		sl->used = true;
+		sl->msgid = msgid;
+		__sync_add_and_fetch(&m_count, 1);
+	}
+	sl->entry = entry;
+	return true;
+}
 
-bool callback_table::out(
+// m_table_rwlock must be read locked
+bool callback_table::take_slot(
 		msgid_t msgid, callback_entry* result)
 {
-	pthread_scoped_lock lk(m_callbacks_mutex[msgid % PARTITION_NUM]);
+	pthread_scoped_lock lk(stripe(msgid));
 
-	callbacks_t& cbs(m_callbacks[msgid % PARTITION_NUM]);
-	callbacks_t::iterator it(cbs.find(msgid));
-	if(it == cbs.end()) {
+	slot* sl = probe(m_slots, m_capacity, msgid);
+	if(!sl || !sl->used) {
+		return false;
+	}
+
+	*result = sl->entry;
+	sl->entry = callback_entry();
+	sl->used = false;
+	__sync_sub_and_fetch(&m_count, 1);
+	return true;
+}
+
+// m_table_rwlock must be read locked
+void callback_table::put_overflow(
+		msgid_t msgid, const callback_entry& entry)
+{
+	pthread_scoped_lock lk(m_overflow_mutex);
+	m_overflow[msgid] = entry;
+	__sync_add_and_fetch(&m_count, 1);
+	__sync_add_and_fetch(&m_overflow_count, 1);
+}
+
+// m_table_rwlock must be read locked
+bool callback_table::take_overflow(
+		msgid_t msgid, callback_entry* result)
+{
+	pthread_scoped_lock lk(m_overflow_mutex);
+	overflow_t::iterator it = m_overflow.find(msgid);
+	if(it == m_overflow.end()) {
 		return false;
 	}
 
 	*result = it->second;
-	cbs.erase(it);
+	m_overflow.erase(it);
+	__sync_sub_and_fetch(&m_count, 1);
+	__sync_sub_and_fetch(&m_overflow_count, 1);
+	return true;
+}
+
+bool callback_table::out(
+		msgid_t msgid, callback_entry* result)
+{
+	size_t capacity;
+	{
+		pthread_scoped_rdlock rdlk(m_table_rwlock);
+		capacity = m_capacity;
+		if(capacity == 0) {
+			return false;
+		}
 
+		if(!take_slot(msgid, result) && !take_overflow(msgid, result)) {
+			return false;
+		}
+	}
+
+	if(capacity > INITIAL_CAPACITY && m_count < capacity / 8) {
+		resize(capacity, capacity / 2);
+	}
 	return true;
 }
 
 template <typename F>
 void callback_table::for_each_clear(F f)
 {
-	for(size_t i=0; i < PARTITION_NUM; ++i) {
-		pthread_scoped_lock lk(m_callbacks_mutex[i]);
-		callbacks_t& cbs(m_callbacks[i]);
-		std::for_each(cbs.begin(), cbs.end(), f);
-		cbs.clear();
+	pthread_scoped_wrlock wrlk(m_table_rwlock);
+	for(size_t i=0; i < m_capacity; ++i) {
+		slot& sl(m_slots[i]);
+		if(sl.used) {
+			f(sl.entry);
+			sl.entry = callback_entry();
+			sl.used = false;
+		}
 	}
+	for(overflow_t::iterator it(m_overflow.begin()), it_end(m_overflow.end());
+			it != it_end; ++it) {
+		f(it->second);
+	}
+	m_overflow.clear();
+	m_count = 0;
+	m_overflow_count = 0;
 }
 
-template <typename F>
-void callback_table::erase_if(F f)
-{
-	for(size_t i=0; i < PARTITION_NUM; ++i) {
-		pthread_scoped_lock lk(m_callbacks_mutex[i]);
-		callbacks_t& cbs(m_callbacks[i]);
-		for(callbacks_t::iterator it(cbs.begin()), it_end(cbs.end());
-				it != it_end; ) {
-			if(f(*it)) {
-				cbs.erase(it++);
-			} else {
-				++it;
+void callback_table::insert(
+		msgid_t msgid, const callback_entry& entry)
+{
+	while(true) {
+		size_t capacity;
+		{
+			pthread_scoped_rdlock rdlk(m_table_rwlock);
+			capacity = m_capacity;
+			if(capacity != 0 &&
+					(m_count < capacity / 2 || capacity >= MAX_CAPACITY)) {
+				if(m_overflow_count != 0) {
+					// msgid is reused while the old one is in flight
+					callback_entry old;
+					if(take_overflow(msgid, &old)) {
+						old.release_load();
+						old.cancel_timeout();
+					}
+				}
+				if(!put_slot(msgid, entry)) {
+					put_overflow(msgid, entry);
+				}
+				return;
 			}
 		}
-		//cbs.erase(std::remove_if(cbs.begin(), cbs.end(), f), cbs.end());
+		resize(capacity, (capacity == 0) ? INITIAL_CAPACITY : capacity * 2);
 	}
 }
 
-void callback_table::insert(
-		msgid_t msgid, const callback_entry& entry)
+void callback_table::resize(size_t capacity, size_t next)
 {
-	pthread_scoped_lock lk(m_callbacks_mutex[msgid % PARTITION_NUM]);
-	std::pair<callbacks_t::iterator, bool> pair =
-		m_callbacks[msgid % PARTITION_NUM].insert(
-				callbacks_t::value_type(msgid, entry));
-	if(!pair.second) {
-		pair.first->second = entry;
+	pthread_scoped_wrlock wrlk(m_table_rwlock);
+	if(m_capacity != capacity) {
+		return;  // resized by another thread
+	}
+
+	slot* slots = new slot[next];
+	overflow_t overflow;
+
+	for(size_t i=0; i < m_capacity; ++i) {
+		slot& from(m_slots[i]);
+		if(from.used) {
+			slot* to = probe(slots, next, from.msgid);
+			if(to) {
+				to->used = true;
+				to->msgid = from.msgid;
+				to->entry = from.entry;
+			} else {
+				overflow[from.msgid] = from.entry;
+			}
+		}
 	}
+
+	for(overflow_t::iterator it(m_overflow.begin()), it_end(m_overflow.end());
+			it != it_end; ++it) {
+		slot* to = probe(slots, next, it->first);
+		if(to) {
+			to->used = true;
+			to->msgid = it->first;
+			to->entry = it->second;
+		} else {
+			overflow[it->first] = it->second;
+		}
+	}
+
+	delete[] m_slots;
+	m_slots = slots;
+	m_capacity = next;
+	m_overflow.swap(overflow);
+	m_overflow_count = m_overflow.size();
+	LOG_TRACE("resize callback table ",capacity," -> ",next,
+			" overflow ",m_overflow_count);
 }
 
 }  // noname namespace
@@ -221,8 +428,21 @@ void callback_table::insert(
 	reinterpret_cast<callback_table*>(m_cbtable)
 
 
+unsigned long basic_session::s_timeout_step_msec = 2000;
+
+void basic_session::set_timeout_step(unsigned long usec)
+{
+	s_timeout_step_msec = usec / 1000;
+	if(s_timeout_step_msec == 0) {
+		s_timeout_step_msec = 1;
+	}
+}
+
+
 basic_session::basic_session(session_manager* mgr) :
 	m_msgid_rr(0),  // FIXME randomize?
+	m_pool_connecting(0),
+	m_pool_retry_time(0),
 	m_lost(false),
 	m_connect_retried_count(0),
 	m_manager(mgr)
@@ -254,9 +474,8 @@ void basic_session::call_real(msgid_t msgid, std::auto_ptr<vrefbuffer> buffer,
 {
 	//if(!life) { life.reset(new msgpack::zone()); }
 
-	ANON_m_cbtable->insert(msgid, callback_entry(callback, life, timeout_steps));
-
 	if(is_lost()) {
+		insert_callback(msgid, life, callback, timeout_steps);
 		//throw std::runtime_error("lost session");
 		// FIXME XXX forget the error for robustness and wait timeout.
 		return;
@@ -264,18 +483,49 @@ void basic_session::call_real(msgid_t msgid, std::auto_ptr<vrefbuffer> buffer,
 
 	pthread_scoped_lock blk(m_binds_mutex);
 	if(m_binds.empty()) {
+		insert_callback(msgid, life, callback, timeout_steps);
 		//throw std::runtime_error("session not bound");
 		// FIXME XXX forget the error for robustness and wait timeout.
 
 	} else {
+		// the callback is counted on the transport before sending
+		basic_transport* t = least_loaded_transport();
+		insert_callback(msgid, life, callback, timeout_steps, t->load());
+		t->send_datav(buffer.get(), &vrefbuffer_pool::release_void, buffer.get());
+		buffer.release();
+	}
+}
+
+void basic_session::insert_callback(msgid_t msgid,
+		shared_zone life, callback_t callback, unsigned short timeout_steps,
+		shared_transport_load load)
+{
+	// same as the callback timed out by (timeout_steps+1) timeout steps
+	unsigned long msec = (timeout_steps + 1) * s_timeout_step_msec;
+	wavy::timer_id timer = wavy::add_timer(msec,
+			mp::bind(&basic_session::process_timeout,
+				basic_weak_session(shared_from_this()), msgid));
+
+	ANON_m_cbtable->insert(msgid, callback_entry(callback, life, timer, load));
+}
+
+basic_transport* basic_session::least_loaded_transport()
+{
 #ifndef NO_AD_HOC_CONNECTION_LOAD_BALANCE
-		m_binds[m_msgid_rr % m_binds.size()]
+	// ties are broken round-robin
+	size_t num = m_binds.size();
+	size_t start = m_msgid_rr % num;
+	basic_transport* best = m_binds[start];
+	for(size_t i=1; i < num && best->inflight() > 0; ++i) {
+		basic_transport* t = m_binds[(start + i) % num];
+		if(t->inflight() < best->inflight()) {
+			best = t;
+		}
+	}
+	return best;
 #else
-		m_binds[0]
+	return m_binds[0];
 #endif
-			->send_datav(buffer.get(), &mp::object_delete<vrefbuffer>, buffer.get());
-		buffer.release();
-	}
 }
 
 void session::call_real(msgid_t msgid, std::auto_ptr<vrefbuffer> buffer,
@@ -283,8 +533,44 @@ void session::call_real(msgid_t msgid, std::auto_ptr<vrefbuffer> buffer,
 {
 	//if(!life) { life.reset(new msgpack::zone()); }
 
-	ANON_m_cbtable->insert(msgid, callback_entry(callback, life, timeout_steps));
+	if(is_lost()) {
+		insert_callback(msgid, life, callback, timeout_steps);
+		//throw std::runtime_error("lost session");
+		// FIXME XXX forget the error for robustness and wait timeout.
+		return;
+	}
+
+	pthread_scoped_lock blk(m_binds_mutex);
+	if(m_binds.empty()) {
+		insert_callback(msgid, life, callback, timeout_steps);
+		{
+			pthread_scoped_lock plk(m_pending_queue_mutex);
+			LOG_TRACE("push pending queue ",m_pending_queue.size()+1);
+			m_pending_queue.push_back(buffer.get());
+		}
+		buffer.release();
+		// FIXME clear pending queue if it is too big
+		// FIXME or throw exception
+
+	} else {
+		// the callback is counted on the transport before sending
+		basic_transport* t = least_loaded_transport();
+		insert_callback(msgid, life, callback, timeout_steps, t->load());
+		t->send_datav(buffer.get(), &vrefbuffer_pool::release_void, buffer.get());
+		buffer.release();
+	}
+}
+
+void session::send_batch(std::auto_ptr<vrefbuffer> batch)
+{
+	if(batch->vector_size() == 0) {
+		return;
+	}
+	send_buffer(batch);
+}
 
+void session::send_buffer(std::auto_ptr<vrefbuffer> buffer)
+{
 	if(is_lost()) {
 		//throw std::runtime_error("lost session");
 		// FIXME XXX forget the error for robustness and wait timeout.
@@ -303,12 +589,8 @@ void session::call_real(msgid_t msgid, std::auto_ptr<vrefbuffer> buffer,
 		// FIXME or throw exception
 
 	} else {
-#ifndef NO_AD_HOC_CONNECTION_LOAD_BALANCE
-		m_binds[m_msgid_rr % m_binds.size()]
-#else
-		m_binds[0]
-#endif
-			->send_datav(buffer.get(), &mp::object_delete<vrefbuffer>, buffer.get());
+		least_loaded_transport()
+			->send_datav(buffer.get(), &vrefbuffer_pool::release_void, buffer.get());
 		buffer.release();
 	}
 }
@@ -325,9 +607,35 @@ void basic_session::process_response(
 		LOG_DEBUG("callback not found id=",msgid);
 		return;
 	}
+	e.cancel_timeout();
 	e.callback(self, result, error, z);
 }
 
+void basic_session::process_timeout(basic_weak_session ws, msgid_t msgid)
+{
+	basic_shared_session self(ws.lock());
+	if(!self) {
+		// destructed session calls all callbacks
+		return;
+	}
+
+	callback_entry e;
+	if(!reinterpret_cast<callback_table*>(self->m_cbtable)->out(msgid, &e)) {
+		// already responded
+		return;
+	}
+	LOG_DEBUG("callback timeout id=",msgid);
+
+	msgpack::object res;
+	res.type = msgpack::type::NIL;
+	msgpack::object err;
+	err.type = msgpack::type::POSITIVE_INTEGER;
+	err.via.u64 = protocol::TIMEOUT_ERROR;
+
+	// timers run on the worker threads
+	e.callback(self, res, err);
+}
+
 
 void basic_session::send_data(const char* buf, size_t buflen,
 		void (*finalize)(void*), void* data)
@@ -336,11 +644,7 @@ void basic_session::send_data(const char* buf, size_t buflen,
 	if(m_binds.empty()) {
 		throw std::runtime_error("session not bound");
 	}
-#ifndef NO_AD_HOC_CONNECTION_LOAD_BALANCE
-	m_binds[m_msgid_rr % m_binds.size()]
-#else
-	m_binds[0]
-#endif
+	least_loaded_transport()
 		->send_data(buf, buflen, finalize, data);
 }
 
@@ -351,11 +655,7 @@ void basic_session::send_datav(vrefbuffer* buf,
 	if(m_binds.empty()) {
 		throw std::runtime_error("session not bound");
 	}
-#ifndef NO_AD_HOC_CONNECTION_LOAD_BALANCE
-	m_binds[m_msgid_rr % m_binds.size()]
-#else
-	m_binds[0]
-#endif
+	least_loaded_transport()
 		->send_datav(buf, finalize, data);
 }
 
@@ -385,7 +685,7 @@ bool session::bind_transport(basic_transport* t)
 	for(pending_queue_t::iterator it(pendings.begin()),
 			it_end(pendings.end()); it != it_end; ++it) {
 		t->send_datav(*it,
-			&mp::object_delete<vrefbuffer>, *it);
+			&vrefbuffer_pool::release_void, *it);
 	}
 	pendings.clear();
 
@@ -416,6 +716,52 @@ bool session::unbind_transport(basic_transport* t, basic_shared_session& self)
 }
 
 
+bool basic_session::begin_pool_connect(unsigned short pool_size)
+{
+	pthread_scoped_lock lk(m_binds_mutex);
+	if(m_binds.empty() || m_binds.size() + m_pool_connecting >= pool_size) {
+		return false;
+	}
+	if(m_pool_retry_time != 0 && time(NULL) < m_pool_retry_time) {
+		return false;
+	}
+	++m_pool_connecting;
+	return true;
+}
+
+void basic_session::end_pool_connect(bool failed)
+{
+	pthread_scoped_lock lk(m_binds_mutex);
+	--m_pool_connecting;
+	m_pool_retry_time = failed ? time(NULL) + 1 : 0;
+}
+
+void basic_session::connection_loads(std::vector<unsigned int>* result)
+{
+	pthread_scoped_lock lk(m_binds_mutex);
+	result->clear();
+	for(binds_t::iterator it(m_binds.begin()), it_end(m_binds.end());
+			it != it_end; ++it) {
+		result->push_back((*it)->inflight());
+	}
+}
+
+
+size_t session::queue_depth()
+{
+	size_t depth = 0;
+	{
+		pthread_scoped_lock blk(m_binds_mutex);
+		for(binds_t::iterator it(m_binds.begin()), it_end(m_binds.end());
+				it != it_end; ++it) {
+			depth += (*it)->inflight();
+		}
+	}
+	pthread_scoped_lock plk(m_pending_queue_mutex);
+	return depth + m_pending_queue.size();
+}
+
+
 void basic_session::shutdown()
 {
 	pthread_scoped_lock lk(m_binds_mutex);
@@ -439,10 +785,10 @@ namespace {
 		each_callback_submit(basic_shared_session& s,
 				msgobj r, msgobj e) :
 			self(s), res(r), err(e) { }
-		template <typename T>
-		void operator() (T& pair) const
+		void operator() (callback_entry& e) const
 		{
-			pair.second.callback_submit(self, res, err);
+			e.cancel_timeout();
+			e.callback_submit(self, res, err);
 		}
 	private:
 		basic_shared_session& self;
@@ -459,40 +805,6 @@ void basic_session::force_lost(basic_shared_session& s,
 	ANON_m_cbtable->for_each_clear(each_callback_submit(s, res, err));
 }
 
-namespace {
-	struct remove_if_step_timeout {
-		remove_if_step_timeout(basic_shared_session s) :
-			self(s)
-		{
-			res.type = msgpack::type::NIL;
-			err.type = msgpack::type::POSITIVE_INTEGER;
-			err.via.u64 = protocol::TIMEOUT_ERROR;
-		}
-		template <typename T>
-		bool operator() (T& pair)
-		{
-			if(!pair.second.step_timeout()) {
-				LOG_DEBUG("callback timeout id=",pair.first);
-				pair.second.callback_submit(self, res, err);  // client::step_timeout;
-				//pair.second.callback(self, res, err);  // client::step_timeout;  // FIXME XXX
-				return true;
-			}
-			return false;
-		}
-	private:
-		basic_shared_session& self;
-		msgobj res;
-		msgobj err;
-		remove_if_step_timeout();
-	};
-}  // noname namespace
-
-void basic_session::step_timeout(basic_shared_session self)
-{
-	ANON_m_cbtable->erase_if(remove_if_step_timeout(self));
-}
-
-
 void session::cancel_pendings()
 {
 	pthread_scoped_lock lk(m_pending_queue_mutex);
@@ -503,7 +815,7 @@ void session::clear_pending_queue(pending_queue_t& queue)
 {
 	for(pending_queue_t::iterator it(queue.begin()),
 			it_end(queue.end()); it != it_end; ++it) {
-		delete *it;
+		vrefbuffer_pool::release(*it);
 	}
 	queue.clear();
 }
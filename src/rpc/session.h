@@ -21,9 +21,12 @@
 #include "rpc/address.h"
 #include "rpc/connection.h"
 #include "rpc/vrefbuffer.h"
+#include "rpc/pool.h"
 #include <mp/memory.h>
 #include <mp/object_callback.h>
 #include <algorithm>
+#include <vector>
+#include <time.h>
 
 namespace rpc {
 
@@ -44,7 +47,7 @@ struct session_manager {
 };
 
 
-class basic_session {
+class basic_session : public mp::enable_shared_from_this<basic_session> {
 public:
 	basic_session(session_manager* mgr = NULL);
 	virtual ~basic_session();
@@ -52,8 +55,9 @@ public:
 	typedef std::auto_ptr<msgpack::zone> auto_zone;
 
 public:
-	// step callback timeout count.
-	void step_timeout(basic_shared_session self);
+	// set length of a timeout step. callbacks time out after
+	// (timeout_steps+1) steps. default is 2 seconds.
+	static void set_timeout_step(unsigned long usec);
 
 	// return true if this session is connected.
 	bool is_bound() const;
@@ -88,6 +92,18 @@ public:
 	// close this session.
 	void shutdown();
 
+public:
+	// called from client_tmpl to keep pooled connections.
+	// returns true if one more connection should be opened
+	// to have pool_size connections; call end_pool_connect()
+	// after the connection is bound or failed.
+	// pooled connections are not retried for a second after a failure.
+	bool begin_pool_connect(unsigned short pool_size);
+	void end_pool_connect(bool failed = false);
+
+	// number of requests waiting for the responses on each connection
+	void connection_loads(std::vector<unsigned int>* result);
+
 public:
 	// call all registered callback functions with specified arguments
 	// and set is_lost == true
@@ -122,10 +138,23 @@ protected:
 	template <typename Message>
 	msgid_t pack(vrefbuffer& buffer, Message& param);
 
+	void insert_callback(msgid_t msgid,
+			shared_zone life, callback_t callback, unsigned short timeout_steps,
+			shared_transport_load load = shared_transport_load());
+
+	// returns the transport which has the fewest requests in flight.
+	// m_binds_mutex must be locked and m_binds must not be empty.
+	basic_transport* least_loaded_transport();
+
 private:
 	void call_real(msgid_t msgid, std::auto_ptr<vrefbuffer> buffer,
 			shared_zone life, callback_t callback, unsigned short timeout_steps);
 
+	// called from the timer of the wavy core
+	static void process_timeout(basic_weak_session ws, msgid_t msgid);
+
+	static unsigned long s_timeout_step_msec;
+
 protected:
 	msgid_t m_msgid_rr;
 
@@ -135,6 +164,9 @@ protected:
 	typedef std::vector<basic_transport*> binds_t;
 	binds_t m_binds;
 
+	unsigned short m_pool_connecting;  // locked by m_binds_mutex
+	time_t m_pool_retry_time;  // locked by m_binds_mutex
+
 	bool m_lost;
 	unsigned short m_connect_retried_count;
 
@@ -161,9 +193,25 @@ public:
 			shared_zone life, callback_t callback,
 			unsigned short timeout_steps);
 
+	// pack the request into the batch buffer and register the callback.
+	// the request is not sent till send_batch() is called.
+	// Message is requred to inherit rpc::message.
+	template <typename Message>
+	void call_batch(vrefbuffer& batch, Message& param,
+			shared_zone life, callback_t callback,
+			unsigned short timeout_steps);
+
+	// send the requests packed by call_batch() at once.
+	void send_batch(std::auto_ptr<vrefbuffer> batch);
+
 	// clear all pending requests.
 	void cancel_pendings();
 
+	// number of requests waiting for the responses on the transports
+	// and waiting for the connection.
+	// Note: requests sent by send_batch() are not counted.
+	size_t queue_depth();
+
 public:
 	virtual bool bind_transport(basic_transport* t);
 	virtual bool unbind_transport(basic_transport* t, basic_shared_session& self);
@@ -172,6 +220,8 @@ private:
 	void call_real(msgid_t msgid, std::auto_ptr<vrefbuffer> buffer,
 			shared_zone life, callback_t callback, unsigned short timeout_steps);
 
+	void send_buffer(std::auto_ptr<vrefbuffer> buffer);
+
 private:
 	mp::pthread_mutex m_pending_queue_mutex;
 	typedef std::vector<vrefbuffer*> pending_queue_t;
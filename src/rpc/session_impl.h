@@ -87,7 +87,7 @@ inline void basic_session::call(
 {
 	LOG_DEBUG("send request method=",Message::method::id);
 
-	std::auto_ptr<vrefbuffer> buffer(new vrefbuffer());
+	std::auto_ptr<vrefbuffer> buffer(vrefbuffer_pool::get());
 	msgid_t msgid = pack(*buffer, param);
 
 	call_real(msgid, buffer, life, callback, timeout_steps);
@@ -102,13 +102,27 @@ inline void session::call(
 {
 	LOG_DEBUG("send request method=",Message::method::id);
 
-	std::auto_ptr<vrefbuffer> buffer(new vrefbuffer());
+	std::auto_ptr<vrefbuffer> buffer(vrefbuffer_pool::get());
 	msgid_t msgid = pack(*buffer, param);
 
 	call_real(msgid, buffer, life, callback, timeout_steps);
 }
 
 
+template <typename Message>
+inline void session::call_batch(vrefbuffer& batch,
+		Message& param,
+		shared_zone life, callback_t callback,
+		unsigned short timeout_steps)
+{
+	LOG_DEBUG("batch request method=",Message::method::id);
+
+	msgid_t msgid = pack(batch, param);
+
+	insert_callback(msgid, life, callback, timeout_steps);
+}
+
+
 }  // namespace rpc
 
 #endif /* rpc/session_impl.h */
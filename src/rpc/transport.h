@@ -42,6 +42,10 @@ public:
 	// called from basic_session::shutdown()
 	basic_shared_session shutdown();
 
+	// called from basic_session to choose the least loaded transport
+	const shared_transport_load& load() const;
+	unsigned int inflight() const;
+
 public:
 	void process_request(method_id method, msgobj param,
 			msgid_t msgid, auto_zone& z);
@@ -62,6 +66,7 @@ protected:
 
 private:
 	transport_manager* m_manager;
+	shared_transport_load m_load;
 
 private:
 	basic_transport();
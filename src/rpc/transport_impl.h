@@ -25,7 +25,8 @@ inline basic_transport::basic_transport(int fd,
 		basic_shared_session s, transport_manager* mgr) :
 	m_fd(fd),
 	m_session(s),
-	m_manager(mgr) { }
+	m_manager(mgr),
+	m_load(new transport_load()) { }
 
 inline basic_transport::~basic_transport() { }
 
@@ -41,6 +42,16 @@ inline basic_shared_session basic_transport::shutdown()
 	return m_session;
 }
 
+inline const shared_transport_load& basic_transport::load() const
+{
+	return m_load;
+}
+
+inline unsigned int basic_transport::inflight() const
+{
+	return m_load->inflight;
+}
+
 inline transport::transport(int fd, basic_shared_session& s,
 		transport_manager* mgr) :
 	basic_transport(fd, s, mgr),
@@ -47,6 +47,16 @@ typedef mp::weak_ptr<basic_session> basic_weak_session;
 typedef mp::function<void (basic_shared_session, msgobj, msgobj, auto_zone)> callback_t;
 
 
+// number of requests sent through a transport and waiting for the
+// responses. callbacks keep it after the transport is closed.
+struct transport_load {
+	transport_load() : inflight(0) { }
+	volatile unsigned int inflight;
+};
+
+typedef mp::shared_ptr<transport_load> shared_transport_load;
+
+
 using mp::pthread_scoped_lock;
 using mp::pthread_scoped_rdlock;
 using mp::pthread_scoped_wrlock;
@@ -42,6 +42,9 @@ public:
 
 	void write(const char* buf, size_t len);
 
+	// clear the buffer to reuse it. see rpc/pool.h
+	void clear();
+
 	size_t vector_size() const;
 	const struct iovec* vector() const;
 
@@ -93,6 +96,19 @@ inline void vrefbuffer::write(const char* buf, size_t len)
 }
 
 
+inline void vrefbuffer::clear()
+{
+	if(m_vec.capacity() > 64) {
+		// don't keep the vector grown by a large batch
+		vec_t().swap(m_vec);
+		m_vec.reserve(4);
+	} else {
+		m_vec.clear();
+	}
+	m_zone.clear();
+}
+
+
 inline size_t vrefbuffer::vector_size() const
 {
 	return m_vec.size();
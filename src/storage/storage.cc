@@ -25,6 +25,7 @@ Storage::Storage(const char* path,
 		uint32_t garbage_min_time,
 		uint32_t garbage_max_time,
 		size_t garbage_mem_limit) :
+	m_flush_clocktime(0),
 	m_garbage_min_time(garbage_min_time),
 	m_garbage_max_time(garbage_max_time),
 	m_garbage_mem_limit(garbage_mem_limit)
@@ -129,6 +130,10 @@ bool Storage::cas(
 		const char* raw_val, uint32_t raw_vallen,
 		ClockTime compare)
 {
+	if(m_flush_clocktime != 0 && compare < flush_clocktime()) {
+		return false;  // flushed
+	}
+
 	return m_op.update(m_data,
 			raw_key, raw_keylen,
 			raw_val, raw_vallen,
@@ -137,6 +142,90 @@ bool Storage::cas(
 }
 
 
+static bool storage_addproc(void* casdata,
+		const char* oldval, size_t oldvallen)
+{
+	// deleted key has only clocktime
+	if(oldvallen < Storage::VALUE_META_SIZE) {
+		return true;
+	}
+
+	ClockTime flush_clocktime =
+		ClockTime( *reinterpret_cast<uint64_t*>(casdata) );
+
+	return flush_clocktime.get() != 0 &&
+		Storage::clocktime_of(oldval) < flush_clocktime;
+}
+
+
+bool Storage::add(
+		const char* raw_key, uint32_t raw_keylen,
+		const char* raw_val, uint32_t raw_vallen)
+{
+	ClockTime flush = flush_clocktime();
+
+	return m_op.update(m_data,
+			raw_key, raw_keylen,
+			raw_val, raw_vallen,
+			&storage_addproc,
+			reinterpret_cast<void*>(&flush));
+}
+
+
+static bool storage_replaceproc(void* casdata,
+		const char* oldval, size_t oldvallen)
+{
+	if(oldvallen < Storage::VALUE_META_SIZE) {
+		return false;
+	}
+
+	ClockTime flush_clocktime =
+		ClockTime( *reinterpret_cast<uint64_t*>(casdata) );
+
+	return flush_clocktime.get() == 0 ||
+		!(Storage::clocktime_of(oldval) < flush_clocktime);
+}
+
+
+bool Storage::replace(
+		const char* raw_key, uint32_t raw_keylen,
+		const char* raw_val, uint32_t raw_vallen)
+{
+	// the update proc is not called if the key is not stored.
+	// deleted keys are left till they are collected as garbage
+	// and checked by the update proc.
+	char meta_buf[VALUE_META_SIZE];
+	if( m_op.get_header(m_data, raw_key, raw_keylen,
+				meta_buf, sizeof(meta_buf)) <
+			static_cast<int32_t>(sizeof(meta_buf)) || is_flushed(meta_buf) ) {
+		return false;
+	}
+
+	ClockTime flush = flush_clocktime();
+
+	return m_op.update(m_data,
+			raw_key, raw_keylen,
+			raw_val, raw_vallen,
+			&storage_replaceproc,
+			reinterpret_cast<void*>(&flush));
+}
+
+
+bool Storage::flush(ClockTime flush_clocktime)
+{
+	while(true) {
+		uint64_t x = m_flush_clocktime;
+		if(!(ClockTime(x) < flush_clocktime)) {
+			return false;
+		}
+		if(__sync_bool_compare_and_swap(&m_flush_clocktime,
+					x, flush_clocktime.get())) {
+			return true;
+		}
+	}
+}
+
+
 namespace {
 struct scoped_clock_key {
 	scoped_clock_key(const char* key, uint32_t keylen, ClockTime clocktime)
@@ -269,6 +358,7 @@ struct for_each_data {
 	void (*callback)(void* obj, Storage::iterator& it);
 	void* obj;
 	ClockTime clocktime_limit;
+	ClockTime flush_clocktime;
 };
 
 static int for_each_collect(void* user, void* iterator_data)
@@ -301,6 +391,17 @@ try {
 		return 0;
 	}
 
+	if(data->flush_clocktime.get() != 0 &&
+			Storage::clocktime_of(val) < data->flush_clocktime) {
+		// flushed
+		if(data->clocktime_limit.get() != 0) {
+			data->op->iterator_del(iterator_data,
+					&storage_updateproc,
+					reinterpret_cast<void*>(&data->flush_clocktime));
+		}
+		return 0;
+	}
+
 	Storage::iterator it(data->op, iterator_data);
 	(*data->callback)(data->obj, it);
 
@@ -319,6 +420,7 @@ void Storage::for_each_impl(void* obj, void (*callback)(void* obj, iterator& it)
 		callback,
 		obj,
 		clocktime.before_sec(m_garbage_max_time),
+		flush_clocktime(),
 	};
 
 	int ret = m_op.for_each(m_data,
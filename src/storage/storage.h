@@ -135,10 +135,26 @@ public:
 			const char* raw_key, uint32_t raw_keylen,
 			const char* raw_val, uint32_t raw_vallen);
 
+	// stored only if the key is not found
+	bool add(
+			const char* raw_key, uint32_t raw_keylen,
+			const char* raw_val, uint32_t raw_vallen);
+
+	// stored only if the key is found
+	bool replace(
+			const char* raw_key, uint32_t raw_keylen,
+			const char* raw_val, uint32_t raw_vallen);
+
 	bool remove(
 			const char* raw_key, uint32_t raw_keylen,
 			ClockTime update_clocktime);
 
+	// values older than the clocktime are treated as not found.
+	// they are deleted lazily while iterating the database.
+	// returns false if the clocktime is not newer than the current one.
+	bool flush(ClockTime flush_clocktime);
+	ClockTime flush_clocktime() const;
+
 	// FIXME
 	//bool append(
 	//		const char* raw_key, uint32_t raw_keylen,
@@ -180,6 +196,10 @@ private:
 	void* m_data;
 	kumo_storage_op m_op;
 
+	volatile uint64_t m_flush_clocktime;
+
+	bool is_flushed(const char* raw_val) const;
+
 	mp::pthread_mutex m_garbage_mutex;
 	buffer_queue m_garbage;
 
@@ -235,12 +255,24 @@ inline const char* Storage::get(
 			raw_key, raw_keylen,
 			result_raw_vallen,
 			z);
-	if(raw_val && *result_raw_vallen < VALUE_META_SIZE) {
+	if(raw_val && (*result_raw_vallen < VALUE_META_SIZE ||
+				is_flushed(raw_val))) {
 		return NULL;
 	}
 	return raw_val;
 }
 
+inline ClockTime Storage::flush_clocktime() const
+{
+	return ClockTime(m_flush_clocktime);
+}
+
+inline bool Storage::is_flushed(const char* raw_val) const
+{
+	return m_flush_clocktime != 0 &&
+		clocktime_of(raw_val) < flush_clocktime();
+}
+
 inline bool Storage::cache_is_valid(
 		const char* raw_key, uint32_t raw_keylen,
 		ClockTime cache_clocktime)
@@ -253,6 +285,10 @@ inline bool Storage::cache_is_valid(
 		return false;
 	}
 
+	if(is_flushed(meta_buf)) {
+		return false;
+	}
+
 	return clocktime_of(meta_buf) <= cache_clocktime;
 }
 